@@ -0,0 +1,218 @@
+#include "AllocTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Every tracked block is prefixed with a small header that remembers its size and owning subsystem, so frees
+// are attributed to the subsystem that made the allocation. 16 bytes keeps the user pointer aligned for any type.
+struct AllocHeader
+{
+	uint64_t Size;
+	uint32_t Subsystem;
+	uint32_t Padding;
+};
+static_assert(sizeof(AllocHeader) == 16, "AllocHeader must preserve 16 byte alignment");
+
+struct SubsystemCounters
+{
+	std::atomic<uint64_t> Allocations;
+	std::atomic<uint64_t> Frees;
+	std::atomic<uint64_t> BytesAllocated;
+	std::atomic<uint64_t> LiveBytes;
+};
+
+// zero initialized before any dynamic initializer runs, so allocations from static constructors are counted too
+static SubsystemCounters counters[ALLOC_SUBSYSTEM_COUNT];
+static std::atomic<uint64_t> totalAllocations;
+static std::atomic<uint64_t> totalBytes;
+static uint64_t frameStartAllocations = 0;
+static uint64_t frameStartBytes = 0;
+
+static thread_local Alloc_Subsystem currentSubsystem = ALLOC_UNTAGGED;
+static thread_local bool countsTowardsFrames = true;
+
+static void recordAllocation(AllocHeader* header, size_t size)
+{
+	header->Size = size;
+	header->Subsystem = currentSubsystem;
+	SubsystemCounters& c = counters[header->Subsystem];
+	c.Allocations.fetch_add(1, std::memory_order_relaxed);
+	c.BytesAllocated.fetch_add(size, std::memory_order_relaxed);
+	c.LiveBytes.fetch_add(size, std::memory_order_relaxed);
+	if (countsTowardsFrames)
+	{
+		totalAllocations.fetch_add(1, std::memory_order_relaxed);
+		totalBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+static void recordFree(AllocHeader* header)
+{
+	SubsystemCounters& c = counters[header->Subsystem];
+	c.Frees.fetch_add(1, std::memory_order_relaxed);
+	c.LiveBytes.fetch_sub(header->Size, std::memory_order_relaxed);
+}
+
+void* AllocTracker::Malloc(size_t size)
+{
+	AllocHeader* header = (AllocHeader*)std::malloc(sizeof(AllocHeader) + size);
+	if (header == nullptr)
+		return nullptr;
+	recordAllocation(header, size);
+	return header + 1;
+}
+
+void* AllocTracker::Realloc(void* ptr, size_t size)
+{
+	if (ptr == nullptr)
+		return Malloc(size);
+
+	AllocHeader* header = (AllocHeader*)ptr - 1;
+	AllocHeader old = *header;
+	AllocHeader* grown = (AllocHeader*)std::realloc(header, sizeof(AllocHeader) + size);
+	if (grown == nullptr)
+		return nullptr; // the original block is untouched and still owned by the caller
+	// a realloc counts as a free of the old block and a new allocation charged to the current subsystem
+	recordFree(&old);
+	recordAllocation(grown, size);
+	return grown + 1;
+}
+
+void AllocTracker::Free(void* ptr)
+{
+	if (ptr == nullptr)
+		return;
+	AllocHeader* header = (AllocHeader*)ptr - 1;
+	recordFree(header);
+	std::free(header);
+}
+
+void AllocTracker::BeginFrame()
+{
+	frameStartAllocations = totalAllocations.load(std::memory_order_relaxed);
+	frameStartBytes = totalBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocTracker::FrameAllocations()
+{
+	return totalAllocations.load(std::memory_order_relaxed) - frameStartAllocations;
+}
+
+uint64_t AllocTracker::FrameBytes()
+{
+	return totalBytes.load(std::memory_order_relaxed) - frameStartBytes;
+}
+
+void AllocTracker::ExcludeThreadFromFrames()
+{
+	countsTowardsFrames = false;
+}
+
+AllocStats AllocTracker::GetStats(Alloc_Subsystem subsystem)
+{
+	const SubsystemCounters& c = counters[subsystem];
+	AllocStats stats;
+	stats.Allocations = c.Allocations.load(std::memory_order_relaxed);
+	stats.Frees = c.Frees.load(std::memory_order_relaxed);
+	stats.BytesAllocated = c.BytesAllocated.load(std::memory_order_relaxed);
+	stats.LiveBytes = c.LiveBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+const char* AllocTracker::SubsystemName(Alloc_Subsystem subsystem)
+{
+	switch (subsystem)
+	{
+	case ALLOC_UNTAGGED: return "untagged";
+	case ALLOC_RENDER: return "render";
+	case ALLOC_SHADER: return "shader";
+	case ALLOC_TEXTURE: return "texture";
+	case ALLOC_INPUT: return "input";
+	default: return "unknown";
+	}
+}
+
+void AllocTracker::PrintReport()
+{
+	// snapshot first, printing through std::cout may allocate itself
+	AllocStats stats[ALLOC_SUBSYSTEM_COUNT];
+	for (int i = 0; i < ALLOC_SUBSYSTEM_COUNT; i++)
+		stats[i] = GetStats((Alloc_Subsystem)i);
+
+	std::cout << "ALLOC::REPORT subsystem allocations frees bytes live_bytes" << std::endl;
+	for (int i = 0; i < ALLOC_SUBSYSTEM_COUNT; i++)
+	{
+		std::cout << "  " << SubsystemName((Alloc_Subsystem)i) << " " << stats[i].Allocations << " " << stats[i].Frees
+			<< " " << stats[i].BytesAllocated << " " << stats[i].LiveBytes << std::endl;
+	}
+}
+
+AllocScope::AllocScope(Alloc_Subsystem subsystem) : previous(currentSubsystem)
+{
+	currentSubsystem = subsystem;
+}
+
+AllocScope::~AllocScope()
+{
+	currentSubsystem = previous;
+}
+
+// global operator new/delete replacements, all routed through the tracker
+// ------------------------------------------------------------------------
+void* operator new(size_t size)
+{
+	void* ptr = AllocTracker::Malloc(size);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	void* ptr = AllocTracker::Malloc(size);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return AllocTracker::Malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return AllocTracker::Malloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	AllocTracker::Free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	AllocTracker::Free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	AllocTracker::Free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	AllocTracker::Free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	AllocTracker::Free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	AllocTracker::Free(ptr);
+}
@@ -0,0 +1,63 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Subsystems heap allocations can be attributed to. Allocations made outside of any AllocScope land in ALLOC_UNTAGGED
+enum Alloc_Subsystem {
+	ALLOC_UNTAGGED,
+	ALLOC_RENDER,
+	ALLOC_SHADER,
+	ALLOC_TEXTURE,
+	ALLOC_INPUT,
+	ALLOC_SUBSYSTEM_COUNT
+};
+
+// Snapshot of the counters of one subsystem
+struct AllocStats
+{
+	uint64_t Allocations;
+	uint64_t Frees;
+	uint64_t BytesAllocated;
+	uint64_t LiveBytes;
+};
+
+// Counts every heap allocation made through the global operator new/delete (hooked in AllocTracker.cpp) and through
+// stb_image's STBI_MALLOC/STBI_REALLOC/STBI_FREE hooks. Counters are atomics, so tracking is safe from any thread.
+class AllocTracker
+{
+public:
+	// malloc/realloc/free replacements that keep the counters up to date. Memory must be released by the same family
+	static void* Malloc(size_t size);
+	static void* Realloc(void* ptr, size_t size);
+	static void Free(void* ptr);
+
+	// Marks the start of a frame, FrameAllocations() reports the number of allocations made since then
+	static void BeginFrame();
+	static uint64_t FrameAllocations();
+	static uint64_t FrameBytes();
+	// Leaves the calling thread's allocations out of the frame counters from now on, for background threads (texture
+	// decoding) whose work is not part of any frame. They are still attributed to their subsystem
+	static void ExcludeThreadFromFrames();
+
+	static AllocStats GetStats(Alloc_Subsystem subsystem);
+	static const char* SubsystemName(Alloc_Subsystem subsystem);
+	// Prints the per-subsystem totals to stdout
+	static void PrintReport();
+};
+
+// Attributes every allocation made on this thread to the given subsystem for as long as the scope lives. Scopes nest
+class AllocScope
+{
+public:
+	explicit AllocScope(Alloc_Subsystem subsystem);
+	~AllocScope();
+
+	AllocScope(const AllocScope&) = delete;
+	AllocScope& operator=(const AllocScope&) = delete;
+
+private:
+	Alloc_Subsystem previous;
+};
+#endif
@@ -0,0 +1,947 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE 1
+#endif
+
+// Error of compressed texels against their source, summed over every channel the format stores
+struct BlockCompressionStats
+{
+	double SquaredError = 0.0;
+	uint64_t Samples = 0;
+
+	double Rmse() const
+	{
+		return Samples > 0 ? std::sqrt(SquaredError / Samples) : 0.0;
+	}
+
+	// peak signal to noise ratio in dB, infinite for a lossless result
+	double Psnr() const
+	{
+		double mse = Samples > 0 ? SquaredError / Samples : 0.0;
+		return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : HUGE_VAL;
+	}
+
+	void Add(const BlockCompressionStats& other)
+	{
+		SquaredError += other.SquaredError;
+		Samples += other.Samples;
+	}
+};
+
+// Encodes 4x4 texel blocks to BC1 (RGB), BC4 (R), BC5 (RG) and BC7 mode 6 (RGBA), and decodes them again to measure
+// the error. Endpoints come from the principal axis of the block's colours (FAST uses the inset bounding box for BC1),
+// NORMAL and HIGH refine them by least squares against the chosen indices and keep whichever candidate has the lowest
+// error. The nearest palette entry for all 16 texels is found with SSE2, 8 channels a register, or one texel at a time
+// without it. Blocks hold RGBA texels, channels a format doesn't store are ignored.
+class BlockCompressor
+{
+public:
+	// Writes one block of the given compressed format, 8 or 16 bytes
+	static void Encode(Texture_Format format, const unsigned char texels[16][4], Texture_Compression quality, unsigned char* out)
+	{
+		switch (format)
+		{
+		case TEXTURE_FORMAT_BC1:
+			encodeBC1(texels, quality, out);
+			break;
+		case TEXTURE_FORMAT_BC4:
+			encodeBC4(texels, 0, quality, out);
+			break;
+		case TEXTURE_FORMAT_BC5:
+			encodeBC4(texels, 0, quality, out);
+			encodeBC4(texels, 1, quality, out + 8);
+			break;
+		case TEXTURE_FORMAT_BC7:
+			encodeBC7(texels, quality, out);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Decodes one block into RGBA texels, unused channels come out as 0 and alpha as 255
+	static void Decode(Texture_Format format, const unsigned char* block, unsigned char texels[16][4])
+	{
+		memset(texels, 0, 16 * 4);
+		for (int i = 0; i < 16; i++)
+			texels[i][3] = 255;
+		switch (format)
+		{
+		case TEXTURE_FORMAT_BC1:
+			decodeBC1(block, texels);
+			break;
+		case TEXTURE_FORMAT_BC4:
+			decodeBC4(block, 0, texels);
+			break;
+		case TEXTURE_FORMAT_BC5:
+			decodeBC4(block, 0, texels);
+			decodeBC4(block + 8, 1, texels);
+			break;
+		case TEXTURE_FORMAT_BC7:
+			decodeBC7(block, texels);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Turns the SSE2 index search off so the benchmark can compare it with the scalar one. Not for use while blocks
+	// are being encoded
+	static void SetSimdEnabled(bool enabled)
+	{
+		simdEnabled() = enabled;
+	}
+
+	static bool SimdAvailable()
+	{
+#if defined(BLOCK_COMPRESSION_SSE)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+private:
+	// BC7 mode 6 interpolation weights, out of 64
+	static const int* bc7Weights()
+	{
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		return weights;
+	}
+
+	static bool& simdEnabled()
+	{
+		static bool enabled = true;
+		return enabled;
+	}
+
+	// Texels widened to 16 bits, RGBA one texel after the other, the layout the index search loads 2 texels from
+	struct Texels16
+	{
+		int16_t Values[16 * 4];
+	};
+
+	static void widen(const unsigned char texels[16][4], const int* channels, int channelCount, Texels16& out)
+	{
+		memset(out.Values, 0, sizeof(out.Values));
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channelCount; c++)
+				out.Values[i * 4 + c] = texels[i][channels[c]];
+		}
+	}
+
+	// Nearest palette entry by squared RGBA distance for every texel, ties go to the lower index. Returns the summed
+	// squared error
+	static int selectIndices(const Texels16& texels, const int16_t (*palette)[4], int paletteSize, unsigned char indices[16])
+	{
+#if defined(BLOCK_COMPRESSION_SSE)
+		if (simdEnabled())
+			return selectIndicesSse(texels, palette, paletteSize, indices);
+#endif
+		return selectIndicesScalar(texels, palette, paletteSize, indices);
+	}
+
+	static int selectIndicesScalar(const Texels16& texels, const int16_t (*palette)[4], int paletteSize, unsigned char indices[16])
+	{
+		int total = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const int16_t* texel = &texels.Values[i * 4];
+			int best = INT_MAX;
+			for (int p = 0; p < paletteSize; p++)
+			{
+				int distance = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					int d = texel[c] - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					indices[i] = (unsigned char)p;
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+#if defined(BLOCK_COMPRESSION_SSE)
+	static int selectIndicesSse(const Texels16& texels, const int16_t (*palette)[4], int paletteSize, unsigned char indices[16])
+	{
+		// two texels a register, madd squares and adds channel pairs, shuffling the even and odd lanes apart adds the
+		// pairs of 4 texels up to their distances
+		__m128i pairs[8];
+		for (int i = 0; i < 8; i++)
+			pairs[i] = _mm_loadu_si128((const __m128i*)&texels.Values[i * 8]);
+		__m128i best[4], bestIndex[4];
+		for (int g = 0; g < 4; g++)
+		{
+			best[g] = _mm_set1_epi32(INT_MAX);
+			bestIndex[g] = _mm_setzero_si128();
+		}
+		for (int p = 0; p < paletteSize; p++)
+		{
+			__m128i entry = _mm_loadl_epi64((const __m128i*)palette[p]);
+			entry = _mm_unpacklo_epi64(entry, entry);
+			__m128i index = _mm_set1_epi32(p);
+			for (int g = 0; g < 4; g++)
+			{
+				__m128i d0 = _mm_sub_epi16(pairs[2 * g], entry);
+				__m128i d1 = _mm_sub_epi16(pairs[2 * g + 1], entry);
+				__m128 s0 = _mm_castsi128_ps(_mm_madd_epi16(d0, d0));
+				__m128 s1 = _mm_castsi128_ps(_mm_madd_epi16(d1, d1));
+				__m128i even = _mm_castps_si128(_mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0)));
+				__m128i odd = _mm_castps_si128(_mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1)));
+				__m128i distance = _mm_add_epi32(even, odd);
+				__m128i closer = _mm_cmplt_epi32(distance, best[g]);
+				best[g] = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best[g]));
+				bestIndex[g] = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex[g]));
+			}
+		}
+		int32_t errors[4], chosen[16];
+		__m128i sum = _mm_setzero_si128();
+		for (int g = 0; g < 4; g++)
+		{
+			_mm_storeu_si128((__m128i*)&chosen[g * 4], bestIndex[g]);
+			sum = _mm_add_epi32(sum, best[g]);
+		}
+		_mm_storeu_si128((__m128i*)errors, sum);
+		for (int i = 0; i < 16; i++)
+			indices[i] = (unsigned char)chosen[i];
+		return errors[0] + errors[1] + errors[2] + errors[3];
+	}
+#endif
+
+	// Principal axis of the first channelCount channels through power iteration on the covariance matrix. Writes the
+	// lowest and highest points of the texels projected onto the axis
+	static void principalEndpoints(const unsigned char texels[16][4], int channelCount, float low[4], float high[4])
+	{
+		float mean[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channelCount; c++)
+				mean[c] += texels[i][c];
+		}
+		for (int c = 0; c < channelCount; c++)
+			mean[c] /= 16.0f;
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float d[4];
+			for (int c = 0; c < channelCount; c++)
+				d[c] = texels[i][c] - mean[c];
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = a; b < channelCount; b++)
+					covariance[a][b] += d[a] * d[b];
+			}
+		}
+		for (int a = 0; a < channelCount; a++)
+		{
+			for (int b = 0; b < a; b++)
+				covariance[a][b] = covariance[b][a];
+		}
+
+		// start from the channel with the largest spread, that axis can't be orthogonal to the principal one
+		float axis[4] = {};
+		int widest = 0;
+		for (int c = 1; c < channelCount; c++)
+		{
+			if (covariance[c][c] > covariance[widest][widest])
+				widest = c;
+		}
+		for (int c = 0; c < channelCount; c++)
+			axis[c] = covariance[widest][c];
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = 0; b < channelCount; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length = std::max(length, std::fabs(next[a]));
+			}
+			if (length < 1e-12f)
+				break;
+			for (int c = 0; c < channelCount; c++)
+				axis[c] = next[c] / length;
+		}
+		float length = 0.0f;
+		for (int c = 0; c < channelCount; c++)
+			length += axis[c] * axis[c];
+		if (length < 1e-12f)
+		{
+			// a single colour, both endpoints on the mean
+			for (int c = 0; c < channelCount; c++)
+				low[c] = high[c] = mean[c];
+			return;
+		}
+		length = std::sqrt(length);
+		for (int c = 0; c < channelCount; c++)
+			axis[c] /= length;
+
+		float minimum = 1e30f, maximum = -1e30f;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channelCount; c++)
+				t += (texels[i][c] - mean[c]) * axis[c];
+			minimum = std::min(minimum, t);
+			maximum = std::max(maximum, t);
+		}
+		for (int c = 0; c < channelCount; c++)
+		{
+			low[c] = std::min(std::max(mean[c] + axis[c] * minimum, 0.0f), 255.0f);
+			high[c] = std::min(std::max(mean[c] + axis[c] * maximum, 0.0f), 255.0f);
+		}
+	}
+
+	// Endpoints that best reproduce the texels for the given indices, weights[index] being the share of endpoint 1.
+	// False when every texel picked the same weight
+	static bool leastSquaresEndpoints(const unsigned char texels[16][4], int channelCount, const unsigned char indices[16],
+		const float* weights, float e0[4], float e1[4])
+	{
+		float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float b = weights[indices[i]];
+			float a = 1.0f - b;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			for (int c = 0; c < channelCount; c++)
+			{
+				ax[c] += a * texels[i][c];
+				bx[c] += b * texels[i][c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return false;
+		for (int c = 0; c < channelCount; c++)
+		{
+			e0[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+			e1[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// BC1
+	// ---
+	static int expand5(int value)
+	{
+		return (value << 3) | (value >> 2);
+	}
+
+	static int expand6(int value)
+	{
+		return (value << 2) | (value >> 4);
+	}
+
+	static uint16_t pack565(const float color[3])
+	{
+		int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+		int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+		int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)(r << 11 | g << 5 | b);
+	}
+
+	static void unpack565(uint16_t color, int out[3])
+	{
+		out[0] = expand5(color >> 11);
+		out[1] = expand6((color >> 5) & 63);
+		out[2] = expand5(color & 31);
+	}
+
+	// c0 > c1 selects the four colour mode, 1/3 and 2/3 of the way between the endpoints. c0 <= c1 is the three colour
+	// mode with the midpoint and black
+	static void bc1Palette(uint16_t c0, uint16_t c1, int16_t palette[4][4])
+	{
+		int a[3], b[3];
+		unpack565(c0, a);
+		unpack565(c1, b);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[0][c] = (int16_t)a[c];
+			palette[1][c] = (int16_t)b[c];
+			if (c0 > c1)
+			{
+				palette[2][c] = (int16_t)((2 * a[c] + b[c]) / 3);
+				palette[3][c] = (int16_t)((a[c] + 2 * b[c]) / 3);
+			}
+			else
+			{
+				palette[2][c] = (int16_t)((a[c] + b[c]) / 2);
+				palette[3][c] = 0;
+			}
+		}
+		for (int p = 0; p < 4; p++)
+			palette[p][3] = 0;
+	}
+
+	// For every 8 bit value the 5 and 6 bit endpoint pairs whose 2/3 point reproduces it best, a block of one colour
+	// is encoded exactly through index 2 instead of whatever rounding both endpoints to 565 gives
+	struct SingleColorTables
+	{
+		unsigned char Endpoints5[256][2];
+		unsigned char Endpoints6[256][2];
+
+		SingleColorTables()
+		{
+			build(5, Endpoints5);
+			build(6, Endpoints6);
+		}
+
+		static void build(int bits, unsigned char (*table)[2])
+		{
+			int levels = 1 << bits;
+			for (int value = 0; value < 256; value++)
+			{
+				int bestError = INT_MAX;
+				for (int e0 = 0; e0 < levels; e0++)
+				{
+					for (int e1 = 0; e1 < levels; e1++)
+					{
+						int a = bits == 5 ? expand5(e0) : expand6(e0);
+						int b = bits == 5 ? expand5(e1) : expand6(e1);
+						// prefer close endpoints, decoders that interpolate differently then still land near value
+						int error = std::abs((2 * a + b) / 3 - value) * 256 + std::abs(a - b);
+						if (error < bestError)
+						{
+							bestError = error;
+							table[value][0] = (unsigned char)e0;
+							table[value][1] = (unsigned char)e1;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	static const SingleColorTables& singleColorTables()
+	{
+		static const SingleColorTables tables;
+		return tables;
+	}
+
+	static void writeBC1(uint16_t c0, uint16_t c1, const unsigned char indices[16], unsigned char* out)
+	{
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (uint32_t)indices[i] << (2 * i);
+		out[0] = (unsigned char)(c0 & 0xFF);
+		out[1] = (unsigned char)(c0 >> 8);
+		out[2] = (unsigned char)(c1 & 0xFF);
+		out[3] = (unsigned char)(c1 >> 8);
+		for (int i = 0; i < 4; i++)
+			out[4 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	// Quantizes a pair of endpoints and picks the indices, keeping the four colour mode. Returns the error
+	static int fitBC1(const Texels16& texels, const float e0[3], const float e1[3], uint16_t& c0, uint16_t& c1, unsigned char indices[16])
+	{
+		c0 = pack565(e0);
+		c1 = pack565(e1);
+		if (c0 < c1)
+			std::swap(c0, c1);
+		int16_t palette[4][4];
+		bc1Palette(c0, c1, palette);
+		if (c0 == c1)
+		{
+			// both endpoints collapsed to one colour, that is all index 0 can give
+			memset(indices, 0, 16);
+			return selectIndices(texels, palette, 1, indices);
+		}
+		return selectIndices(texels, palette, 4, indices);
+	}
+
+	static void encodeBC1(const unsigned char texels[16][4], Texture_Compression quality, unsigned char* out)
+	{
+		const int rgb[3] = { 0, 1, 2 };
+		Texels16 wide;
+		widen(texels, rgb, 3, wide);
+
+		bool single = true;
+		for (int i = 1; i < 16 && single; i++)
+			single = texels[i][0] == texels[0][0] && texels[i][1] == texels[0][1] && texels[i][2] == texels[0][2];
+		if (single)
+		{
+			const SingleColorTables& tables = singleColorTables();
+			const unsigned char* r = tables.Endpoints5[texels[0][0]];
+			const unsigned char* g = tables.Endpoints6[texels[0][1]];
+			const unsigned char* b = tables.Endpoints5[texels[0][2]];
+			uint16_t c0 = (uint16_t)(r[0] << 11 | g[0] << 5 | b[0]);
+			uint16_t c1 = (uint16_t)(r[1] << 11 | g[1] << 5 | b[1]);
+			unsigned char indices[16];
+			memset(indices, 2, 16);
+			if (c0 < c1)
+			{
+				std::swap(c0, c1);
+				memset(indices, 3, 16);
+			}
+			else if (c0 == c1)
+				memset(indices, 0, 16);
+			writeBC1(c0, c1, indices, out);
+			return;
+		}
+
+		float e0[3], e1[3];
+		if (quality == TEXTURE_COMPRESSION_FAST)
+			insetBoundingBox(texels, e0, e1);
+		else
+			principalEndpoints(texels, 3, e1, e0);
+		uint16_t c0, c1;
+		unsigned char indices[16];
+		int error = fitBC1(wide, e0, e1, c0, c1, indices);
+
+		// weight of c1 for each index, the palette order is c0, c1, 1/3, 2/3
+		const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		int refinements = quality == TEXTURE_COMPRESSION_HIGH ? 4 : quality == TEXTURE_COMPRESSION_NORMAL ? 1 : 0;
+		for (int iteration = 0; iteration < refinements && c0 != c1; iteration++)
+		{
+			float r0[3], r1[3];
+			if (!leastSquaresEndpoints(texels, 3, indices, weights, r0, r1))
+				break;
+			uint16_t t0, t1;
+			unsigned char candidate[16];
+			int candidateError = fitBC1(wide, r0, r1, t0, t1, candidate);
+			if (candidateError >= error)
+				break;
+			error = candidateError;
+			c0 = t0;
+			c1 = t1;
+			memcpy(indices, candidate, 16);
+		}
+		if (quality == TEXTURE_COMPRESSION_HIGH)
+		{
+			// the bounding box sometimes beats the principal axis on blocks with several clusters
+			insetBoundingBox(texels, e0, e1);
+			uint16_t t0, t1;
+			unsigned char candidate[16];
+			if (fitBC1(wide, e0, e1, t0, t1, candidate) < error)
+			{
+				c0 = t0;
+				c1 = t1;
+				memcpy(indices, candidate, 16);
+			}
+		}
+		writeBC1(c0, c1, indices, out);
+	}
+
+	// Bounding box of the colours shrunk by 1/16 on every side, along the diagonal the colours actually follow
+	static void insetBoundingBox(const unsigned char texels[16][4], float e0[3], float e1[3])
+	{
+		int minimum[3] = { 255, 255, 255 }, maximum[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				minimum[c] = std::min(minimum[c], (int)texels[i][c]);
+				maximum[c] = std::max(maximum[c], (int)texels[i][c]);
+			}
+		}
+		float center[3];
+		for (int c = 0; c < 3; c++)
+		{
+			float inset = (maximum[c] - minimum[c]) / 16.0f;
+			e0[c] = maximum[c] - inset;
+			e1[c] = minimum[c] + inset;
+			center[c] = (maximum[c] + minimum[c]) * 0.5f;
+		}
+		float greenRed = 0.0f, blueRed = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float r = texels[i][0] - center[0];
+			greenRed += r * (texels[i][1] - center[1]);
+			blueRed += r * (texels[i][2] - center[2]);
+		}
+		if (greenRed < 0.0f)
+			std::swap(e0[1], e1[1]);
+		if (blueRed < 0.0f)
+			std::swap(e0[2], e1[2]);
+	}
+
+	static void decodeBC1(const unsigned char* block, unsigned char texels[16][4])
+	{
+		uint16_t c0 = (uint16_t)(block[0] | block[1] << 8);
+		uint16_t c1 = (uint16_t)(block[2] | block[3] << 8);
+		int16_t palette[4][4];
+		bc1Palette(c0, c1, palette);
+		uint32_t bits = (uint32_t)block[4] | (uint32_t)block[5] << 8 | (uint32_t)block[6] << 16 | (uint32_t)block[7] << 24;
+		for (int i = 0; i < 16; i++)
+		{
+			int index = (bits >> (2 * i)) & 3;
+			for (int c = 0; c < 3; c++)
+				texels[i][c] = (unsigned char)palette[index][c];
+		}
+	}
+
+	// BC4
+	// ---
+	// e0 > e1 interpolates 6 values between the endpoints, e0 <= e1 interpolates 4 and adds 0 and 255
+	static void bc4Palette(int e0, int e1, int16_t palette[8][4])
+	{
+		memset(palette, 0, sizeof(int16_t) * 8 * 4);
+		palette[0][0] = (int16_t)e0;
+		palette[1][0] = (int16_t)e1;
+		if (e0 > e1)
+		{
+			for (int code = 2; code < 8; code++)
+				palette[code][0] = (int16_t)(((8 - code) * e0 + (code - 1) * e1) / 7);
+		}
+		else
+		{
+			for (int code = 2; code < 6; code++)
+				palette[code][0] = (int16_t)(((6 - code) * e0 + (code - 1) * e1) / 5);
+			palette[6][0] = 0;
+			palette[7][0] = 255;
+		}
+	}
+
+	static int fitBC4(const Texels16& texels, int e0, int e1, unsigned char indices[16])
+	{
+		int16_t palette[8][4];
+		bc4Palette(e0, e1, palette);
+		return selectIndices(texels, palette, 8, indices);
+	}
+
+	static void encodeBC4(const unsigned char texels[16][4], int channel, Texture_Compression quality, unsigned char* out)
+	{
+		Texels16 wide;
+		widen(texels, &channel, 1, wide);
+		int minimum = 255, maximum = 0, innerMinimum = 255, innerMaximum = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int value = texels[i][channel];
+			minimum = std::min(minimum, value);
+			maximum = std::max(maximum, value);
+			if (value != 0 && value != 255)
+			{
+				innerMinimum = std::min(innerMinimum, value);
+				innerMaximum = std::max(innerMaximum, value);
+			}
+		}
+
+		int e0 = maximum, e1 = minimum;
+		unsigned char indices[16];
+		int error = fitBC4(wide, e0, e1, indices);
+		if (quality == TEXTURE_COMPRESSION_HIGH && error > 0)
+		{
+			for (int high = std::max(maximum - 2, 1); high <= std::min(maximum + 2, 255); high++)
+			{
+				for (int low = std::max(minimum - 2, 0); low <= std::min(minimum + 2, high - 1); low++)
+				{
+					unsigned char candidate[16];
+					int candidateError = fitBC4(wide, high, low, candidate);
+					if (candidateError < error)
+					{
+						error = candidateError;
+						e0 = high;
+						e1 = low;
+						memcpy(indices, candidate, 16);
+					}
+				}
+			}
+		}
+		if (quality != TEXTURE_COMPRESSION_FAST && error > 0 && innerMinimum <= innerMaximum)
+		{
+			// values at 0 and 255 come for free in the 6 value mode, the rest share a narrower range
+			unsigned char candidate[16];
+			int candidateError = fitBC4(wide, innerMinimum, innerMaximum, candidate);
+			if (candidateError < error)
+			{
+				error = candidateError;
+				e0 = innerMinimum;
+				e1 = innerMaximum;
+				memcpy(indices, candidate, 16);
+			}
+		}
+
+		out[0] = (unsigned char)e0;
+		out[1] = (unsigned char)e1;
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (uint64_t)indices[i] << (3 * i);
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	static void decodeBC4(const unsigned char* block, int channel, unsigned char texels[16][4])
+	{
+		int16_t palette[8][4];
+		bc4Palette(block[0], block[1], palette);
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= (uint64_t)block[2 + i] << (8 * i);
+		for (int i = 0; i < 16; i++)
+			texels[i][channel] = (unsigned char)palette[(bits >> (3 * i)) & 7][0];
+	}
+
+	// BC7 mode 6
+	// ----------
+	// One subset, RGBA endpoints of 7 bits plus a shared lowest bit per endpoint, 16 weights
+	struct Bc7Endpoints
+	{
+		int Values[2][4]; // 7 bit
+		int PBits[2];
+	};
+
+	static void bc7Palette(const Bc7Endpoints& endpoints, int16_t palette[16][4])
+	{
+		const int* weights = bc7Weights();
+		for (int c = 0; c < 4; c++)
+		{
+			int a = endpoints.Values[0][c] << 1 | endpoints.PBits[0];
+			int b = endpoints.Values[1][c] << 1 | endpoints.PBits[1];
+			for (int p = 0; p < 16; p++)
+				palette[p][c] = (int16_t)(((64 - weights[p]) * a + weights[p] * b + 32) >> 6);
+		}
+	}
+
+	// The 7 bit value closest to an endpoint channel for the given lowest bit, and its squared error
+	static int quantizeBC7(float value, int pBit, float& error)
+	{
+		int quantized = std::min(std::max((int)((value - pBit) * 0.5f + 0.5f), 0), 127);
+		float d = (float)(quantized << 1 | pBit) - value;
+		error += d * d;
+		return quantized;
+	}
+
+	// Quantizes both endpoints. pBitMask bit 0 and 1 force the lowest bits, -1 picks the closer one for each endpoint
+	static void quantizeBC7Endpoints(const float e0[4], const float e1[4], int pBitMask, Bc7Endpoints& endpoints)
+	{
+		const float* sources[2] = { e0, e1 };
+		for (int e = 0; e < 2; e++)
+		{
+			int best = 0;
+			float bestError = 1e30f;
+			for (int pBit = 0; pBit < 2; pBit++)
+			{
+				if (pBitMask >= 0 && pBit != ((pBitMask >> e) & 1))
+					continue;
+				float error = 0.0f;
+				int values[4];
+				for (int c = 0; c < 4; c++)
+					values[c] = quantizeBC7(sources[e][c], pBit, error);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = pBit;
+					memcpy(endpoints.Values[e], values, sizeof(values));
+				}
+			}
+			endpoints.PBits[e] = best;
+		}
+	}
+
+	// Tries the lowest bit combinations allowed at this quality, keeps the best fit of these endpoints
+	static int fitBC7(const Texels16& texels, const float e0[4], const float e1[4], bool allPBits, Bc7Endpoints& endpoints,
+		unsigned char indices[16])
+	{
+		int error = INT_MAX;
+		for (int mask = allPBits ? 0 : -1; mask < (allPBits ? 4 : 0); mask++)
+		{
+			Bc7Endpoints candidate;
+			quantizeBC7Endpoints(e0, e1, mask, candidate);
+			int16_t palette[16][4];
+			bc7Palette(candidate, palette);
+			unsigned char candidateIndices[16];
+			int candidateError = selectIndices(texels, palette, 16, candidateIndices);
+			if (candidateError < error)
+			{
+				error = candidateError;
+				endpoints = candidate;
+				memcpy(indices, candidateIndices, 16);
+			}
+		}
+		return error;
+	}
+
+	static void encodeBC7(const unsigned char texels[16][4], Texture_Compression quality, unsigned char* out)
+	{
+		const int rgba[4] = { 0, 1, 2, 3 };
+		Texels16 wide;
+		widen(texels, rgba, 4, wide);
+
+		float e0[4], e1[4];
+		principalEndpoints(texels, 4, e0, e1);
+		bool allPBits = quality != TEXTURE_COMPRESSION_FAST;
+		Bc7Endpoints endpoints;
+		unsigned char indices[16];
+		int error = fitBC7(wide, e0, e1, allPBits, endpoints, indices);
+
+		float weights[16];
+		for (int p = 0; p < 16; p++)
+			weights[p] = bc7Weights()[p] / 64.0f;
+		int refinements = quality == TEXTURE_COMPRESSION_HIGH ? 3 : quality == TEXTURE_COMPRESSION_NORMAL ? 1 : 0;
+		for (int iteration = 0; iteration < refinements && error > 0; iteration++)
+		{
+			float r0[4], r1[4];
+			if (!leastSquaresEndpoints(texels, 4, indices, weights, r0, r1))
+				break;
+			Bc7Endpoints candidate;
+			unsigned char candidateIndices[16];
+			int candidateError = fitBC7(wide, r0, r1, allPBits, candidate, candidateIndices);
+			if (candidateError >= error)
+				break;
+			error = candidateError;
+			endpoints = candidate;
+			memcpy(indices, candidateIndices, 16);
+		}
+
+		// the first index is stored with 3 bits, so its top bit must be 0. The weights are symmetric, swapping the
+		// endpoints and mirroring the indices gives the same texels
+		if (indices[0] & 8)
+		{
+			std::swap(endpoints.Values[0], endpoints.Values[1]);
+			std::swap(endpoints.PBits[0], endpoints.PBits[1]);
+			for (int i = 0; i < 16; i++)
+				indices[i] = (unsigned char)(15 - indices[i]);
+		}
+
+		memset(out, 0, 16);
+		int position = 0;
+		auto write = [&](uint32_t value, int bits)
+		{
+			for (int i = 0; i < bits; i++, position++)
+				out[position >> 3] |= (unsigned char)(((value >> i) & 1) << (position & 7));
+		};
+		write(1 << 6, 7); // mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			write(endpoints.Values[0][c], 7);
+			write(endpoints.Values[1][c], 7);
+		}
+		write(endpoints.PBits[0], 1);
+		write(endpoints.PBits[1], 1);
+		for (int i = 0; i < 16; i++)
+			write(indices[i], i == 0 ? 3 : 4);
+	}
+
+	// Only mode 6 is decoded, other modes come out black
+	static void decodeBC7(const unsigned char* block, unsigned char texels[16][4])
+	{
+		if ((block[0] & 0x7F) != 1 << 6)
+		{
+			for (int i = 0; i < 16; i++)
+				texels[i][3] = 0;
+			return;
+		}
+		int position = 7;
+		auto read = [&](int bits)
+		{
+			int value = 0;
+			for (int i = 0; i < bits; i++, position++)
+				value |= ((block[position >> 3] >> (position & 7)) & 1) << i;
+			return value;
+		};
+		Bc7Endpoints endpoints;
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints.Values[0][c] = read(7);
+			endpoints.Values[1][c] = read(7);
+		}
+		endpoints.PBits[0] = read(1);
+		endpoints.PBits[1] = read(1);
+		int16_t palette[16][4];
+		bc7Palette(endpoints, palette);
+		for (int i = 0; i < 16; i++)
+		{
+			int index = read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				texels[i][c] = (unsigned char)palette[index][c];
+		}
+	}
+};
+
+// Compresses every level of an uncompressed mip chain into format, which must store no more channels than the source
+// has. Blocks at the right and bottom edges of levels not a multiple of 4 repeat the last column and row. Block rows
+// of all levels are spread over the pool when one is given. stats, when given, receives the error of the whole chain
+inline void CompressMipChain(const TextureImage& source, Texture_Format format, Texture_Compression quality,
+	std::vector<unsigned char>& storage, TextureImage& image, ThreadPool* pool = nullptr, BlockCompressionStats* stats = nullptr)
+{
+	storage.resize(LayoutMipChain(format, source.Width(), source.Height(), image));
+	image.Data = storage.data();
+	int sourceChannels = GetTextureFormatInfo(source.Format).Channels;
+	int channels = GetTextureFormatInfo(format).Channels;
+	int blockBytes = GetTextureFormatInfo(format).BlockBytes;
+
+	int firstRow[TEXTURE_MAX_LEVELS + 1] = {};
+	for (int level = 0; level < image.LevelCount; level++)
+		firstRow[level + 1] = firstRow[level] + TextureRowCount(format, image.Levels[level].Height);
+	int rowCount = firstRow[image.LevelCount];
+	std::vector<BlockCompressionStats> rowStats(stats != nullptr ? rowCount : 0);
+
+	auto compressRows = [&](size_t begin, size_t end)
+	{
+		int level = 0;
+		for (size_t row = begin; row < end; row++)
+		{
+			while ((int)row >= firstRow[level + 1])
+				level++;
+			const TextureLevel& from = source.Levels[level];
+			const TextureLevel& to = image.Levels[level];
+			const unsigned char* pixels = source.Data + from.Offset;
+			size_t stride = (size_t)from.Width * sourceChannels;
+			int y0 = ((int)row - firstRow[level]) * 4;
+			unsigned char* out = storage.data() + to.Offset + (row - firstRow[level]) * TextureRowBytes(format, to.Width);
+			for (int x0 = 0; x0 < from.Width; x0 += 4, out += blockBytes)
+			{
+				unsigned char texels[16][4];
+				for (int i = 0; i < 16; i++)
+				{
+					const unsigned char* texel = pixels + std::min(y0 + i / 4, from.Height - 1) * stride
+						+ std::min(x0 + i % 4, from.Width - 1) * sourceChannels;
+					for (int c = 0; c < 4; c++)
+						texels[i][c] = c < sourceChannels ? texel[c] : c == 3 ? 255 : 0;
+				}
+				BlockCompressor::Encode(format, texels, quality, out);
+				if (stats == nullptr)
+					continue;
+				unsigned char decoded[16][4];
+				BlockCompressor::Decode(format, out, decoded);
+				BlockCompressionStats& rowStat = rowStats[row];
+				for (int i = 0; i < 16; i++)
+				{
+					if (y0 + i / 4 >= from.Height || x0 + i % 4 >= from.Width)
+						continue;
+					for (int c = 0; c < channels; c++)
+					{
+						double d = (double)decoded[i][c] - texels[i][c];
+						rowStat.SquaredError += d * d;
+					}
+					rowStat.Samples += channels;
+				}
+			}
+		}
+	};
+	if (pool != nullptr)
+		pool->ParallelFor((size_t)rowCount, 4, compressRows);
+	else
+		compressRows(0, (size_t)rowCount);
+
+	if (stats != nullptr)
+	{
+		for (const BlockCompressionStats& rowStat : rowStats)
+			stats->Add(rowStat);
+	}
+}
+#endif
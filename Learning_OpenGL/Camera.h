@@ -4,9 +4,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define CAMERA_SSE 1
+#endif
+
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement {
 	FORWARD,
@@ -22,6 +29,23 @@ const float PITCH = 0.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+// Matrices derived from the camera. View is WorldOrigin-relative, RelativeView is camera-relative (rotation only)
+struct CameraMatrices
+{
+	glm::mat4 View;
+	glm::mat4 InverseView;
+	glm::mat4 RelativeView;
+	glm::mat4 InverseRelativeView;
+	glm::mat4 Projection;
+	glm::mat4 InverseProjection;
+	glm::mat4 ViewProjection;
+	glm::mat4 InverseViewProjection;
+	glm::mat4 RelativeViewProjection;
+	glm::mat4 InverseRelativeViewProjection;
+};
 
 
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
@@ -29,7 +53,7 @@ class Camera
 {
 public:
 	// Camera Attributes
-	glm::vec3 Position;
+	glm::dvec3 Position; // double precision world position, see ToCameraRelative
 	glm::vec3 Front;
 	glm::vec3 Up;
 	glm::vec3 Right;
@@ -44,28 +68,39 @@ public:
 	float MouseSensitivity;
 	float Zoom;
 	bool Fly = false;
+	// Projection options
+	float NearPlane = NEAR_PLANE;
+	float FarPlane = FAR_PLANE; // ignored with ReverseZ, the far plane is at infinity
+	bool ReverseZ = false; // reverse-Z projection, needs glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE) and a GL_GREATER depth test
+	// Orientation as a quaternion, only maintained in quaternion mode (see SetQuaternionMode)
+	glm::quat Orientation;
+	// Floating origin. Float-side data such as bounding volumes is stored relative to WorldOrigin, which follows the camera
+	// once it gets further than RebaseDistance away (0 disables rebasing). OriginVersion changes on every rebase
+	glm::dvec3 WorldOrigin = glm::dvec3(0.0);
+	double RebaseDistance = 0.0;
+	unsigned int OriginVersion = 0;
 
 	// Constructor with vectors
 	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
-		Position = position;
+		Position = glm::dvec3(position);
 		WorldUp = up;
 		Yaw = yaw;
 		Pitch = pitch;
-		updateCameraVectors();
+		resetOrientation();
 	}
 	// Constructor with scalar values
 	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
-		Position = glm::vec3(posX, posY, posZ);
+		Position = glm::dvec3(posX, posY, posZ);
 		WorldUp = glm::vec3(upX, upY, upZ);
 		Yaw = yaw;
 		Pitch = pitch;
-		updateCameraVectors();
+		resetOrientation();
 	}
 
 	// Returns the view matrix calculated using Euler Angles and the LookAt Matrix
-	glm::mat4 MyLookAt(glm::vec3 position, glm::vec3 target, glm::vec3 worldUp)
+	static glm::mat4 MyLookAt(glm::vec3 position, glm::vec3 target, glm::vec3 worldUp)
 	{	
 		// 1. Position = known
 			// 2. Calculate cameraDirection
@@ -75,45 +110,148 @@ public:
 		// 4. Calculate camera up vector
 		glm::vec3 yaxis = glm::cross(zaxis, xaxis);
 
-		// Create translation and rotation matrix
-		// In glm we access elements as mat[col][row] due to column-major layout
-		glm::mat4 translation(1.0f); // Identity matrix by default
-		translation[3][0] = -position.x; // Third column, first row
-		translation[3][1] = -position.y;
-		translation[3][2] = -position.z;
-		glm::mat4 rotation(1.0f);
-		rotation[0][0] = xaxis.x; // First column, first row
-		rotation[1][0] = xaxis.y;
-		rotation[2][0] = xaxis.z;
-		rotation[0][1] = yaxis.x; // First column, second row
-		rotation[1][1] = yaxis.y;
-		rotation[2][1] = yaxis.z;
-		rotation[0][2] = zaxis.x; // First column, third row
-		rotation[1][2] = zaxis.y;
-		rotation[2][2] = zaxis.z;
-
-		// Return lookAt matrix as combination of translation and rotation matrix
-		return rotation * translation; // Remember to read from right to left (first translation then rotation)	
+		// Build the lookAt matrix directly. It equals rotation * translation (first translate by -position, then rotate
+		// into the camera axes), so the translation column is the camera axes dotted with -position and no full
+		// matrix multiply is needed. In glm we access elements as mat[col][row] due to column-major layout
+		glm::mat4 view(1.0f); // Identity matrix by default
+		view[0][0] = xaxis.x; // First column, first row
+		view[1][0] = xaxis.y;
+		view[2][0] = xaxis.z;
+		view[0][1] = yaxis.x; // First column, second row
+		view[1][1] = yaxis.y;
+		view[2][1] = yaxis.z;
+		view[0][2] = zaxis.x; // First column, third row
+		view[1][2] = zaxis.y;
+		view[2][2] = zaxis.z;
+		view[3][0] = -glm::dot(xaxis, position); // Fourth column, translation
+		view[3][1] = -glm::dot(yaxis, position);
+		view[3][2] = -glm::dot(zaxis, position);
+		return view;
 	}
 
+	// Same as MyLookAt for count views at once, e.g. the six faces of a cubemap or the cascades of a shadow map. Four
+	// views go through the SSE registers side by side (one lane per view), so the normalizations and cross products are
+	// shared, and the result is written to a contiguous array that can be uploaded to a uniform buffer as is
+	static void MyLookAtBatch(const glm::vec3* positions, const glm::vec3* targets, const glm::vec3* worldUps, size_t count, glm::mat4* views)
+	{
+		size_t i = 0;
+#if defined(CAMERA_SSE)
+		// a partly used last group repeats its last view, which beats scalar leftovers
+		for (; i < count; i += 4)
+			lookAt4(positions, targets, worldUps, i, count, views);
+#else
+		for (; i < count; i++)
+			views[i] = MyLookAt(positions[i], targets[i], worldUps[i]);
+#endif
+	}
+
+	// Returns the view matrix in WorldOrigin-relative space, matching float-side data such as culling volumes
 	glm::mat4 GetViewMatrix()
 	{
-		//return glm::lookAt(Position, Position + Front, Up);
-		return MyLookAt(Position, Position + Front, Up);
+		updateView();
+		return matrices.View;
+	}
+
+	// Returns the view matrix for camera-relative rendering: the camera sits at the origin, so the view is rotation only
+	// and the translation lives in each model matrix (see ToCameraRelative)
+	glm::mat4 GetRelativeViewMatrix()
+	{
+		updateView();
+		return matrices.RelativeView;
+	}
+
+	// Returns all camera matrices for the given aspect ratio. They are cached and only rebuilt when an input changed
+	// (position, orientation, floating origin, Zoom, the projection options or the aspect ratio); every rebuild bumps
+	// MatrixVersion so callers can skip their own work while it stays the same
+	const CameraMatrices& GetMatrices(float aspect)
+	{
+		updateView();
+		updateProjection(aspect);
+		if (viewProjectionDirty)
+		{
+			matrices.ViewProjection = matrices.Projection * matrices.View;
+			matrices.InverseViewProjection = matrices.InverseView * matrices.InverseProjection;
+			matrices.RelativeViewProjection = matrices.Projection * matrices.RelativeView;
+			matrices.InverseRelativeViewProjection = matrices.InverseRelativeView * matrices.InverseProjection;
+			viewProjectionDirty = false;
+		}
+		return matrices;
+	}
+
+	// Changes whenever any cached matrix changed
+	unsigned int MatrixVersion() const
+	{
+		return matrixVersion;
+	}
+
+	// Converts a world position to camera-relative coordinates. The subtraction happens in double precision, so the
+	// float result is exact to well below a millimetre for anything near the camera, no matter how far from the world
+	// origin both are
+	glm::vec3 ToCameraRelative(const glm::dvec3& worldPosition) const
+	{
+		return glm::vec3(worldPosition - Position);
+	}
+
+	// Model matrix of an object at a world position for camera-relative rendering, local is applied first
+	glm::mat4 GetRelativeModelMatrix(const glm::dvec3& worldPosition, const glm::mat4& local = glm::mat4(1.0f)) const
+	{
+		return glm::translate(glm::mat4(1.0f), ToCameraRelative(worldPosition)) * local;
+	}
+
+	// Converts a world position to WorldOrigin-relative float coordinates
+	glm::vec3 ToOriginRelative(const glm::dvec3& worldPosition) const
+	{
+		return glm::vec3(worldPosition - WorldOrigin);
+	}
+
+	// Moves WorldOrigin to the camera when it has drifted further than RebaseDistance. Returns true on a rebase, after
+	// which origin-relative data must be rebuilt from the double precision world positions
+	bool UpdateFloatingOrigin()
+	{
+		if (RebaseDistance <= 0.0 || glm::length(Position - WorldOrigin) <= RebaseDistance)
+			return false;
+		WorldOrigin = Position;
+		OriginVersion++;
+		return true;
+	}
+
+	// Returns the perspective projection for the current Zoom, see BuildProjectionMatrix
+	glm::mat4 GetProjectionMatrix(float aspect)
+	{
+		updateProjection(aspect);
+		return matrices.Projection;
+	}
+
+	// Builds the perspective projection for the current Zoom. With ReverseZ the near plane maps to depth 1 and the far
+	// plane, at infinity, to depth 0 in a 0..1 clip range. Floating point depth is densest near 0, which cancels the
+	// 1/z distribution of perspective depth, so precision stays nearly uniform out to any distance
+	glm::mat4 BuildProjectionMatrix(float aspect) const
+	{
+		if (!ReverseZ)
+			return glm::perspective(glm::radians(Zoom), aspect, NearPlane, FarPlane);
+
+		float f = 1.0f / tan(glm::radians(Zoom) * 0.5f);
+		glm::mat4 projection(0.0f);
+		projection[0][0] = f / aspect;
+		projection[1][1] = f;
+		projection[2][3] = -1.0f; // w_clip = -z_eye
+		projection[3][2] = NearPlane; // z_clip = near, so depth = near / -z_eye
+		return projection;
 	}
 
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
-		float velocity = MovementSpeed * deltaTime;
+		UpdateOrientation(); // movement follows the latest mouse look
+		double velocity = MovementSpeed * deltaTime;
 		if (direction == FORWARD)
-			Position += (Fly ? Front : WalkDirection) * velocity; // enable flight if toggle set to true
+			Position += glm::dvec3(Fly ? Front : WalkDirection) * velocity; // enable flight if toggle set to true
 		if (direction == BACKWARD)
-			Position -= (Fly ? Front : WalkDirection) * velocity;
+			Position -= glm::dvec3(Fly ? Front : WalkDirection) * velocity;
 		if (direction == LEFT)
-			Position -= Right * velocity;
+			Position -= glm::dvec3(Right) * velocity;
 		if (direction == RIGHT)
-			Position += Right * velocity;
+			Position += glm::dvec3(Right) * velocity;
 		if (direction == FLY)
 		{
 			if (Fly == true)
@@ -126,11 +264,14 @@ public:
 	}
 
 	// Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
+	// Only accumulates the angles, the Front, Right and Up vectors are rebuilt once when they are next needed, so several
+	// mouse events per frame cost one update.
 	void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
 	{
 		xoffset *= MouseSensitivity;
 		yoffset *= MouseSensitivity;
 
+		float previousPitch = Pitch;
 		Yaw += xoffset;
 		Pitch += yoffset;
 
@@ -143,8 +284,9 @@ public:
 				Pitch = -89.0f;
 		}
 
-		// Update Front, Right and Up Vectors using the updated Euler angles
-		updateCameraVectors();
+		pendingYaw += xoffset;
+		pendingPitch += Pitch - previousPitch; // only the part of the pitch that survived clamping
+		vectorsDirty = true;
 	}
 
 	// Processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
@@ -158,10 +300,187 @@ public:
 			Zoom = 45.0f;
 	}
 
+	// Places the camera at an absolute pose, used by scripted camera paths
+	void SetPose(const glm::dvec3& position, float yaw, float pitch)
+	{
+		Position = position;
+		Yaw = yaw;
+		Pitch = glm::clamp(pitch, -89.0f, 89.0f);
+		resetOrientation();
+	}
+
+	// Switches between Euler angles and quaternion orientation. In quaternion mode mouse look is applied as rotations
+	// about the world up and the camera's right axis, which needs no trigonometry to rebuild the basis vectors
+	void SetQuaternionMode(bool enabled)
+	{
+		UpdateOrientation();
+		useQuaternion = enabled;
+		resetOrientation();
+	}
+
+	// Applies mouse movement accumulated since the last update to Front, Right, Up and WalkDirection. Called by
+	// GetViewMatrix and ProcessKeyboard; call it before reading the vectors directly
+	void UpdateOrientation()
+	{
+		if (vectorsDirty)
+			updateCameraVectors();
+	}
+
 private:
-	// Calculates the front vector from the Camera's (updated) Euler Angles
+#if defined(CAMERA_SSE)
+	// MyLookAt for views first to first + 3, one per SSE lane, clamped to count
+	static void lookAt4(const glm::vec3* p, const glm::vec3* t, const glm::vec3* u, size_t first, size_t count, glm::mat4* views)
+	{
+		size_t i0 = first, i1 = std::min(first + 1, count - 1), i2 = std::min(first + 2, count - 1), i3 = std::min(first + 3, count - 1);
+		__m128 px = _mm_setr_ps(p[i0].x, p[i1].x, p[i2].x, p[i3].x);
+		__m128 py = _mm_setr_ps(p[i0].y, p[i1].y, p[i2].y, p[i3].y);
+		__m128 pz = _mm_setr_ps(p[i0].z, p[i1].z, p[i2].z, p[i3].z);
+		// 2. cameraDirection
+		__m128 zx = _mm_sub_ps(px, _mm_setr_ps(t[i0].x, t[i1].x, t[i2].x, t[i3].x));
+		__m128 zy = _mm_sub_ps(py, _mm_setr_ps(t[i0].y, t[i1].y, t[i2].y, t[i3].y));
+		__m128 zz = _mm_sub_ps(pz, _mm_setr_ps(t[i0].z, t[i1].z, t[i2].z, t[i3].z));
+		normalize4(zx, zy, zz);
+		__m128 ux = _mm_setr_ps(u[i0].x, u[i1].x, u[i2].x, u[i3].x);
+		__m128 uy = _mm_setr_ps(u[i0].y, u[i1].y, u[i2].y, u[i3].y);
+		__m128 uz = _mm_setr_ps(u[i0].z, u[i1].z, u[i2].z, u[i3].z);
+		normalize4(ux, uy, uz);
+		// 3. right axis = cross(up, z)
+		__m128 xx = _mm_sub_ps(_mm_mul_ps(uy, zz), _mm_mul_ps(uz, zy));
+		__m128 xy = _mm_sub_ps(_mm_mul_ps(uz, zx), _mm_mul_ps(ux, zz));
+		__m128 xz = _mm_sub_ps(_mm_mul_ps(ux, zy), _mm_mul_ps(uy, zx));
+		normalize4(xx, xy, xz);
+		// 4. camera up = cross(z, x)
+		__m128 yx = _mm_sub_ps(_mm_mul_ps(zy, xz), _mm_mul_ps(zz, xy));
+		__m128 yy = _mm_sub_ps(_mm_mul_ps(zz, xx), _mm_mul_ps(zx, xz));
+		__m128 yz = _mm_sub_ps(_mm_mul_ps(zx, xy), _mm_mul_ps(zy, xx));
+		// translation column, -dot(axis, position)
+		__m128 zero = _mm_setzero_ps();
+		__m128 tx = _mm_sub_ps(zero, dot4(xx, xy, xz, px, py, pz));
+		__m128 ty = _mm_sub_ps(zero, dot4(yx, yy, yz, px, py, pz));
+		__m128 tz = _mm_sub_ps(zero, dot4(zx, zy, zz, px, py, pz));
+		__m128 one = _mm_set1_ps(1.0f);
+		// every register holds one matrix row for four views, a 4x4 transpose turns that into one column per view
+		__m128 w0 = zero, w1 = zero, w2 = zero, w3 = one;
+		_MM_TRANSPOSE4_PS(xx, yx, zx, w0);
+		_MM_TRANSPOSE4_PS(xy, yy, zy, w1);
+		_MM_TRANSPOSE4_PS(xz, yz, zz, w2);
+		_MM_TRANSPOSE4_PS(tx, ty, tz, w3);
+		__m128 columns[4][4] = { { xx, xy, xz, tx }, { yx, yy, yz, ty }, { zx, zy, zz, tz }, { w0, w1, w2, w3 } };
+		size_t store = std::min<size_t>(count - first, 4);
+		for (size_t v = 0; v < store; v++)
+			for (int c = 0; c < 4; c++)
+				_mm_storeu_ps(&views[first + v][c][0], columns[v][c]);
+	}
+
+	static void normalize4(__m128& x, __m128& y, __m128& z)
+	{
+		__m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(dot4(x, y, z, x, y, z)));
+		x = _mm_mul_ps(x, inverseLength);
+		y = _mm_mul_ps(y, inverseLength);
+		z = _mm_mul_ps(z, inverseLength);
+	}
+
+	static __m128 dot4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+#endif
+
+	// matrix cache and the inputs it was built from
+	CameraMatrices matrices;
+	unsigned int matrixVersion = 0;
+	bool viewValid = false;
+	bool projectionValid = false;
+	bool viewProjectionDirty = true;
+	glm::dvec3 viewPosition;
+	glm::dvec3 viewOrigin;
+	glm::vec3 viewFront;
+	glm::vec3 viewUp;
+	float projectionZoom = 0.0f;
+	float projectionAspect = 0.0f;
+	float projectionNear = 0.0f;
+	float projectionFar = 0.0f;
+	bool projectionReverseZ = false;
+
+	// Rebuilds the view matrices if the camera moved or turned since the last call
+	void updateView()
+	{
+		UpdateOrientation();
+		if (viewValid && viewPosition == Position && viewOrigin == WorldOrigin && viewFront == Front && viewUp == Up)
+			return;
+		viewValid = true;
+		viewPosition = Position;
+		viewOrigin = WorldOrigin;
+		viewFront = Front;
+		viewUp = Up;
+
+		glm::vec3 position = ToOriginRelative(Position);
+		//matrices.View = glm::lookAt(position, position + Front, Up);
+		matrices.View = MyLookAt(position, position + Front, Up);
+		matrices.RelativeView = MyLookAt(glm::vec3(0.0f), Front, Up);
+		// the view is a rotation plus a translation: the inverse is the transposed rotation and the camera position
+		matrices.InverseRelativeView = glm::transpose(matrices.RelativeView);
+		matrices.InverseView = matrices.InverseRelativeView;
+		matrices.InverseView[3] = glm::vec4(position, 1.0f);
+		viewProjectionDirty = true;
+		matrixVersion++;
+	}
+
+	// Rebuilds the projection matrices if Zoom, the projection options or the aspect ratio changed
+	void updateProjection(float aspect)
+	{
+		if (projectionValid && projectionZoom == Zoom && projectionAspect == aspect && projectionNear == NearPlane
+			&& projectionFar == FarPlane && projectionReverseZ == ReverseZ)
+			return;
+		projectionValid = true;
+		projectionZoom = Zoom;
+		projectionAspect = aspect;
+		projectionNear = NearPlane;
+		projectionFar = FarPlane;
+		projectionReverseZ = ReverseZ;
+
+		matrices.Projection = BuildProjectionMatrix(aspect);
+		matrices.InverseProjection = glm::inverse(matrices.Projection);
+		viewProjectionDirty = true;
+		matrixVersion++;
+	}
+
+	bool useQuaternion = false;
+	bool vectorsDirty = false;
+	// mouse look not yet applied to the quaternion, in degrees
+	float pendingYaw = 0.0f;
+	float pendingPitch = 0.0f;
+
+	// Rebuilds the orientation from Yaw and Pitch and drops any pending mouse movement
+	void resetOrientation()
+	{
+		// yaw -90 looks down -z, the camera's rest direction, yaw 0 looks down +x
+		Orientation = glm::angleAxis(glm::radians(-(Yaw + 90.0f)), WorldUp) * glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+		pendingYaw = 0.0f;
+		pendingPitch = 0.0f;
+		updateCameraVectors();
+	}
+
+	// Calculates the front vector from the Camera's (updated) Euler Angles, or from the orientation in quaternion mode
 	void updateCameraVectors()
 	{
+		vectorsDirty = false;
+		if (useQuaternion)
+		{
+			// yaw turns about the world up axis and pitch about the camera's own right axis. The two commute, so all
+			// the mouse events of a frame collapse into one rotation on each side
+			Orientation = glm::normalize(glm::angleAxis(glm::radians(-pendingYaw), WorldUp) * Orientation * glm::angleAxis(glm::radians(pendingPitch), glm::vec3(1.0f, 0.0f, 0.0f)));
+			pendingYaw = 0.0f;
+			pendingPitch = 0.0f;
+			Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+			Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+			Up = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+			WalkDirection = glm::normalize(Front - dot(Front, WorldUp) * WorldUp);
+			return;
+		}
+		pendingYaw = 0.0f;
+		pendingPitch = 0.0f;
+
 		// Calculate the new Front vector
 		glm::vec3 front;
 		front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
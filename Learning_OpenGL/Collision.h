@@ -0,0 +1,471 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define COLLISION_SSE 1
+#if defined(__AVX__)
+#define COLLISION_AVX 1
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// An upright capsule around the walking camera. The eye sits EyeHeight above the feet, the capsule reaches from the feet
+// to Height above them
+struct CapsuleShape
+{
+	float Radius = 0.25f;
+	float Height = 1.0f;
+	float EyeHeight = 0.9f;
+};
+
+// Static axis aligned boxes the walking camera collides with. Boxes are binned into a hashed uniform grid, a move only
+// tests the boxes in the cells the capsule touches. Every cell's boxes are stored contiguously in structure-of-arrays
+// layout and padded to a multiple of 8, so the narrowphase tests 8 (AVX) or 4 (SSE) boxes per instruction without a
+// scalar tail. Positions are kept in float relative to Origin, which the boxes should be close to.
+//
+// The capsule is always upright, so its distance to a box separates per axis: the x and z distances are constant along
+// the segment and only y depends on it. That keeps the capsule test as cheap as a sphere test.
+class CollisionWorld
+{
+public:
+	glm::dvec3 Origin = glm::dvec3(0.0);
+	float CellSize = 4.0f; // grid cell edge in meters, a few times the capsule size
+	int MaxIterations = 4; // push-outs per substep, enough to settle into a corner
+	bool Simd = true; // narrowphase with SIMD, off for the scalar reference
+
+	// Removes all boxes and sets the point box coordinates are relative to
+	void Clear(const glm::dvec3& origin)
+	{
+		Origin = origin;
+		boxes = AabbSoA();
+		built = false;
+	}
+
+	void AddBox(const glm::dvec3& min, const glm::dvec3& max)
+	{
+		boxes.Add(glm::vec3(min - Origin), glm::vec3(max - Origin));
+		built = false;
+	}
+
+	size_t Size() const
+	{
+		return boxes.Size();
+	}
+
+	// Bins the boxes into the grid, call after adding them. Boxes spanning more than MAX_CELL_SPAN cells along an axis
+	// would be copied into too many cells and go into a list every query tests instead
+	void Build()
+	{
+		size_t count = boxes.Size();
+		size_t buckets = 64;
+		while (buckets < count * 2)
+			buckets *= 2;
+		bucketMask = (uint32_t)buckets - 1;
+
+		std::vector<uint32_t> bucketCounts(buckets + 1, 0); // the last bucket holds the large boxes
+		std::vector<uint32_t> large;
+		forEachBoxCell([&](uint32_t, uint32_t bucket) { bucketCounts[bucket]++; }, large);
+		bucketCounts[buckets] = (uint32_t)large.size();
+
+		// counting sort into padded ranges
+		bucketStart.assign(buckets + 2, 0);
+		for (size_t b = 0; b <= buckets; b++)
+			bucketStart[b + 1] = bucketStart[b] + ((bucketCounts[b] + 7) & ~7u);
+		// padding boxes sit far away, the square of the distance still fits a float
+		size_t total = bucketStart[buckets + 1];
+		cells = AabbSoA();
+		for (std::vector<float>* column : { &cells.CenterX, &cells.CenterY, &cells.CenterZ })
+			column->assign(total, 1e15f);
+		for (std::vector<float>* column : { &cells.ExtentX, &cells.ExtentY, &cells.ExtentZ })
+			column->assign(total, 0.0f);
+		cellIds.assign(total, UINT32_MAX);
+
+		std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+		auto place = [&](uint32_t box, uint32_t bucket)
+		{
+			uint32_t slot = fill[bucket]++;
+			cells.CenterX[slot] = boxes.CenterX[box];
+			cells.CenterY[slot] = boxes.CenterY[box];
+			cells.CenterZ[slot] = boxes.CenterZ[box];
+			cells.ExtentX[slot] = boxes.ExtentX[box];
+			cells.ExtentY[slot] = boxes.ExtentY[box];
+			cells.ExtentZ[slot] = boxes.ExtentZ[box];
+			cellIds[slot] = box;
+		};
+		large.clear();
+		forEachBoxCell(place, large);
+		for (uint32_t box : large)
+			place(box, (uint32_t)buckets);
+		built = true;
+	}
+
+	// Moves the eye of a walking capsule by motion and slides it along the boxes in its way. The motion is split into
+	// steps shorter than half the radius so fast movement cannot pass through thin boxes. Push-outs are horizontal,
+	// walking has no gravity, so vertical motion (like the snap when landing) is applied as is
+	glm::dvec3 Move(const CapsuleShape& capsule, const glm::dvec3& eye, const glm::dvec3& motion)
+	{
+		if (!built)
+			Build();
+		glm::vec3 position(eye - Origin);
+		int steps = stepCount(capsule, motion);
+		glm::vec3 step = glm::vec3(motion) / (float)steps;
+		bool collided = false;
+		for (int s = 0; s < steps; s++)
+		{
+			position += step;
+			collided = resolve(capsule, position) || collided;
+		}
+		// without contact the double precision result is exact, rounding through the float position would make the
+		// camera jitter far from Origin
+		return collided ? Origin + glm::dvec3(position) : eye + motion;
+	}
+
+	// Brute force reference of Move: scalar tests against every box, no grid
+	glm::dvec3 MoveBruteForce(const CapsuleShape& capsule, const glm::dvec3& eye, const glm::dvec3& motion)
+	{
+		glm::vec3 position(eye - Origin);
+		int steps = stepCount(capsule, motion);
+		glm::vec3 step = glm::vec3(motion) / (float)steps;
+		bool collided = false;
+		for (int s = 0; s < steps; s++)
+		{
+			position += step;
+			for (int i = 0; i < MaxIterations; i++)
+			{
+				Contact contact = makeContact(capsule, position);
+				DeepestScalar(boxes, nullptr, 0, boxes.Size(), contact);
+				if (contact.Box == UINT32_MAX)
+					break;
+				pushOut(capsule, position, contact.Box);
+				collided = true;
+			}
+		}
+		return collided ? Origin + glm::dvec3(position) : eye + motion;
+	}
+
+	// Closest box the capsule segment is nearer to than Radius. Distances are squared, Box is UINT32_MAX until one is found
+	struct Contact
+	{
+		float X, Z, Bottom, Top; // capsule segment, relative to Origin
+		float DistanceSquared; // starts at Radius squared
+		uint32_t Box;
+	};
+
+	// Narrowphase over boxes [begin, end). ids maps slots to box indices, nullptr when they are the same. Ties go to
+	// the lower box index, so every path finds the same box no matter in which order it visits them
+	static void DeepestScalar(const AabbSoA& b, const uint32_t* ids, size_t begin, size_t end, Contact& contact)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			float dx = std::max(std::fabs(contact.X - b.CenterX[i]) - b.ExtentX[i], 0.0f);
+			float dz = std::max(std::fabs(contact.Z - b.CenterZ[i]) - b.ExtentZ[i], 0.0f);
+			float dy = std::max(std::max(contact.Bottom - (b.CenterY[i] + b.ExtentY[i]), (b.CenterY[i] - b.ExtentY[i]) - contact.Top), 0.0f);
+			float distanceSquared = dx * dx + dy * dy + dz * dz;
+			consider(contact, distanceSquared, ids != nullptr ? ids[i] : (uint32_t)i);
+		}
+	}
+
+	// SIMD narrowphase, end - begin must be a multiple of 8. Lanes only compute distances, the rare boxes closer than
+	// the current contact are picked out with a movemask
+	static void DeepestSimd(const AabbSoA& b, const uint32_t* ids, size_t begin, size_t end, Contact& contact)
+	{
+#if defined(COLLISION_AVX)
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 x = _mm256_set1_ps(contact.X), z = _mm256_set1_ps(contact.Z);
+		const __m256 bottom = _mm256_set1_ps(contact.Bottom), top = _mm256_set1_ps(contact.Top);
+		for (size_t i = begin; i < end; i += 8)
+		{
+			__m256 cy = _mm256_loadu_ps(&b.CenterY[i]), ey = _mm256_loadu_ps(&b.ExtentY[i]);
+			__m256 dx = _mm256_max_ps(_mm256_sub_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(x, _mm256_loadu_ps(&b.CenterX[i]))), _mm256_loadu_ps(&b.ExtentX[i])), zero);
+			__m256 dz = _mm256_max_ps(_mm256_sub_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(z, _mm256_loadu_ps(&b.CenterZ[i]))), _mm256_loadu_ps(&b.ExtentZ[i])), zero);
+			__m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(bottom, _mm256_add_ps(cy, ey)), _mm256_sub_ps(_mm256_sub_ps(cy, ey), top)), zero);
+			__m256 distanceSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+			int mask = _mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, _mm256_set1_ps(contact.DistanceSquared), _CMP_LE_OQ));
+			if (mask != 0)
+			{
+				alignas(32) float lanes[8];
+				_mm256_store_ps(lanes, distanceSquared);
+				for (; mask != 0; mask &= mask - 1)
+				{
+					int lane = ctz(mask);
+					consider(contact, lanes[lane], ids != nullptr ? ids[i + lane] : (uint32_t)(i + lane));
+				}
+			}
+		}
+#elif defined(COLLISION_SSE)
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 x = _mm_set1_ps(contact.X), z = _mm_set1_ps(contact.Z);
+		const __m128 bottom = _mm_set1_ps(contact.Bottom), top = _mm_set1_ps(contact.Top);
+		for (size_t i = begin; i < end; i += 4)
+		{
+			__m128 cy = _mm_loadu_ps(&b.CenterY[i]), ey = _mm_loadu_ps(&b.ExtentY[i]);
+			__m128 dx = _mm_max_ps(_mm_sub_ps(_mm_andnot_ps(signMask, _mm_sub_ps(x, _mm_loadu_ps(&b.CenterX[i]))), _mm_loadu_ps(&b.ExtentX[i])), zero);
+			__m128 dz = _mm_max_ps(_mm_sub_ps(_mm_andnot_ps(signMask, _mm_sub_ps(z, _mm_loadu_ps(&b.CenterZ[i]))), _mm_loadu_ps(&b.ExtentZ[i])), zero);
+			__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(bottom, _mm_add_ps(cy, ey)), _mm_sub_ps(_mm_sub_ps(cy, ey), top)), zero);
+			__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			int mask = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_set1_ps(contact.DistanceSquared)));
+			if (mask != 0)
+			{
+				alignas(16) float lanes[4];
+				_mm_store_ps(lanes, distanceSquared);
+				for (; mask != 0; mask &= mask - 1)
+				{
+					int lane = ctz(mask);
+					consider(contact, lanes[lane], ids != nullptr ? ids[i + lane] : (uint32_t)(i + lane));
+				}
+			}
+		}
+#else
+		DeepestScalar(b, ids, begin, end, contact);
+#endif
+	}
+
+private:
+	static const int MAX_CELL_SPAN = 4;
+	static const int MAX_STEPS = 64;
+
+	AabbSoA boxes; // every box, index order
+	AabbSoA cells; // boxes copied into their grid buckets
+	std::vector<uint32_t> cellIds; // box index of every slot in cells
+	std::vector<uint32_t> bucketStart; // slot range of bucket b is [bucketStart[b], bucketStart[b + 1]), the last one is the large boxes
+	uint32_t bucketMask = 0;
+	bool built = false;
+
+	static void consider(Contact& contact, float distanceSquared, uint32_t box)
+	{
+		if (distanceSquared < contact.DistanceSquared || (distanceSquared == contact.DistanceSquared && box < contact.Box))
+		{
+			contact.DistanceSquared = distanceSquared;
+			contact.Box = box;
+		}
+	}
+
+	// Substeps of a move, each shorter than half the radius
+	static int stepCount(const CapsuleShape& capsule, const glm::dvec3& motion)
+	{
+		float horizontal = (float)std::sqrt(motion.x * motion.x + motion.z * motion.z);
+		int steps = (int)std::ceil(horizontal / (capsule.Radius * 0.5f));
+		if (steps < 1)
+			return 1;
+		return steps < MAX_STEPS ? steps : MAX_STEPS;
+	}
+
+	static int ctz(int mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, (unsigned long)mask);
+		return (int)index;
+#else
+		return __builtin_ctz((unsigned int)mask);
+#endif
+	}
+
+	static Contact makeContact(const CapsuleShape& capsule, const glm::vec3& eye)
+	{
+		float feet = eye.y - capsule.EyeHeight;
+		Contact contact;
+		contact.X = eye.x;
+		contact.Z = eye.z;
+		contact.Bottom = feet + capsule.Radius;
+		contact.Top = feet + std::max(capsule.Height - capsule.Radius, capsule.Radius);
+		contact.DistanceSquared = capsule.Radius * capsule.Radius;
+		contact.Box = UINT32_MAX;
+		return contact;
+	}
+
+	int cellOf(float coordinate) const
+	{
+		return (int)std::floor(coordinate / CellSize);
+	}
+
+	uint32_t bucketOf(int x, int y, int z) const
+	{
+		return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u) & bucketMask;
+	}
+
+	// Calls fn(box, bucket) for every grid cell a box overlaps, boxes too large for the grid go to large
+	template<typename Function>
+	void forEachBoxCell(const Function& fn, std::vector<uint32_t>& large) const
+	{
+		for (uint32_t box = 0; box < (uint32_t)boxes.Size(); box++)
+		{
+			glm::vec3 center(boxes.CenterX[box], boxes.CenterY[box], boxes.CenterZ[box]);
+			glm::vec3 extent(boxes.ExtentX[box], boxes.ExtentY[box], boxes.ExtentZ[box]);
+			int x0 = cellOf(center.x - extent.x), x1 = cellOf(center.x + extent.x);
+			int y0 = cellOf(center.y - extent.y), y1 = cellOf(center.y + extent.y);
+			int z0 = cellOf(center.z - extent.z), z1 = cellOf(center.z + extent.z);
+			if (x1 - x0 >= MAX_CELL_SPAN || y1 - y0 >= MAX_CELL_SPAN || z1 - z0 >= MAX_CELL_SPAN)
+			{
+				large.push_back(box);
+				continue;
+			}
+			for (int z = z0; z <= z1; z++)
+				for (int y = y0; y <= y1; y++)
+					for (int x = x0; x <= x1; x++)
+						fn(box, bucketOf(x, y, z));
+		}
+	}
+
+	// Finds the deepest box in the cells around the capsule. Cells hashing into the same bucket get tested twice and
+	// boxes from other cells sharing a bucket get tested too, neither changes the result
+	Contact deepest(const CapsuleShape& capsule, const glm::vec3& eye) const
+	{
+		Contact contact = makeContact(capsule, eye);
+		float r = capsule.Radius;
+		int x0 = cellOf(contact.X - r), x1 = cellOf(contact.X + r);
+		int y0 = cellOf(contact.Bottom - r), y1 = cellOf(contact.Top + r);
+		int z0 = cellOf(contact.Z - r), z1 = cellOf(contact.Z + r);
+		size_t largeBucket = bucketStart.size() - 2;
+		for (int z = z0; z <= z1; z++)
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					narrowphase(bucketOf(x, y, z), contact);
+		narrowphase(largeBucket, contact);
+		return contact;
+	}
+
+	void narrowphase(size_t bucket, Contact& contact) const
+	{
+		size_t begin = bucketStart[bucket], end = bucketStart[bucket + 1];
+		if (begin == end)
+			return;
+		if (Simd)
+			DeepestSimd(cells, cellIds.data(), begin, end, contact);
+		else
+			DeepestScalar(cells, cellIds.data(), begin, end, contact);
+	}
+
+	bool resolve(const CapsuleShape& capsule, glm::vec3& eye) const
+	{
+		bool collided = false;
+		for (int i = 0; i < MaxIterations; i++)
+		{
+			Contact contact = deepest(capsule, eye);
+			if (contact.Box == UINT32_MAX)
+				break;
+			pushOut(capsule, eye, contact.Box);
+			collided = true;
+		}
+		return collided;
+	}
+
+	// Pushes the capsule horizontally out of a box. With a vertical gap dy between segment and box the capsule needs a
+	// horizontal distance of sqrt(r^2 - dy^2); a segment standing inside the box's footprint leaves through the nearest side
+	void pushOut(const CapsuleShape& capsule, glm::vec3& eye, uint32_t box) const
+	{
+		Contact contact = makeContact(capsule, eye);
+		glm::vec3 center(boxes.CenterX[box], boxes.CenterY[box], boxes.CenterZ[box]);
+		glm::vec3 extent(boxes.ExtentX[box], boxes.ExtentY[box], boxes.ExtentZ[box]);
+		glm::vec3 min = center - extent, max = center + extent;
+		float dy = std::max(std::max(contact.Bottom - max.y, min.y - contact.Top), 0.0f);
+		// the small extra distance keeps rounding from finding the contact again
+		float reach = std::sqrt(std::max(capsule.Radius * capsule.Radius - dy * dy, 0.0f)) + 1e-4f;
+
+		float hx = eye.x - glm::clamp(eye.x, min.x, max.x);
+		float hz = eye.z - glm::clamp(eye.z, min.z, max.z);
+		float h = std::sqrt(hx * hx + hz * hz);
+		if (h > 0.0f)
+		{
+			eye.x += hx / h * (reach - h);
+			eye.z += hz / h * (reach - h);
+			return;
+		}
+		float exits[4] = { eye.x - min.x, max.x - eye.x, eye.z - min.z, max.z - eye.z };
+		int side = (int)(std::min_element(exits, exits + 4) - exits);
+		float distance = exits[side] + reach;
+		if (side < 2)
+			eye.x += side == 0 ? -distance : distance;
+		else
+			eye.z += side == 2 ? -distance : distance;
+	}
+};
+
+// CPU benchmark of walking capsules through random boxes, see --bench-collision. Compares the brute force scalar test
+// against the grid with scalar and SIMD narrowphase and checks that all three end up in the same place
+inline void RunCollisionBenchmark(size_t colliderCount, unsigned int iterations)
+{
+	const size_t WALKERS = 256;
+	const float FRAME_TIME = 1.0f / 60.0f;
+	const float RUN_SPEED = 5.0f;
+	std::mt19937 rng(1234);
+	// keep the density constant, about one box per 16 square meters
+	float halfSize = std::sqrt((float)colliderCount * 16.0f) * 0.5f;
+	std::uniform_real_distribution<float> position(-halfSize, halfSize);
+	std::uniform_real_distribution<float> size(0.2f, 3.0f);
+	std::uniform_real_distribution<float> height(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+	CollisionWorld world;
+	world.Clear(glm::dvec3(0.0));
+	for (size_t i = 0; i < colliderCount; i++)
+	{
+		glm::dvec3 center(position(rng), height(rng), position(rng));
+		glm::dvec3 extent(size(rng), size(rng), size(rng));
+		world.AddBox(center - extent * 0.5, center + extent * 0.5);
+	}
+	world.Build();
+
+	std::vector<glm::dvec3> starts(WALKERS), motions(WALKERS * iterations);
+	for (glm::dvec3& start : starts)
+		start = glm::dvec3(position(rng), 0.0, position(rng));
+	for (glm::dvec3& motion : motions)
+	{
+		float a = angle(rng);
+		motion = glm::dvec3(std::cos(a), 0.0, std::sin(a)) * (double)(RUN_SPEED * FRAME_TIME);
+	}
+
+	CapsuleShape capsule;
+	typedef std::chrono::high_resolution_clock Clock;
+	std::cout << "COLLISION::BENCH " << colliderCount << " boxes, " << WALKERS << " capsules, " << iterations << " frames" << std::endl;
+	std::vector<glm::dvec3> reference;
+	for (int mode = 0; mode < 3; mode++)
+	{
+		const char* labels[3] = { "brute force", "grid", "grid+simd" };
+		world.Simd = mode == 2;
+		std::vector<glm::dvec3> walkers = starts;
+		Clock::time_point start = Clock::now();
+		for (unsigned int frame = 0; frame < iterations; frame++)
+		{
+			for (size_t w = 0; w < WALKERS; w++)
+			{
+				const glm::dvec3& motion = motions[frame * WALKERS + w];
+				walkers[w] = mode == 0 ? world.MoveBruteForce(capsule, walkers[w], motion) : world.Move(capsule, walkers[w], motion);
+			}
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		double usPerMove = ms * 1000.0 / ((double)iterations * WALKERS);
+		std::cout << "COLLISION::BENCH " << labels[mode] << " " << usPerMove << " us/move, " << usPerMove * 100.0 / (FRAME_TIME * 1e6)
+			<< "% of a 60 Hz frame" << std::endl;
+
+		if (mode == 0)
+		{
+			reference = walkers;
+			continue;
+		}
+		size_t differing = 0;
+		for (size_t w = 0; w < WALKERS; w++)
+			differing += glm::length(walkers[w] - reference[w]) > 1e-4 ? 1 : 0;
+		if (differing != 0)
+			std::cout << "ERROR::COLLISION::BENCH " << labels[mode] << " " << differing << " capsules differ from brute force" << std::endl;
+	}
+}
+#endif
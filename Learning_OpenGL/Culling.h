@@ -0,0 +1,377 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define CULLING_SSE 1
+#if defined(__AVX__)
+#define CULLING_AVX 1
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The six planes of a view frustum. xyz is the inward facing normal and w the distance, so a point p is inside a
+// plane when dot(xyz, p) + w >= 0. Planes are normalized, which makes the plane distance comparable to a radius.
+struct Frustum
+{
+	glm::vec4 Planes[6]; // left, right, bottom, top, near, far (near and far swap with reverse-Z)
+};
+
+// Extracts the frustum planes from a view-projection matrix (Gribb/Hartmann). Planes come out in the space the matrix
+// maps from, so projection * view gives world space planes. zeroToOneDepth selects the 0..1 clip depth range of
+// glClipControl(..., GL_ZERO_TO_ONE) instead of OpenGL's default -1..1
+inline Frustum ExtractFrustum(const glm::mat4& viewProjection, bool zeroToOneDepth = false)
+{
+	// glm is column-major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	const glm::mat4& m = viewProjection;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.Planes[0] = row3 + row0;
+	frustum.Planes[1] = row3 - row0;
+	frustum.Planes[2] = row3 + row1;
+	frustum.Planes[3] = row3 - row1;
+	frustum.Planes[4] = zeroToOneDepth ? row2 : row3 + row2;
+	frustum.Planes[5] = row3 - row2;
+	for (int i = 0; i < 6; i++)
+	{
+		float length = glm::length(glm::vec3(frustum.Planes[i]));
+		// an infinite far plane degenerates to a constant, replace it with a plane everything is inside of
+		frustum.Planes[i] = length > 1e-6f ? frustum.Planes[i] / length : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+	return frustum;
+}
+
+// Bounding spheres in structure-of-arrays layout, so SIMD lanes load 4 or 8 objects with one instruction
+struct SphereSoA
+{
+	std::vector<float> X, Y, Z, Radius;
+
+	size_t Size() const
+	{
+		return X.size();
+	}
+
+	void Add(const glm::vec3& center, float radius)
+	{
+		X.push_back(center.x);
+		Y.push_back(center.y);
+		Z.push_back(center.z);
+		Radius.push_back(radius);
+	}
+};
+
+// Axis aligned boxes in structure-of-arrays layout, stored as center and half extent
+struct AabbSoA
+{
+	std::vector<float> CenterX, CenterY, CenterZ, ExtentX, ExtentY, ExtentZ;
+
+	size_t Size() const
+	{
+		return CenterX.size();
+	}
+
+	void Add(const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 center = (min + max) * 0.5f;
+		glm::vec3 extent = (max - min) * 0.5f;
+		CenterX.push_back(center.x);
+		CenterY.push_back(center.y);
+		CenterZ.push_back(center.z);
+		ExtentX.push_back(extent.x);
+		ExtentY.push_back(extent.y);
+		ExtentZ.push_back(extent.z);
+	}
+};
+
+// Tests bounding volumes against a frustum and writes the indices of the visible ones into a compact list.
+// Objects are tested 8 at a time with AVX, 4 at a time with SSE, one at a time otherwise. With a thread pool the
+// array is split into chunks that are culled in parallel and compacted afterwards.
+class FrustumCuller
+{
+public:
+	// Objects per parallel chunk. A multiple of 8 so only the last chunk has a scalar tail
+	size_t ChunkSize = 16384;
+
+	// Culls spheres. visible is resized to the number of visible objects; its capacity is kept between calls so
+	// steady-state culling does not allocate
+	size_t CullSpheres(const Frustum& frustum, const SphereSoA& spheres, std::vector<uint32_t>& visible, ThreadPool* pool = nullptr)
+	{
+		return cull(frustum, &spheres, nullptr, visible, pool);
+	}
+
+	size_t CullAabbs(const Frustum& frustum, const AabbSoA& boxes, std::vector<uint32_t>& visible, ThreadPool* pool = nullptr)
+	{
+		return cull(frustum, nullptr, &boxes, visible, pool);
+	}
+
+	// Scalar reference versions of the kernels, used for tails and to validate the SIMD paths
+	static size_t CullSpheresScalar(const Frustum& frustum, const SphereSoA& s, size_t begin, size_t end, uint32_t* out)
+	{
+		size_t count = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				float d = plane.x * s.X[i] + plane.y * s.Y[i] + plane.z * s.Z[i] + plane.w;
+				inside = inside && d + s.Radius[i] >= 0.0f;
+			}
+			if (inside)
+				out[count++] = (uint32_t)i;
+		}
+		return count;
+	}
+
+	static size_t CullAabbsScalar(const Frustum& frustum, const AabbSoA& b, size_t begin, size_t end, uint32_t* out)
+	{
+		size_t count = 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				float d = plane.x * b.CenterX[i] + plane.y * b.CenterY[i] + plane.z * b.CenterZ[i] + plane.w;
+				float r = std::fabs(plane.x) * b.ExtentX[i] + std::fabs(plane.y) * b.ExtentY[i] + std::fabs(plane.z) * b.ExtentZ[i];
+				inside = inside && d + r >= 0.0f;
+			}
+			if (inside)
+				out[count++] = (uint32_t)i;
+		}
+		return count;
+	}
+
+	// SIMD kernels over [begin, end), returning the number of indices written to out
+	static size_t CullSpheresSimd(const Frustum& frustum, const SphereSoA& s, size_t begin, size_t end, uint32_t* out)
+	{
+		size_t count = 0;
+		size_t i = begin;
+#if defined(CULLING_AVX)
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&s.X[i]), y = _mm256_loadu_ps(&s.Y[i]), z = _mm256_loadu_ps(&s.Z[i]);
+			__m256 r = _mm256_loadu_ps(&s.Radius[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				__m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), x), _mm256_mul_ps(_mm256_set1_ps(plane.y), y));
+				d = _mm256_add_ps(_mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.z), z)), _mm256_set1_ps(plane.w));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			count += emitLanes((unsigned int)_mm256_movemask_ps(inside), i, out + count);
+		}
+#endif
+#if defined(CULLING_SSE)
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&s.X[i]), y = _mm_loadu_ps(&s.Y[i]), z = _mm_loadu_ps(&s.Z[i]);
+			__m128 r = _mm_loadu_ps(&s.Radius[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				__m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y));
+				d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), z)), _mm_set1_ps(plane.w));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+			}
+			count += emitLanes((unsigned int)_mm_movemask_ps(inside), i, out + count);
+		}
+#endif
+		return count + CullSpheresScalar(frustum, s, i, end, out + count);
+	}
+
+	static size_t CullAabbsSimd(const Frustum& frustum, const AabbSoA& b, size_t begin, size_t end, uint32_t* out)
+	{
+		size_t count = 0;
+		size_t i = begin;
+#if defined(CULLING_AVX)
+		const __m256 absMask8 = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 cx = _mm256_loadu_ps(&b.CenterX[i]), cy = _mm256_loadu_ps(&b.CenterY[i]), cz = _mm256_loadu_ps(&b.CenterZ[i]);
+			__m256 ex = _mm256_loadu_ps(&b.ExtentX[i]), ey = _mm256_loadu_ps(&b.ExtentY[i]), ez = _mm256_loadu_ps(&b.ExtentZ[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				__m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_mul_ps(nz, cz)), _mm256_set1_ps(plane.w));
+				__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, absMask8), ex), _mm256_mul_ps(_mm256_and_ps(ny, absMask8), ey)),
+					_mm256_mul_ps(_mm256_and_ps(nz, absMask8), ez));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			count += emitLanes((unsigned int)_mm256_movemask_ps(inside), i, out + count);
+		}
+#endif
+#if defined(CULLING_SSE)
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&b.CenterX[i]), cy = _mm_loadu_ps(&b.CenterY[i]), cz = _mm_loadu_ps(&b.CenterZ[i]);
+			__m128 ex = _mm_loadu_ps(&b.ExtentX[i]), ey = _mm_loadu_ps(&b.ExtentY[i]), ez = _mm_loadu_ps(&b.ExtentZ[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4& plane = frustum.Planes[p];
+				__m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_mul_ps(nz, cz)), _mm_set1_ps(plane.w));
+				__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, absMask), ex), _mm_mul_ps(_mm_and_ps(ny, absMask), ey)),
+					_mm_mul_ps(_mm_and_ps(nz, absMask), ez));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+			}
+			count += emitLanes((unsigned int)_mm_movemask_ps(inside), i, out + count);
+		}
+#endif
+		return count + CullAabbsScalar(frustum, b, i, end, out + count);
+	}
+
+private:
+	std::vector<uint32_t> chunkCounts;
+
+	// writes base + lane for every set bit of the lane mask
+	static size_t emitLanes(unsigned int mask, size_t base, uint32_t* out)
+	{
+		size_t count = 0;
+		while (mask != 0)
+		{
+			out[count++] = (uint32_t)(base + lowestBit(mask));
+			mask &= mask - 1;
+		}
+		return count;
+	}
+
+	static unsigned int lowestBit(unsigned int mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (unsigned int)index;
+#else
+		return (unsigned int)__builtin_ctz(mask);
+#endif
+	}
+
+	size_t cull(const Frustum& frustum, const SphereSoA* spheres, const AabbSoA* boxes, std::vector<uint32_t>& visible, ThreadPool* pool)
+	{
+		size_t count = spheres ? spheres->Size() : boxes->Size();
+		visible.resize(count);
+		if (count == 0)
+			return 0;
+
+		size_t chunks = (count + ChunkSize - 1) / ChunkSize;
+		if (chunkCounts.size() < chunks)
+			chunkCounts.resize(chunks);
+		uint32_t* out = visible.data();
+		size_t chunkSize = ChunkSize;
+		uint32_t* counts = chunkCounts.data();
+
+		// every chunk compacts into its own slice of the output, so chunks never contend
+		auto cullChunks = [&](size_t firstChunk, size_t lastChunk)
+		{
+			for (size_t c = firstChunk; c < lastChunk; c++)
+			{
+				size_t begin = c * chunkSize;
+				size_t end = std::min(begin + chunkSize, count);
+				counts[c] = (uint32_t)(spheres ? CullSpheresSimd(frustum, *spheres, begin, end, out + begin)
+					: CullAabbsSimd(frustum, *boxes, begin, end, out + begin));
+			}
+		};
+		if (pool != nullptr)
+			pool->ParallelFor(chunks, 1, cullChunks);
+		else
+			cullChunks(0, chunks);
+
+		// close the gaps between the chunk slices
+		size_t total = counts[0];
+		for (size_t c = 1; c < chunks; c++)
+		{
+			memmove(out + total, out + c * chunkSize, counts[c] * sizeof(uint32_t));
+			total += counts[c];
+		}
+		visible.resize(total);
+		return total;
+	}
+};
+
+// CPU benchmark of the culling kernels over random objects, see --bench-cull
+inline void RunCullingBenchmark(size_t objectCount, unsigned int iterations)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.5f, 5.0f);
+	SphereSoA spheres;
+	AabbSoA boxes;
+	for (size_t i = 0; i < objectCount; i++)
+	{
+		glm::vec3 center(position(rng), position(rng), position(rng));
+		float radius = size(rng);
+		spheres.Add(center, radius);
+		boxes.Add(center - glm::vec3(radius), center + glm::vec3(radius));
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.3f, 0.1f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = ExtractFrustum(projection * view);
+
+	FrustumCuller culler;
+	ThreadPool& pool = SharedThreadPool();
+	std::vector<uint32_t> reference(objectCount), visible;
+	visible.reserve(objectCount);
+
+	typedef std::chrono::high_resolution_clock Clock;
+	auto report = [&](const char* label, Clock::duration elapsed, size_t count)
+	{
+		double ms = std::chrono::duration<double, std::milli>(elapsed).count() / iterations;
+		std::cout << "CULL::BENCH " << label << " " << ms << " ms/frame, " << objectCount / ms / 1000.0 << " Mobjects/s, "
+			<< count << " visible" << std::endl;
+	};
+
+	for (int kind = 0; kind < 2; kind++)
+	{
+		const char* name = kind == 0 ? "spheres" : "aabbs";
+		std::cout << "CULL::BENCH " << objectCount << " " << name << ", " << pool.ThreadCount() << " threads" << std::endl;
+
+		Clock::time_point start = Clock::now();
+		size_t referenceCount = 0;
+		for (unsigned int i = 0; i < iterations; i++)
+			referenceCount = kind == 0 ? FrustumCuller::CullSpheresScalar(frustum, spheres, 0, objectCount, reference.data())
+				: FrustumCuller::CullAabbsScalar(frustum, boxes, 0, objectCount, reference.data());
+		report("scalar", Clock::now() - start, referenceCount);
+
+		ThreadPool* pools[2] = { nullptr, &pool };
+		const char* labels[2] = { "simd", "simd+threads" };
+		for (int p = 0; p < 2; p++)
+		{
+			start = Clock::now();
+			size_t count = 0;
+			for (unsigned int i = 0; i < iterations; i++)
+				count = kind == 0 ? culler.CullSpheres(frustum, spheres, visible, pools[p]) : culler.CullAabbs(frustum, boxes, visible, pools[p]);
+			report(labels[p], Clock::now() - start, count);
+			if (count != referenceCount || memcmp(visible.data(), reference.data(), count * sizeof(uint32_t)) != 0)
+				std::cout << "ERROR::CULL::BENCH " << labels[p] << " result differs from the scalar reference" << std::endl;
+		}
+	}
+}
+#endif
@@ -0,0 +1,269 @@
+#ifndef DECODE_ARENA_H
+#define DECODE_ARENA_H
+
+#include "AllocTracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Bump allocator for the scratch memory of image decodes, behind stb_image's STBI_MALLOC/STBI_REALLOC/STBI_FREE hooks
+// (see stb_image.cpp). While a DecodeArenaScope is open on a thread stb_image allocates from that thread's arena,
+// otherwise the hooks go straight to AllocTracker. Inside the arena a free only gives back the most recent block and
+// only the most recent block grows in place, everything else is released at once when the outermost scope closes.
+// The arena then keeps a single chunk as large as the decode needed, up to MAX_RETAINED_BYTES, so a stream of similar
+// images decodes without going to the heap or faulting in fresh pages. Every thread has its own arena, nothing is
+// shared or locked, and the chunks are counted by AllocTracker like any other allocation.
+//
+// A block allocated inside a scope must not be used or freed after the scope closes, that includes the image
+// stbi_load returns. Blocks allocated before the scope opened may be freed inside it
+class DecodeArena
+{
+public:
+	static const size_t MIN_CHUNK_BYTES = 1 << 20;
+	static const size_t MAX_RETAINED_BYTES = 64 << 20;
+
+	~DecodeArena()
+	{
+		releaseChunks();
+	}
+
+	static void* Malloc(size_t size)
+	{
+		HookTimer timer;
+		DecodeArena* arena = current();
+		return arena ? arena->allocate(size) : AllocTracker::Malloc(size);
+	}
+
+	static void* Realloc(void* ptr, size_t size)
+	{
+		HookTimer timer;
+		DecodeArena* arena = current();
+		if (arena == nullptr || (ptr != nullptr && !arena->owns(ptr)))
+			return AllocTracker::Realloc(ptr, size);
+		return ptr ? arena->reallocate(ptr, size) : arena->allocate(size);
+	}
+
+	static void Free(void* ptr)
+	{
+		HookTimer timer;
+		DecodeArena* arena = current();
+		if (arena != nullptr && arena->owns(ptr))
+			arena->release(ptr);
+		else
+			AllocTracker::Free(ptr);
+	}
+
+	// Time spent inside the hooks, summed over all threads. Off by default, the decode benchmark turns it on to see
+	// how much of a decode the allocator takes, contention included
+	static void SetTimingEnabled(bool enabled)
+	{
+		timingEnabled().store(enabled, std::memory_order_relaxed);
+	}
+
+	static uint64_t HookNanoseconds()
+	{
+		return hookNanoseconds().load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class DecodeArenaScope;
+
+	struct Chunk
+	{
+		Chunk* Next;
+		size_t Size;
+		size_t Used;
+		size_t Padding;
+	};
+
+	// in front of every block, 16 bytes keep the blocks aligned like the heap does
+	struct Block
+	{
+		size_t Size;
+		size_t Padding;
+	};
+	static_assert(sizeof(Chunk) % 16 == 0 && sizeof(Block) == 16, "arena blocks must stay 16 byte aligned");
+
+	Chunk* chunks = nullptr; // newest first, blocks are only carved from the newest one
+	size_t used = 0; // by the blocks of all chunks
+	size_t peak = 0; // of used since the last reset
+	size_t nextChunkBytes = MIN_CHUNK_BYTES;
+	int scopeDepth = 0;
+
+	struct HookTimer
+	{
+		typedef std::chrono::steady_clock Clock;
+		bool enabled;
+		Clock::time_point start;
+
+		HookTimer() : enabled(timingEnabled().load(std::memory_order_relaxed))
+		{
+			if (enabled)
+				start = Clock::now();
+		}
+
+		~HookTimer()
+		{
+			if (enabled)
+				hookNanoseconds().fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+					std::memory_order_relaxed);
+		}
+	};
+
+	static std::atomic<bool>& timingEnabled()
+	{
+		static std::atomic<bool> enabled{ false };
+		return enabled;
+	}
+
+	static std::atomic<uint64_t>& hookNanoseconds()
+	{
+		static std::atomic<uint64_t> nanoseconds{ 0 };
+		return nanoseconds;
+	}
+
+	// the arena of the calling thread while a scope is open on it, null otherwise
+	static DecodeArena*& current()
+	{
+		static thread_local DecodeArena* arena = nullptr;
+		return arena;
+	}
+
+	static DecodeArena& threadArena()
+	{
+		static thread_local DecodeArena arena;
+		return arena;
+	}
+
+	static size_t blockBytes(size_t size)
+	{
+		return sizeof(Block) + ((size + 15) & ~(size_t)15);
+	}
+
+	static unsigned char* chunkData(Chunk* chunk)
+	{
+		return (unsigned char*)(chunk + 1);
+	}
+
+	void* allocate(size_t size)
+	{
+		size_t bytes = blockBytes(size);
+		if (chunks == nullptr || chunks->Size - chunks->Used < bytes)
+		{
+			size_t chunkBytes = std::max(nextChunkBytes, bytes);
+			Chunk* chunk = (Chunk*)AllocTracker::Malloc(sizeof(Chunk) + chunkBytes);
+			if (chunk == nullptr)
+				return nullptr;
+			chunk->Next = chunks;
+			chunk->Size = chunkBytes;
+			chunk->Used = 0;
+			chunks = chunk;
+			nextChunkBytes = chunkBytes * 2; // few chunks even when the first guess was far off
+		}
+		Block* block = (Block*)(chunkData(chunks) + chunks->Used);
+		block->Size = size;
+		chunks->Used += bytes;
+		used += bytes;
+		peak = std::max(peak, used);
+		return block + 1;
+	}
+
+	void* reallocate(void* ptr, size_t size)
+	{
+		Block* block = (Block*)ptr - 1;
+		size_t oldBytes = blockBytes(block->Size), bytes = blockBytes(size);
+		if (isNewest(block) && chunks->Used - oldBytes + bytes <= chunks->Size)
+		{
+			chunks->Used = chunks->Used - oldBytes + bytes;
+			used = used - oldBytes + bytes;
+			peak = std::max(peak, used);
+			block->Size = size;
+			return ptr;
+		}
+		void* moved = allocate(size);
+		if (moved != nullptr)
+			memcpy(moved, ptr, std::min(block->Size, size));
+		return moved; // the old block stays until the reset, like realloc the caller drops it
+	}
+
+	void release(void* ptr)
+	{
+		Block* block = (Block*)ptr - 1;
+		if (isNewest(block))
+		{
+			size_t bytes = blockBytes(block->Size);
+			chunks->Used -= bytes;
+			used -= bytes;
+		}
+	}
+
+	bool isNewest(Block* block) const
+	{
+		return (unsigned char*)block + blockBytes(block->Size) == chunkData(chunks) + chunks->Used;
+	}
+
+	bool owns(void* ptr) const
+	{
+		for (Chunk* chunk = chunks; chunk != nullptr; chunk = chunk->Next)
+			if ((unsigned char*)ptr > chunkData(chunk) && (unsigned char*)ptr < chunkData(chunk) + chunk->Size)
+				return true;
+		return false;
+	}
+
+	// Drops every block. A decode that needed several chunks, or more than may be kept, starts over with one chunk
+	// sized for it next time
+	void reset()
+	{
+		if (chunks != nullptr && (chunks->Next != nullptr || chunks->Size > MAX_RETAINED_BYTES))
+		{
+			releaseChunks();
+			nextChunkBytes = std::max((size_t)MIN_CHUNK_BYTES, (peak + 0xFFFF) & ~(size_t)0xFFFF);
+		}
+		else if (chunks != nullptr)
+			chunks->Used = 0;
+		used = 0;
+		peak = 0;
+	}
+
+	void releaseChunks()
+	{
+		while (chunks != nullptr)
+		{
+			Chunk* next = chunks->Next;
+			AllocTracker::Free(chunks);
+			chunks = next;
+		}
+	}
+};
+
+// Routes the calling thread's stb_image allocations to its DecodeArena for as long as the scope lives. Scopes nest, the
+// arena is reset when the outermost one closes
+class DecodeArenaScope
+{
+public:
+	DecodeArenaScope() : arena(DecodeArena::threadArena())
+	{
+		if (arena.scopeDepth++ == 0)
+			DecodeArena::current() = &arena;
+	}
+
+	~DecodeArenaScope()
+	{
+		if (--arena.scopeDepth == 0)
+		{
+			DecodeArena::current() = nullptr;
+			arena.reset();
+		}
+	}
+
+	DecodeArenaScope(const DecodeArenaScope&) = delete;
+	DecodeArenaScope& operator=(const DecodeArenaScope&) = delete;
+
+private:
+	DecodeArena& arena;
+};
+#endif
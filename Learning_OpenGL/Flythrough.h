@@ -0,0 +1,161 @@
+#ifndef FLYTHROUGH_H
+#define FLYTHROUGH_H
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/spline.hpp>
+
+#include "Camera.h"
+#include "FrameStats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// A control point of a flythrough path
+struct FlythroughPoint
+{
+	glm::vec3 Position;
+	glm::vec2 Angles; // yaw, pitch in degrees
+};
+
+// Benchmark camera path. The camera follows a Catmull-Rom spline through the control points of a small text file:
+//   # comment
+//   frames 120               frames rendered per segment (optional, default 120)
+//   <x> <y> <z> <yaw> <pitch> one control point per line
+// Progress is counted in frames, not seconds, so every run renders exactly the same views. Frame times are
+// collected per segment so the expensive parts of a scene stand out.
+class Flythrough
+{
+public:
+	unsigned int FramesPerSegment = 120;
+
+	bool Load(const char* path)
+	{
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::FLYTHROUGH::PATH_NOT_FOUND " << path << std::endl;
+			return false;
+		}
+		points.clear();
+		char line[256];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			FlythroughPoint point;
+			unsigned int frames;
+			if (sscanf(line, " frames %u", &frames) == 1 && frames > 0)
+				FramesPerSegment = frames;
+			else if (sscanf(line, "%f %f %f %f %f", &point.Position.x, &point.Position.y, &point.Position.z, &point.Angles.x, &point.Angles.y) == 5)
+				points.push_back(point);
+		}
+		fclose(file);
+		if (points.size() < 2)
+		{
+			std::cout << "ERROR::FLYTHROUGH::NEEDS_TWO_POINTS " << path << std::endl;
+			return false;
+		}
+		segments.assign(SegmentCount(), FrameStats(FramesPerSegment));
+		return true;
+	}
+
+	size_t SegmentCount() const
+	{
+		return points.empty() ? 0 : points.size() - 1;
+	}
+
+	size_t TotalFrames() const
+	{
+		return SegmentCount() * FramesPerSegment;
+	}
+
+	// Poses the camera for the given frame. Returns the segment the frame belongs to, or -1 once the path is done
+	int Apply(Camera& camera, size_t frame) const
+	{
+		if (frame >= TotalFrames())
+			return -1;
+		size_t segment = frame / FramesPerSegment;
+		float s = (float)(frame % FramesPerSegment) / (float)FramesPerSegment;
+		// end points are duplicated so the curve passes through the first and last control point
+		const FlythroughPoint& p0 = points[segment == 0 ? 0 : segment - 1];
+		const FlythroughPoint& p1 = points[segment];
+		const FlythroughPoint& p2 = points[segment + 1];
+		const FlythroughPoint& p3 = points[segment + 2 < points.size() ? segment + 2 : segment + 1];
+		glm::vec3 position = glm::catmullRom(p0.Position, p1.Position, p2.Position, p3.Position, s);
+		glm::vec2 angles = glm::catmullRom(p0.Angles, p1.Angles, p2.Angles, p3.Angles, s);
+		camera.SetPose(position, angles.x, angles.y);
+		return (int)segment;
+	}
+
+	void AddFrameTime(int segment, double seconds)
+	{
+		if (segment >= 0 && (size_t)segment < segments.size())
+			segments[segment].Add(seconds);
+	}
+
+	// Prints one summary line per segment plus the whole run, and optionally writes them to a file for later comparison
+	void PrintSummary(const char* outPath) const
+	{
+		FILE* out = outPath ? fopen(outPath, "w") : NULL;
+		if (outPath && out == NULL)
+			std::cout << "ERROR::FLYTHROUGH::SUMMARY_NOT_WRITTEN " << outPath << std::endl;
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			FrameTimeSummary summary = segments[i].Summarize();
+			char label[64];
+			snprintf(label, sizeof(label), "FLYTHROUGH::SEGMENT %zu", i);
+			FrameStats::Print(label, summary);
+			if (out != NULL)
+				writeSummary(out, i, summary);
+		}
+		if (out != NULL)
+			fclose(out);
+	}
+
+	// Compares the median frame time of every segment against a summary written by an earlier run. Returns false
+	// if any segment got slower than the baseline by more than the given fraction
+	bool CompareBaseline(const char* baselinePath, double tolerance) const
+	{
+		FILE* file = fopen(baselinePath, "r");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::FLYTHROUGH::BASELINE_NOT_FOUND " << baselinePath << std::endl;
+			return false;
+		}
+		bool withinTolerance = true;
+		char line[256];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			size_t segment;
+			FrameTimeSummary baseline;
+			if (!readSummary(line, segment, baseline) || segment >= segments.size())
+				continue;
+			FrameTimeSummary current = segments[segment].Summarize();
+			double change = baseline.P50 > 0.0 ? (current.P50 - baseline.P50) / baseline.P50 : 0.0;
+			bool regressed = change > tolerance;
+			withinTolerance = withinTolerance && !regressed;
+			printf("FLYTHROUGH::BASELINE segment %zu p50 %.3f -> %.3f ms (%+.1f%%)%s\n", segment, baseline.P50, current.P50,
+				change * 100.0, regressed ? " REGRESSION" : "");
+		}
+		fclose(file);
+		return withinTolerance;
+	}
+
+private:
+	std::vector<FlythroughPoint> points;
+	std::vector<FrameStats> segments;
+
+	static void writeSummary(FILE* out, size_t segment, const FrameTimeSummary& s)
+	{
+		fprintf(out, "segment %zu frames %zu min %.4f mean %.4f p50 %.4f p95 %.4f p99 %.4f max %.4f\n",
+			segment, s.Frames, s.Min, s.Mean, s.P50, s.P95, s.P99, s.Max);
+	}
+
+	static bool readSummary(const char* line, size_t& segment, FrameTimeSummary& s)
+	{
+		return sscanf(line, "segment %zu frames %zu min %lf mean %lf p50 %lf p95 %lf p99 %lf max %lf",
+			&segment, &s.Frames, &s.Min, &s.Mean, &s.P50, &s.P95, &s.P99, &s.Max) == 8;
+	}
+};
+#endif
@@ -0,0 +1,82 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Summary of a frame-time distribution, all times in milliseconds
+struct FrameTimeSummary
+{
+	size_t Frames = 0;
+	double Min = 0.0;
+	double Mean = 0.0;
+	double P50 = 0.0;
+	double P95 = 0.0;
+	double P99 = 0.0;
+	double Max = 0.0;
+};
+
+// Collects frame times so runs of different builds can be compared by distribution rather than by a single average
+class FrameStats
+{
+public:
+	// Reserve room up front so recording a frame never allocates inside the render loop
+	explicit FrameStats(size_t expectedFrames = 0)
+	{
+		samples.reserve(expectedFrames);
+	}
+
+	void Add(double seconds)
+	{
+		samples.push_back(seconds * 1000.0);
+	}
+
+	void Clear()
+	{
+		samples.clear();
+	}
+
+	size_t Count() const
+	{
+		return samples.size();
+	}
+
+	FrameTimeSummary Summarize() const
+	{
+		FrameTimeSummary summary;
+		if (samples.empty())
+			return summary;
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0.0;
+		for (double s : sorted)
+			total += s;
+		summary.Frames = sorted.size();
+		summary.Min = sorted.front();
+		summary.Max = sorted.back();
+		summary.Mean = total / sorted.size();
+		summary.P50 = percentile(sorted, 0.50);
+		summary.P95 = percentile(sorted, 0.95);
+		summary.P99 = percentile(sorted, 0.99);
+		return summary;
+	}
+
+	// Prints one line: label frames min mean p50 p95 p99 max
+	static void Print(const char* label, const FrameTimeSummary& summary)
+	{
+		std::cout << label << " frames " << summary.Frames << " min " << summary.Min << " mean " << summary.Mean
+			<< " p50 " << summary.P50 << " p95 " << summary.P95 << " p99 " << summary.P99 << " max " << summary.Max << " ms" << std::endl;
+	}
+
+private:
+	std::vector<double> samples;
+
+	// nearest-rank percentile of an already sorted sample set
+	static double percentile(const std::vector<double>& sorted, double p)
+	{
+		size_t rank = (size_t)(p * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(rank, sorted.size() - 1)];
+	}
+};
+#endif
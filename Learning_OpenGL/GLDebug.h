@@ -0,0 +1,178 @@
+#ifndef GL_DEBUG_H
+#define GL_DEBUG_H
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// Categories the debug log aggregates messages into
+enum GLDebug_Class {
+	GLDEBUG_PERFORMANCE,
+	GLDEBUG_UNDEFINED_BEHAVIOR,
+	GLDEBUG_ERROR,
+	GLDEBUG_OTHER,
+	GLDEBUG_CLASS_COUNT
+};
+
+const unsigned int GLDEBUG_TABLE_SIZE = 256; // distinct messages kept, must be a power of two
+const unsigned int GLDEBUG_MESSAGE_LENGTH = 256;
+
+// Collects KHR_debug messages from the driver. Messages are deduplicated by (source, type, id) into a fixed size,
+// open addressing table that is only ever touched through atomics, so the callback can fire from a driver thread
+// while the render thread reads it, and it never allocates.
+class GLDebugLog
+{
+public:
+	// Installs the debug callback. Needs a context created with GLFW_OPENGL_DEBUG_CONTEXT; on contexts older than 4.3
+	// the KHR_debug entry points are fetched through the given loader. Returns false if KHR_debug is unavailable
+	bool Install(GLADloadproc load)
+	{
+		if (glad_glDebugMessageCallback == NULL)
+			glad_glDebugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)load("glDebugMessageCallback");
+		if (glad_glDebugMessageControl == NULL)
+			glad_glDebugMessageControl = (PFNGLDEBUGMESSAGECONTROLPROC)load("glDebugMessageControl");
+		if (glad_glObjectLabel == NULL)
+			glad_glObjectLabel = (PFNGLOBJECTLABELPROC)load("glObjectLabel");
+		if (glad_glDebugMessageCallback == NULL)
+		{
+			std::cout << "ERROR::GLDEBUG::KHR_DEBUG_NOT_SUPPORTED" << std::endl;
+			return false;
+		}
+
+		glEnable(GL_DEBUG_OUTPUT);
+		glDebugMessageCallback(callback, this);
+		if (glad_glDebugMessageControl != NULL)
+			glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+		return true;
+	}
+
+	// Attaches a readable name to a GL object so driver messages and debuggers refer to it by name. No-op without KHR_debug
+	static void Label(GLenum identifier, GLuint name, const char* label)
+	{
+		if (glad_glObjectLabel != NULL)
+			glObjectLabel(identifier, name, -1, label);
+	}
+
+	// Closes the current frame's per-class counters
+	void EndFrame()
+	{
+		for (int i = 0; i < GLDEBUG_CLASS_COUNT; i++)
+		{
+			uint32_t count = frameCounts[i].exchange(0, std::memory_order_relaxed);
+			if (count > 0)
+				framesWithMessages[i]++;
+			if (count > peakPerFrame[i])
+				peakPerFrame[i] = count;
+		}
+		frame.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Prints every distinct message seen so far with its counts
+	void PrintSummary() const
+	{
+		std::cout << "GLDEBUG::SUMMARY after " << frame.load(std::memory_order_relaxed) << " frames" << std::endl;
+		for (int i = 0; i < GLDEBUG_CLASS_COUNT; i++)
+		{
+			std::cout << "  " << className((GLDebug_Class)i) << ": " << totalCounts[i].load(std::memory_order_relaxed)
+				<< " messages in " << framesWithMessages[i] << " frames, peak " << peakPerFrame[i] << " per frame" << std::endl;
+		}
+		for (unsigned int i = 0; i < GLDEBUG_TABLE_SIZE; i++)
+		{
+			const Entry& entry = entries[i];
+			if (!entry.Ready.load(std::memory_order_acquire))
+				continue;
+			std::cout << "  [" << className(entry.Class) << " id " << entry.Id << "] x" << entry.Count.load(std::memory_order_relaxed)
+				<< " in " << entry.Frames.load(std::memory_order_relaxed) << " frames: " << entry.Message << std::endl;
+		}
+		if (dropped.load(std::memory_order_relaxed) > 0)
+			std::cout << "  " << dropped.load(std::memory_order_relaxed) << " messages dropped, table full" << std::endl;
+	}
+
+private:
+	struct Entry
+	{
+		std::atomic<uint64_t> Key{ 0 }; // 0 = empty slot
+		std::atomic<bool> Ready{ false }; // set once Message and Class are written
+		std::atomic<uint64_t> Count{ 0 };
+		std::atomic<uint64_t> LastFrame{ 0 };
+		std::atomic<uint64_t> Frames{ 0 };
+		GLuint Id = 0;
+		GLDebug_Class Class = GLDEBUG_OTHER;
+		char Message[GLDEBUG_MESSAGE_LENGTH] = {};
+	};
+
+	Entry entries[GLDEBUG_TABLE_SIZE];
+	std::atomic<uint32_t> frameCounts[GLDEBUG_CLASS_COUNT] = {};
+	std::atomic<uint64_t> totalCounts[GLDEBUG_CLASS_COUNT] = {};
+	std::atomic<uint64_t> dropped{ 0 };
+	std::atomic<uint64_t> frame{ 1 };
+	// only touched by EndFrame on the render thread
+	uint64_t framesWithMessages[GLDEBUG_CLASS_COUNT] = {};
+	uint32_t peakPerFrame[GLDEBUG_CLASS_COUNT] = {};
+
+	static GLDebug_Class classify(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_DEBUG_TYPE_PERFORMANCE: return GLDEBUG_PERFORMANCE;
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return GLDEBUG_UNDEFINED_BEHAVIOR;
+		case GL_DEBUG_TYPE_ERROR: return GLDEBUG_ERROR;
+		default: return GLDEBUG_OTHER;
+		}
+	}
+
+	static const char* className(GLDebug_Class c)
+	{
+		switch (c)
+		{
+		case GLDEBUG_PERFORMANCE: return "performance";
+		case GLDEBUG_UNDEFINED_BEHAVIOR: return "undefined behavior";
+		case GLDEBUG_ERROR: return "error";
+		default: return "other";
+		}
+	}
+
+	void record(GLenum source, GLenum type, GLuint id, const GLchar* message)
+	{
+		GLDebug_Class c = classify(type);
+		frameCounts[c].fetch_add(1, std::memory_order_relaxed);
+		totalCounts[c].fetch_add(1, std::memory_order_relaxed);
+
+		// source and type enums fit in 16 bits each, the low bit keeps the key non-zero
+		uint64_t key = ((uint64_t)(source & 0xFFFF) << 48) | ((uint64_t)(type & 0xFFFF) << 32) | id;
+		key = (key << 1) | 1;
+		uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+		for (unsigned int probe = 0; probe < GLDEBUG_TABLE_SIZE; probe++)
+		{
+			Entry& entry = entries[(hash + probe) & (GLDEBUG_TABLE_SIZE - 1)];
+			uint64_t existing = entry.Key.load(std::memory_order_acquire);
+			if (existing == 0 && entry.Key.compare_exchange_strong(existing, key, std::memory_order_acq_rel))
+			{
+				// we own the new slot, fill it in before publishing it to readers
+				entry.Id = id;
+				entry.Class = c;
+				strncpy(entry.Message, message, GLDEBUG_MESSAGE_LENGTH - 1);
+				entry.Ready.store(true, std::memory_order_release);
+				existing = key;
+			}
+			if (existing == key)
+			{
+				entry.Count.fetch_add(1, std::memory_order_relaxed);
+				uint64_t now = frame.load(std::memory_order_relaxed);
+				if (entry.LastFrame.exchange(now, std::memory_order_relaxed) != now)
+					entry.Frames.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+		dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static void APIENTRY callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+	{
+		((GLDebugLog*)userParam)->record(source, type, id, message);
+	}
+};
+#endif
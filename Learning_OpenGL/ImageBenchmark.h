@@ -0,0 +1,219 @@
+#ifndef IMAGE_BENCHMARK_H
+#define IMAGE_BENCHMARK_H
+
+#include "stb_image.h"
+#include "AllocTracker.h"
+#include "BlockCompression.h"
+#include "DecodeArena.h"
+#include "MipGenerator.h"
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// Decodes a JPEG from memory at every SIMD level this build and CPU support (see stbi_set_jpeg_simd_limit) and
+// reports the throughput in megabytes of RGBA output per second. All levels must produce the same pixels
+inline void RunJpegBenchmark(const char* path, unsigned int iterations)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::vector<unsigned char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (encoded.empty())
+	{
+		std::cout << "ERROR::JPEG::BENCH_FILE_NOT_READ " << path << std::endl;
+		return;
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	const char* labels[3] = { "c", "sse2/neon", "avx2" };
+	int best = stbi_jpeg_simd_level();
+	std::vector<unsigned char> reference;
+	std::cout << "JPEG::BENCH " << path << ", " << encoded.size() / 1024 << " KB, " << iterations << " decodes per level" << std::endl;
+	for (int level = 0; level <= best; level++)
+	{
+		stbi_set_jpeg_simd_limit(level);
+		double seconds = 0.0;
+		size_t bytes = 0;
+		for (unsigned int i = 0; i < iterations; i++)
+		{
+			int width, height, channels;
+			Clock::time_point start = Clock::now();
+			unsigned char* pixels = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &width, &height, &channels, 4);
+			seconds += std::chrono::duration<double>(Clock::now() - start).count();
+			if (!pixels)
+			{
+				std::cout << "ERROR::JPEG::BENCH_DECODE_FAILED " << stbi_failure_reason() << std::endl;
+				stbi_set_jpeg_simd_limit(-1);
+				return;
+			}
+			bytes = (size_t)width * height * 4;
+			if (i == 0 && level == 0)
+				reference.assign(pixels, pixels + bytes);
+			else if (i == 0 && (reference.size() != bytes || memcmp(reference.data(), pixels, bytes) != 0))
+				std::cout << "ERROR::JPEG::BENCH " << labels[level] << " output differs from the C decoder" << std::endl;
+			stbi_image_free(pixels);
+		}
+		std::cout << "JPEG::BENCH " << labels[level] << " " << seconds * 1000.0 / iterations << " ms/decode, "
+			<< (double)bytes * iterations / seconds / 1e6 << " MB/s" << std::endl;
+	}
+	stbi_set_jpeg_simd_limit(-1);
+}
+
+// Decodes a batch of images from memory to RGBA, every file iterations times, with stb_image allocating from the heap
+// (through AllocTracker) and then from the per-thread decode arenas, first on one thread and then on the shared pool.
+// Reports the throughput, the heap allocations per image and the share of the decode time spent inside the allocator
+// hooks over all threads, which is where contention on the heap shows up
+inline void RunDecodeBenchmark(const std::vector<const char*>& paths, unsigned int iterations)
+{
+	std::vector<std::vector<unsigned char>> files;
+	for (const char* path : paths)
+	{
+		std::ifstream file(path, std::ios::binary);
+		files.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (files.back().empty())
+		{
+			std::cout << "ERROR::IMAGE::BENCH_FILE_NOT_READ " << path << std::endl;
+			return;
+		}
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	ThreadPool& pool = SharedThreadPool();
+	size_t count = files.size() * iterations;
+	std::atomic<uint64_t> decodeNanoseconds{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<unsigned int> failures{ 0 };
+	auto decodeFile = [&](const std::vector<unsigned char>& file)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 4);
+		if (pixels)
+			bytes.fetch_add((uint64_t)width * height * 4, std::memory_order_relaxed);
+		else
+			failures.fetch_add(1, std::memory_order_relaxed);
+		stbi_image_free(pixels);
+	};
+	auto decode = [&](size_t begin, size_t end, bool arena)
+	{
+		AllocScope scope(ALLOC_TEXTURE);
+		for (size_t i = begin; i < end; i++)
+		{
+			Clock::time_point start = Clock::now();
+			if (arena)
+			{
+				DecodeArenaScope arenaScope;
+				decodeFile(files[i % files.size()]);
+			}
+			else
+				decodeFile(files[i % files.size()]);
+			decodeNanoseconds.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(),
+				std::memory_order_relaxed);
+		}
+	};
+
+	std::cout << "DECODE::BENCH " << files.size() << " files, " << iterations << " decodes each, " << pool.ThreadCount() << " threads" << std::endl;
+	for (int threads = 0; threads < 2; threads++)
+	{
+		for (int arena = 0; arena < 2; arena++)
+		{
+			// a pass to warm up the heap and the arenas, then the measured one
+			for (int pass = 0; pass < 2; pass++)
+			{
+				AllocStats before = AllocTracker::GetStats(ALLOC_TEXTURE);
+				uint64_t hookBefore = DecodeArena::HookNanoseconds();
+				decodeNanoseconds.store(0);
+				bytes.store(0);
+				DecodeArena::SetTimingEnabled(true);
+				Clock::time_point start = Clock::now();
+				if (threads == 0)
+					decode(0, count, arena != 0);
+				else
+					pool.ParallelFor(count, 1, [&](size_t begin, size_t end) { decode(begin, end, arena != 0); });
+				double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+				DecodeArena::SetTimingEnabled(false);
+				if (pass == 0)
+					continue;
+				AllocStats after = AllocTracker::GetStats(ALLOC_TEXTURE);
+				std::cout << "DECODE::BENCH " << (arena ? "arena" : "heap ") << " on " << (threads ? pool.ThreadCount() : 1)
+					<< " thread(s): " << count / seconds << " images/s, " << (double)bytes.load() / seconds / 1e6 << " MB/s, "
+					<< (double)(after.Allocations - before.Allocations) / count << " heap allocations per image, "
+					<< 100.0 * (DecodeArena::HookNanoseconds() - hookBefore) / std::max<uint64_t>(decodeNanoseconds.load(), 1)
+					<< "% of the decode time in the allocator" << std::endl;
+			}
+		}
+	}
+	if (failures.load() != 0)
+		std::cout << "ERROR::IMAGE::BENCH_DECODE_FAILED " << failures.load() << " decodes" << std::endl;
+}
+
+// Block compresses the full mip chain of an image into BC4, BC5, BC1 and BC7 (loading it with 1 to 4 channels) at
+// every quality preset: on one thread with the scalar and the SSE2 index search, then on the shared pool. Reports the
+// throughput in megatexels per second, the size reduction and the error. Every run must produce the same blocks
+inline void RunBlockCompressionBenchmark(const char* path, unsigned int iterations)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	const Texture_Format formats[4] = { TEXTURE_FORMAT_BC4, TEXTURE_FORMAT_BC5, TEXTURE_FORMAT_BC1, TEXTURE_FORMAT_BC7 };
+	const char* qualities[4] = { "none", "fast", "normal", "high" };
+	ThreadPool& pool = SharedThreadPool();
+	std::cout << "BC::BENCH " << path << ", " << iterations << " runs per preset, " << pool.ThreadCount() << " threads" << std::endl;
+	for (int f = 0; f < 4; f++)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(path, &width, &height, &channels, f + 1);
+		if (!pixels)
+		{
+			std::cout << "ERROR::BLOCK_COMPRESSION::BENCH_FILE_NOT_READ " << path << ": " << stbi_failure_reason() << std::endl;
+			return;
+		}
+		std::vector<unsigned char> sourceStorage;
+		TextureImage source;
+		TextureImport import;
+		import.FlipVertically = false;
+		import.Srgb = f >= 2;
+		BuildMipChain(pixels, width, height, f + 1, import, sourceStorage, source, &pool);
+		stbi_image_free(pixels);
+		double texels = 0.0;
+		for (int level = 0; level < source.LevelCount; level++)
+			texels += (double)source.Levels[level].Width * source.Levels[level].Height;
+
+		for (int quality = TEXTURE_COMPRESSION_FAST; quality <= TEXTURE_COMPRESSION_HIGH; quality++)
+		{
+			std::vector<unsigned char> reference, storage;
+			TextureImage image;
+			BlockCompressionStats stats;
+			bool mismatch = false;
+			auto run = [&](bool simd, ThreadPool* threads, unsigned int runs)
+			{
+				BlockCompressor::SetSimdEnabled(simd);
+				double seconds = 0.0;
+				for (unsigned int i = 0; i < runs; i++)
+				{
+					Clock::time_point start = Clock::now();
+					CompressMipChain(source, formats[f], (Texture_Compression)quality, storage, image, threads);
+					seconds += std::chrono::duration<double>(Clock::now() - start).count();
+					mismatch = mismatch || storage != reference;
+				}
+				return texels * runs / seconds / 1e6;
+			};
+			BlockCompressor::SetSimdEnabled(false);
+			CompressMipChain(source, formats[f], (Texture_Compression)quality, reference, image, nullptr, &stats);
+			double scalar = run(false, nullptr, iterations);
+			std::cout << "BC::BENCH " << GetTextureFormatInfo(formats[f]).Name << " " << qualities[quality] << ": scalar "
+				<< scalar << " Mtexel/s";
+			if (BlockCompressor::SimdAvailable())
+				std::cout << ", sse2 " << run(true, nullptr, iterations) << " Mtexel/s";
+			std::cout << ", pool " << run(true, &pool, iterations) << " Mtexel/s, " << (double)sourceStorage.size() / reference.size()
+				<< "x smaller, RMSE " << stats.Rmse() << ", PSNR " << stats.Psnr() << " dB" << std::endl;
+			if (mismatch)
+				std::cout << "ERROR::BLOCK_COMPRESSION::BENCH " << GetTextureFormatInfo(formats[f]).Name << " " << qualities[quality]
+					<< " runs produced different blocks" << std::endl;
+		}
+	}
+	BlockCompressor::SetSimdEnabled(true);
+}
+#endif
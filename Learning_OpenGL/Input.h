@@ -0,0 +1,180 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+// Kinds of raw events pushed by the GLFW callbacks
+enum Raw_Input_Type {
+	RAW_INPUT_KEY,
+	RAW_INPUT_CURSOR,
+	RAW_INPUT_SCROLL
+};
+
+struct RawInputEvent
+{
+	Raw_Input_Type Type;
+	int Key; // key: GLFW key code
+	int Action; // key: GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+	double X; // cursor: x position, scroll: xoffset
+	double Y; // cursor: y position, scroll: yoffset
+};
+
+// Lock-free ring buffer with one producer and one consumer thread. Each side owns one index and only reads the other,
+// so a push or pop is a couple of loads and one release store. Capacity must be a power of two
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+	// Returns false, dropping the item, when the queue is full
+	bool Push(const T& item)
+	{
+		size_t head = writeIndex.load(std::memory_order_relaxed);
+		if (head - readIndex.load(std::memory_order_acquire) == Capacity)
+			return false;
+		items[head & (Capacity - 1)] = item;
+		writeIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		size_t tail = readIndex.load(std::memory_order_relaxed);
+		if (tail == writeIndex.load(std::memory_order_acquire))
+			return false;
+		item = items[tail & (Capacity - 1)];
+		readIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+	T items[Capacity];
+	// the indices live on separate cache lines so producer and consumer do not invalidate each other
+	alignas(64) std::atomic<size_t> writeIndex{ 0 };
+	alignas(64) std::atomic<size_t> readIndex{ 0 };
+};
+
+// Input state of one frame, folded from all raw events since the previous frame
+struct FrameInput
+{
+	bool Down[GLFW_KEY_LAST + 1]; // held at the end of the frame
+	bool Pressed[GLFW_KEY_LAST + 1]; // went down during the frame
+	float MouseX; // cursor movement, positive to the right
+	float MouseY; // cursor movement, positive upwards
+	float ScrollY;
+
+	// True if the key was down at any point of the frame, so a tap between two frames still counts
+	bool Held(int key) const
+	{
+		return Down[key] || Pressed[key];
+	}
+};
+
+// Buffered input. The GLFW callbacks only push raw events into a lock-free queue and never touch game state, BeginFrame
+// folds everything that arrived since the previous frame into one FrameInput that the frame then reads. GLFW delivers
+// events on the thread calling glfwPollEvents, which has to be the main thread, so with the queue in between the main
+// thread can poll at a high rate while another thread owns the GL context and consumes the input once per frame.
+class InputSystem
+{
+public:
+	// Installs the key, cursor and scroll callbacks and switches to raw (unaccelerated, unscaled) mouse motion where the
+	// platform and GLFW version support it. Uses the window user pointer
+	void Install(GLFWwindow* window)
+	{
+		memset(&state, 0, sizeof(state));
+		glfwSetWindowUserPointer(window, this);
+		glfwSetKeyCallback(window, keyCallback);
+		glfwSetCursorPosCallback(window, cursorCallback);
+		glfwSetScrollCallback(window, scrollCallback);
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#ifdef GLFW_RAW_MOUSE_MOTION
+		if (glfwRawMouseMotionSupported())
+			glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+#endif
+	}
+
+	// Consumes the queued events. Call once per frame on the consuming thread
+	const FrameInput& BeginFrame()
+	{
+		memset(state.Pressed, 0, sizeof(state.Pressed));
+		state.MouseX = state.MouseY = state.ScrollY = 0.0f;
+		RawInputEvent event;
+		while (events.Pop(event))
+		{
+			switch (event.Type)
+			{
+			case RAW_INPUT_KEY:
+				if (event.Key < 0 || event.Key > GLFW_KEY_LAST || event.Action == GLFW_REPEAT)
+					break;
+				state.Down[event.Key] = event.Action == GLFW_PRESS;
+				state.Pressed[event.Key] = state.Pressed[event.Key] || event.Action == GLFW_PRESS;
+				break;
+			case RAW_INPUT_CURSOR:
+				if (hasCursor)
+				{
+					state.MouseX += (float)(event.X - lastX);
+					state.MouseY += (float)(lastY - event.Y); // reversed since y-coordinates go from bottom to top
+				}
+				lastX = event.X;
+				lastY = event.Y;
+				hasCursor = true;
+				break;
+			case RAW_INPUT_SCROLL:
+				state.ScrollY += (float)event.Y;
+				break;
+			}
+		}
+		size_t dropped = droppedEvents.exchange(0, std::memory_order_relaxed);
+		if (dropped != 0)
+			std::cout << "ERROR::INPUT::QUEUE_FULL " << dropped << " events dropped" << std::endl;
+		return state;
+	}
+
+	const FrameInput& State() const
+	{
+		return state;
+	}
+
+private:
+	SpscQueue<RawInputEvent, 1024> events;
+	std::atomic<size_t> droppedEvents{ 0 };
+	FrameInput state;
+	double lastX = 0.0;
+	double lastY = 0.0;
+	bool hasCursor = false;
+
+	void push(const RawInputEvent& event)
+	{
+		if (!events.Push(event))
+			droppedEvents.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static InputSystem& from(GLFWwindow* window)
+	{
+		return *(InputSystem*)glfwGetWindowUserPointer(window);
+	}
+
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+	{
+		RawInputEvent event = { RAW_INPUT_KEY, key, action, 0.0, 0.0 };
+		from(window).push(event);
+	}
+
+	static void cursorCallback(GLFWwindow* window, double xpos, double ypos)
+	{
+		RawInputEvent event = { RAW_INPUT_CURSOR, 0, 0, xpos, ypos };
+		from(window).push(event);
+	}
+
+	static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+	{
+		RawInputEvent event = { RAW_INPUT_SCROLL, 0, 0, xoffset, yoffset };
+		from(window).push(event);
+	}
+};
+#endif
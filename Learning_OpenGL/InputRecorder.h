@@ -0,0 +1,167 @@
+#ifndef INPUT_RECORDER_H
+#define INPUT_RECORDER_H
+
+#include "Camera.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Kinds of entries in an input recording. Every frame starts with an INPUT_FRAME entry followed by the camera inputs of that frame
+enum Input_Event_Type {
+	INPUT_FRAME,
+	INPUT_KEY,
+	INPUT_MOUSE,
+	INPUT_SCROLL
+};
+
+struct InputEvent
+{
+	Input_Event_Type Type;
+	Camera_Movement Movement; // INPUT_KEY only
+	float X; // frame: time, mouse: xoffset
+	float Y; // frame: deltaTime, mouse: yoffset, scroll: yoffset
+};
+
+// Writes timestamped camera inputs to a text file, one event per line:
+//   f <time> <deltaTime>   start of a frame
+//   k <movement>           Camera::ProcessKeyboard
+//   m <xoffset> <yoffset>  Camera::ProcessMouseMovement
+//   s <yoffset>            Camera::ProcessMouseScroll
+// Floats are written with 9 significant digits so they read back bit-exact.
+class InputRecorder
+{
+public:
+	~InputRecorder()
+	{
+		Close();
+	}
+
+	bool Open(const char* path)
+	{
+		file = fopen(path, "w");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::INPUT::RECORDING_NOT_OPENED " << path << std::endl;
+			return false;
+		}
+		fprintf(file, "# camera input recording v1\n");
+		return true;
+	}
+
+	void Close()
+	{
+		if (file != NULL)
+			fclose(file);
+		file = NULL;
+	}
+
+	bool IsRecording() const
+	{
+		return file != NULL;
+	}
+
+	void BeginFrame(float time, float deltaTime)
+	{
+		if (file != NULL)
+			fprintf(file, "f %.9g %.9g\n", time, deltaTime);
+	}
+
+	void Key(Camera_Movement movement)
+	{
+		if (file != NULL)
+			fprintf(file, "k %d\n", (int)movement);
+	}
+
+	void Mouse(float xoffset, float yoffset)
+	{
+		if (file != NULL)
+			fprintf(file, "m %.9g %.9g\n", xoffset, yoffset);
+	}
+
+	void Scroll(float yoffset)
+	{
+		if (file != NULL)
+			fprintf(file, "s %.9g\n", yoffset);
+	}
+
+private:
+	FILE* file = NULL;
+};
+
+// Plays a recording back into a Camera one frame at a time. Keyboard movement is integrated with a fixed timestep
+// instead of the recorded deltaTime, so replaying the same file always produces the same sequence of camera poses.
+class InputReplayer
+{
+public:
+	bool Load(const char* path)
+	{
+		FILE* file = fopen(path, "r");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::INPUT::RECORDING_NOT_FOUND " << path << std::endl;
+			return false;
+		}
+		events.clear();
+		frames = 0;
+		char line[128];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			InputEvent event = { INPUT_FRAME, FORWARD, 0.0f, 0.0f };
+			int movement = 0;
+			if (sscanf(line, "f %f %f", &event.X, &event.Y) == 2)
+			{
+				event.Type = INPUT_FRAME;
+				frames++;
+			}
+			else if (sscanf(line, "k %d", &movement) == 1 && movement >= FORWARD && movement <= FLY)
+			{
+				event.Type = INPUT_KEY;
+				event.Movement = (Camera_Movement)movement;
+			}
+			else if (sscanf(line, "m %f %f", &event.X, &event.Y) == 2)
+				event.Type = INPUT_MOUSE;
+			else if (sscanf(line, "s %f", &event.Y) == 1)
+				event.Type = INPUT_SCROLL;
+			else
+				continue; // comments and malformed lines
+			events.push_back(event);
+		}
+		fclose(file);
+		next = 0;
+		return true;
+	}
+
+	size_t FrameCount() const
+	{
+		return frames;
+	}
+
+	// Applies the inputs of the next recorded frame. Returns false once the recording is exhausted
+	bool ReplayFrame(Camera& camera, float fixedDeltaTime)
+	{
+		if (next >= events.size())
+			return false;
+		// skip the frame marker, then apply everything up to the next one
+		if (events[next].Type == INPUT_FRAME)
+			next++;
+		while (next < events.size() && events[next].Type != INPUT_FRAME)
+		{
+			const InputEvent& event = events[next++];
+			if (event.Type == INPUT_KEY)
+				camera.ProcessKeyboard(event.Movement, fixedDeltaTime);
+			else if (event.Type == INPUT_MOUSE)
+				camera.ProcessMouseMovement(event.X, event.Y);
+			else if (event.Type == INPUT_SCROLL)
+				camera.ProcessMouseScroll(event.Y);
+		}
+		return true;
+	}
+
+private:
+	std::vector<InputEvent> events;
+	size_t frames = 0;
+	size_t next = 0;
+};
+#endif
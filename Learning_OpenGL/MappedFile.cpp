@@ -0,0 +1,75 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	bool ok = GetFileSizeEx(file, &fileSize) != 0;
+	if (ok && fileSize.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping); // the view keeps the mapping alive
+		}
+		ok = data != nullptr;
+		size = ok ? (size_t)fileSize.QuadPart : 0;
+	}
+	CloseHandle(file);
+	return ok;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat info;
+	bool ok = fstat(file, &info) == 0;
+	if (ok && info.st_size > 0)
+	{
+		void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		ok = view != MAP_FAILED;
+		if (ok)
+		{
+			data = (const unsigned char*)view;
+			size = (size_t)info.st_size;
+			madvise(view, size, MADV_SEQUENTIAL);
+		}
+	}
+	close(file); // the mapping keeps the file alive
+	return ok;
+#endif
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
+	}
+	data = nullptr;
+	size = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A whole file mapped read only into memory. Pages are read on first touch, so a mapping handed to another thread
+// should be prefetched first (see Prefetch) if that thread must not wait on the disk. Move only.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	MappedFile(MappedFile&& other)
+	{
+		*this = static_cast<MappedFile&&>(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other)
+	{
+		if (this != &other)
+		{
+			Close();
+			data = other.data;
+			size = other.size;
+			other.data = nullptr;
+			other.size = 0;
+		}
+		return *this;
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	// Maps path, false if it can't be opened. An empty file opens with a null Data()
+	bool Open(const char* path);
+	void Close();
+
+	// Touches every page so later reads don't fault on the disk. Returns a value depending on the bytes read so the
+	// loop can't be optimized away
+	unsigned int Prefetch() const
+	{
+		unsigned int sum = 0;
+		for (size_t offset = 0; offset < size; offset += 4096)
+			sum += data[offset];
+		return sum;
+	}
+
+	const unsigned char* Data() const
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+	bool IsOpen() const
+	{
+		return data != nullptr;
+	}
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+};
+#endif
@@ -0,0 +1,388 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define MIP_GENERATOR_SSE 1
+#if defined(__AVX__)
+#define MIP_GENERATOR_AVX 1
+#endif
+#endif
+
+// Generates the levels below level 0 of a mip chain on the CPU. Texels are widened to 4 floats, colour is converted
+// from sRGB to linear and premultiplied by alpha, and every level is filtered from the one above it: a vertical pass
+// over whole rows (8 floats at a time with AVX, 4 with SSE) then a horizontal pass with one texel per SSE register.
+// The taps of every row and column are computed up front, so odd sizes and the clamped edges need no special case.
+// Results are unpremultiplied, alpha is scaled to keep the coverage level 0 has above TextureImport::AlphaCutoff, and
+// colour goes back to sRGB. A level needs the one above it, so the work is split into bands of rows within a level.
+class MipGenerator
+{
+public:
+	// Fills levels 1 and up of an uncompressed image whose level 0 is already in data
+	static void Generate(unsigned char* data, const TextureImage& image, const TextureImport& import, ThreadPool* pool = nullptr)
+	{
+		if (image.LevelCount < 2)
+			return;
+		int channels = GetTextureFormatInfo(image.Format).Channels;
+		Lanes lanes = { channels, channels == 2 || channels == 4 ? channels - 1 : -1, import.Srgb };
+		const SrgbTables& tables = srgbTables();
+
+		const TextureLevel& top = image.Levels[0];
+		std::vector<float> above((size_t)top.Width * top.Height * 4), below;
+		forRows(pool, top.Height, top.Width, [&](int begin, int end)
+		{
+			for (int y = begin; y < end; y++)
+				widenRow(data + top.Offset + (size_t)y * top.Width * channels, top.Width, lanes, tables, &above[(size_t)y * top.Width * 4]);
+		});
+		bool keepCoverage = import.AlphaCutoff > 0.0f && lanes.Alpha >= 0;
+		float coverage = keepCoverage ? alphaCoverage(above, lanes.Alpha, import.AlphaCutoff) : 0.0f;
+
+		for (int level = 1; level < image.LevelCount; level++)
+		{
+			const TextureLevel& from = image.Levels[level - 1];
+			const TextureLevel& to = image.Levels[level];
+			Taps rows(from.Height, to.Height, import.MipFilter);
+			Taps columns(from.Width, to.Width, import.MipFilter);
+			below.resize((size_t)to.Width * to.Height * 4);
+			forRows(pool, to.Height, from.Width, [&](int begin, int end)
+			{
+				std::vector<float> scratch((size_t)from.Width * 4);
+				for (int y = begin; y < end; y++)
+					filterRow(above.data(), from.Width, rows, columns, y, to.Width, scratch.data(), &below[(size_t)y * to.Width * 4]);
+			});
+
+			float alphaScale = keepCoverage ? coverageScale(below, lanes.Alpha, import.AlphaCutoff, coverage) : 1.0f;
+			forRows(pool, to.Height, to.Width, [&](int begin, int end)
+			{
+				for (int y = begin; y < end; y++)
+					narrowRow(&below[(size_t)y * to.Width * 4], to.Width, lanes, tables, alphaScale, data + to.Offset + (size_t)y * to.Width * channels);
+			});
+			above.swap(below);
+		}
+	}
+
+private:
+	static const int SRGB_TABLE_SIZE = 16384; // linear to sRGB entries, fine enough that every 8 bit value round trips
+
+	// Where a texel's channels sit in its 4 floats. Alpha is the last channel of grey-alpha and RGBA images
+	struct Lanes
+	{
+		int Channels;
+		int Alpha; // -1 without alpha
+		bool Srgb;
+	};
+
+	struct SrgbTables
+	{
+		float ToLinear[256];
+		float Unorm[256]; // i / 255, for alpha and linear channels
+		unsigned char FromLinear[SRGB_TABLE_SIZE];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float v = i / 255.0f;
+				Unorm[i] = v;
+				ToLinear[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < SRGB_TABLE_SIZE; i++)
+			{
+				float v = (float)i / (SRGB_TABLE_SIZE - 1);
+				float s = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+				FromLinear[i] = (unsigned char)(s * 255.0f + 0.5f);
+			}
+		}
+	};
+
+	static const SrgbTables& srgbTables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	// Filter taps of every texel along one axis, Count per texel, with source indices clamped to the edge
+	struct Taps
+	{
+		int Count;
+		std::vector<int> Index;
+		std::vector<float> Weight;
+
+		Taps(int sourceSize, int size, Mip_Filter filter)
+		{
+			float scale = (float)sourceSize / size;
+			float radius = filterRadius(filter);
+			float support = radius * scale; // in source texels
+			// the taps the kernel reaches are at most this many, the texel at the end of the range may fall outside
+			int reach = (int)std::ceil(2.0f * support) + 1;
+			Count = reach - 1;
+			for (int pass = 0; pass < 2; pass++)
+			{
+				Index.assign((size_t)size * Count, 0);
+				Weight.assign((size_t)size * Count, 0.0f);
+				bool fits = true;
+				for (int i = 0; i < size && fits; i++)
+				{
+					float center = (i + 0.5f) * scale;
+					int first = (int)std::ceil(center - support - 0.5f);
+					float sum = 0.0f;
+					for (int k = 0; k < reach; k++)
+					{
+						float x = (first + k + 0.5f - center) / scale;
+						float weight = std::fabs(x) < radius ? filterWeight(filter, x) : 0.0f;
+						if (k >= Count)
+						{
+							fits = weight == 0.0f;
+							break;
+						}
+						Index[i * Count + k] = std::min(std::max(first + k, 0), sourceSize - 1);
+						Weight[i * Count + k] = weight;
+						sum += weight;
+					}
+					for (int k = 0; k < Count; k++)
+						Weight[i * Count + k] /= sum;
+				}
+				if (fits)
+					break;
+				Count = reach;
+			}
+		}
+	};
+
+	// half width of the kernels in texels of the smaller level
+	static float filterRadius(Mip_Filter filter)
+	{
+		return filter == MIP_FILTER_BOX ? 0.5f : 3.0f;
+	}
+
+	static float sinc(float x)
+	{
+		if (std::fabs(x) < 1e-5f)
+			return 1.0f;
+		x *= 3.14159265f;
+		return std::sin(x) / x;
+	}
+
+	// modified Bessel function of the first kind, order 0
+	static float bessel0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 32 && term > sum * 1e-8f; k++)
+		{
+			float half = x / (2.0f * k);
+			term *= half * half;
+			sum += term;
+		}
+		return sum;
+	}
+
+	static float filterWeight(Mip_Filter filter, float x)
+	{
+		const float width = 3.0f;
+		switch (filter)
+		{
+		case MIP_FILTER_KAISER:
+		{
+			const float alpha = 4.0f;
+			float t = x / width;
+			return sinc(x) * bessel0(alpha * std::sqrt(std::max(1.0f - t * t, 0.0f))) / bessel0(alpha);
+		}
+		case MIP_FILTER_LANCZOS:
+			return sinc(x) * sinc(x / width);
+		default:
+			return 1.0f;
+		}
+	}
+
+	template<typename Function>
+	static void forRows(ThreadPool* pool, int rows, int width, const Function& fn)
+	{
+		// bands of roughly 16k texels, small levels run in one piece
+		size_t band = std::max<size_t>(16384 / std::max(width, 1), 1);
+		if (pool != nullptr)
+			pool->ParallelFor((size_t)rows, band, [&](size_t begin, size_t end) { fn((int)begin, (int)end); });
+		else
+			fn(0, rows);
+	}
+
+	static void widenRow(const unsigned char* pixels, int width, const Lanes& lanes, const SrgbTables& tables, float* out)
+	{
+		const float* convert[4];
+		for (int c = 0; c < 4; c++)
+			convert[c] = c == lanes.Alpha || !lanes.Srgb ? tables.Unorm : tables.ToLinear;
+		if (lanes.Alpha < 0)
+		{
+			memset(out, 0, (size_t)width * 4 * sizeof(float));
+			for (int x = 0; x < width; x++, pixels += lanes.Channels, out += 4)
+			{
+				for (int c = 0; c < lanes.Channels; c++)
+					out[c] = convert[c][pixels[c]];
+			}
+			return;
+		}
+		for (int x = 0; x < width; x++, pixels += lanes.Channels, out += 4)
+		{
+			float alpha = tables.Unorm[pixels[lanes.Alpha]];
+			out[0] = convert[0][pixels[0]] * alpha;
+			out[1] = lanes.Alpha == 1 ? alpha : convert[1][pixels[1]] * alpha;
+			out[2] = lanes.Alpha == 1 ? 0.0f : convert[2][pixels[2]] * alpha;
+			out[3] = lanes.Alpha == 1 ? 0.0f : alpha;
+		}
+	}
+
+	static void narrowRow(const float* texels, int width, const Lanes& lanes, const SrgbTables& tables, float alphaScale, unsigned char* out)
+	{
+		for (int x = 0; x < width; x++, texels += 4, out += lanes.Channels)
+		{
+			float alpha = lanes.Alpha >= 0 ? texels[lanes.Alpha] : 1.0f;
+			float unpremultiply = alpha > 1.0f / 1024.0f ? 1.0f / alpha : 0.0f;
+			for (int c = 0; c < lanes.Channels; c++)
+			{
+				if (c == lanes.Alpha)
+				{
+					out[c] = quantizeAlpha(alpha, alphaScale);
+					continue;
+				}
+				float v = std::min(std::max(texels[c] * unpremultiply, 0.0f), 1.0f);
+				out[c] = lanes.Srgb ? tables.FromLinear[(int)(v * (SRGB_TABLE_SIZE - 1) + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+			}
+		}
+	}
+
+	// One row of the level below: the rows of the level above under the vertical taps are summed into scratch, then
+	// the horizontal taps pick from scratch
+	static void filterRow(const float* above, int aboveWidth, const Taps& rows, const Taps& columns, int y, int width,
+		float* scratch, float* out)
+	{
+		size_t count = (size_t)aboveWidth * 4;
+		memset(scratch, 0, count * sizeof(float));
+		for (int k = 0; k < rows.Count; k++)
+		{
+			float weight = rows.Weight[y * rows.Count + k];
+			if (weight == 0.0f)
+				continue;
+			const float* source = above + (size_t)rows.Index[y * rows.Count + k] * count;
+			size_t i = 0;
+#if defined(MIP_GENERATOR_AVX)
+			__m256 w8 = _mm256_set1_ps(weight);
+			for (; i + 8 <= count; i += 8)
+				_mm256_storeu_ps(scratch + i, _mm256_add_ps(_mm256_loadu_ps(scratch + i), _mm256_mul_ps(w8, _mm256_loadu_ps(source + i))));
+#endif
+#if defined(MIP_GENERATOR_SSE)
+			__m128 w4 = _mm_set1_ps(weight);
+			for (; i + 4 <= count; i += 4)
+				_mm_storeu_ps(scratch + i, _mm_add_ps(_mm_loadu_ps(scratch + i), _mm_mul_ps(w4, _mm_loadu_ps(source + i))));
+#endif
+			for (; i < count; i++)
+				scratch[i] += weight * source[i];
+		}
+
+		for (int x = 0; x < width; x++, out += 4)
+		{
+			const int* index = &columns.Index[x * columns.Count];
+			const float* weight = &columns.Weight[x * columns.Count];
+#if defined(MIP_GENERATOR_SSE)
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < columns.Count; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[k]), _mm_loadu_ps(scratch + index[k] * 4)));
+			_mm_storeu_ps(out, sum);
+#else
+			out[0] = out[1] = out[2] = out[3] = 0.0f;
+			for (int k = 0; k < columns.Count; k++)
+			{
+				const float* texel = scratch + index[k] * 4;
+				for (int c = 0; c < 4; c++)
+					out[c] += weight[k] * texel[c];
+			}
+#endif
+		}
+	}
+
+	// Fraction of texels whose alpha passes the cutoff
+	static float alphaCoverage(const std::vector<float>& texels, int alphaLane, float cutoff)
+	{
+		size_t passing = 0, count = texels.size() / 4;
+		for (size_t i = 0; i < count; i++)
+			passing += texels[i * 4 + alphaLane] >= cutoff ? 1 : 0;
+		return count > 0 ? (float)passing / count : 0.0f;
+	}
+
+	static unsigned char quantizeAlpha(float alpha, float alphaScale)
+	{
+		return (unsigned char)(std::min(std::max(alpha * alphaScale, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	// Scale for a level's alpha that lets the same fraction of texels pass the cutoff as in level 0, counted on the
+	// alpha rounded to 8 bits the way narrowRow does. The texel at that fraction is found exactly (nth_element), texels
+	// with the same alpha all pass or all fail, whichever lands closer to the wanted count. The scale puts the weakest
+	// passing texel on the smallest 8 bit value at or above the cutoff, the weakest failing one below it
+	static float coverageScale(const std::vector<float>& texels, int alphaLane, float cutoff, float coverage)
+	{
+		size_t count = texels.size() / 4;
+		double wanted = (double)coverage * count;
+		if (coverage <= 0.0f || coverage >= 1.0f || count == 0)
+			return 1.0f;
+		size_t nth = std::min((size_t)std::max(wanted - 0.5, 0.0), count - 1);
+		std::vector<float> alphas(count);
+		for (size_t i = 0; i < count; i++)
+			alphas[i] = texels[i * 4 + alphaLane];
+		std::nth_element(alphas.begin(), alphas.begin() + nth, alphas.end(), std::greater<float>());
+		float threshold = alphas[nth];
+		size_t above = 0, equal = 0;
+		float higher = HUGE_VALF, lower = -HUGE_VALF; // nearest alphas on either side of the threshold
+		for (float alpha : alphas)
+		{
+			if (alpha > threshold)
+			{
+				above++;
+				higher = std::min(higher, alpha);
+			}
+			else if (alpha == threshold)
+				equal++;
+			else
+				lower = std::max(lower, alpha);
+		}
+
+		// pass from the threshold on, or only what lies above it
+		bool passEqual = threshold > 0.0f && std::abs((double)(above + equal) - wanted) <= std::abs((double)above - wanted);
+		float weakestPassing = passEqual ? threshold : higher;
+		float strongestFailing = passEqual ? lower : threshold;
+		if (weakestPassing == HUGE_VALF)
+			weakestPassing = 2.0f * std::max(threshold, 1.0f / 255.0f);
+		if (strongestFailing < 0.0f)
+			strongestFailing = 0.0f;
+		int code = (int)std::ceil(cutoff * 255.0f);
+		while (code > 0 && (code - 1) / 255.0f >= cutoff)
+			code--;
+		while (code / 255.0f < cutoff)
+			code++;
+		// halfway between the two, rounding then splits them at code - 0.5
+		float scale = (code - 0.5f) / (255.0f * 0.5f * (weakestPassing + strongestFailing));
+		while (quantizeAlpha(weakestPassing, scale) < code)
+			scale = std::nextafter(scale, HUGE_VALF);
+		return scale;
+	}
+};
+
+// Copies a decoded image into storage as level 0, flipped when the import asks for it, and generates the rest of the
+// chain with the import's filter
+inline void BuildMipChain(const unsigned char* pixels, int width, int height, int channels, const TextureImport& import,
+	std::vector<unsigned char>& storage, TextureImage& image, ThreadPool* pool = nullptr)
+{
+	storage.resize(LayoutMipChain(UncompressedTextureFormat(channels), width, height, image));
+	image.Data = storage.data();
+	size_t rowBytes = (size_t)width * channels;
+	for (int y = 0; y < height; y++)
+		memcpy(&storage[y * rowBytes], pixels + (import.FlipVertically ? height - 1 - y : y) * rowBytes, rowBytes);
+	MipGenerator::Generate(storage.data(), image, import, pool);
+}
+#endif
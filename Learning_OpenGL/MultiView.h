@@ -0,0 +1,323 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "Culling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+// Largest number of views in one batch: six cubemap faces or up to eight shadow cascades
+const unsigned int MAX_BATCH_VIEWS = 8;
+
+// Matrices of all views of one light, laid out for a std140 uniform block so it can be uploaded with a single call:
+//   layout (std140) uniform MultiView
+//   {
+//       mat4 views[8];
+//       mat4 projections[8];
+//       mat4 viewProjections[8];
+//       vec4 viewData[8];   // cubemaps: light position and far plane, cascades: split distance in x
+//       int viewCount;
+//   };
+struct MultiViewBlock
+{
+	glm::mat4 View[MAX_BATCH_VIEWS];
+	glm::mat4 Projection[MAX_BATCH_VIEWS];
+	glm::mat4 ViewProjection[MAX_BATCH_VIEWS];
+	glm::vec4 ViewData[MAX_BATCH_VIEWS];
+	int ViewCount = 0;
+	int padding[3] = {};
+};
+
+// out[i] = a[i] * b[i] for count matrices. Each result column is a linear combination of the columns of a, which maps
+// directly onto four wide multiply-adds
+inline void MultiplyMatrixBatch(const glm::mat4* a, const glm::mat4* b, size_t count, glm::mat4* out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+#if defined(CAMERA_SSE)
+		__m128 a0 = _mm_loadu_ps(&a[i][0][0]);
+		__m128 a1 = _mm_loadu_ps(&a[i][1][0]);
+		__m128 a2 = _mm_loadu_ps(&a[i][2][0]);
+		__m128 a3 = _mm_loadu_ps(&a[i][3][0]);
+		for (int c = 0; c < 4; c++)
+		{
+			const float* column = &b[i][c][0];
+			__m128 result = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(column[0])), _mm_mul_ps(a1, _mm_set1_ps(column[1]))),
+				_mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(column[2])), _mm_mul_ps(a3, _mm_set1_ps(column[3]))));
+			_mm_storeu_ps(&out[i][c][0], result);
+		}
+#else
+		out[i] = a[i] * b[i];
+#endif
+	}
+}
+
+// Look directions and up vectors of the cube map faces, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order
+const glm::vec3 CUBEMAP_DIRECTIONS[6] = {
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+const glm::vec3 CUBEMAP_UPS[6] = {
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+	glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+// Fills the block with the six cube map faces seen from position. The position has to be in the same space as the
+// model matrices, camera-relative in this renderer (see Camera::ToCameraRelative). The face rotations never change,
+// they are built once in a batch and only the translation column, -R * position, is filled in per call
+inline void BuildCubemapViews(const glm::vec3& position, float nearPlane, float farPlane, MultiViewBlock& block)
+{
+	struct FaceRotations
+	{
+		glm::mat4 Views[6];
+		FaceRotations()
+		{
+			glm::vec3 origins[6] = { glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f) };
+			Camera::MyLookAtBatch(origins, CUBEMAP_DIRECTIONS, CUBEMAP_UPS, 6, Views);
+		}
+	};
+	static const FaceRotations faces;
+	glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+	for (int face = 0; face < 6; face++)
+	{
+		glm::mat4& view = block.View[face];
+		view = faces.Views[face];
+		view[3] = glm::vec4(-(glm::mat3(view) * position), 1.0f);
+		block.Projection[face] = projection;
+		block.ViewData[face] = glm::vec4(position, farPlane);
+	}
+	MultiplyMatrixBatch(block.Projection, block.View, 6, block.ViewProjection);
+	block.ViewCount = 6;
+}
+
+// Fills the block with cascadeCount directional shadow map views covering the camera frustum up to shadowDistance.
+// Split distances blend a logarithmic and a uniform distribution by splitLambda (1 = fully logarithmic). Every cascade
+// is an orthographic box around the bounding sphere of its frustum slice. The box size only depends on the slice, and
+// its center is snapped to whole shadow map texels in WorldOrigin-relative space, so shadows do not shimmer while the
+// camera moves or turns. The resulting views expect camera-relative positions like the model matrices
+inline void BuildShadowCascades(Camera& camera, float aspect, glm::vec3 lightDirection, unsigned int cascadeCount,
+	float shadowDistance, float splitLambda, unsigned int shadowMapSize, MultiViewBlock& block)
+{
+	cascadeCount = std::min(std::max(cascadeCount, 1u), MAX_BATCH_VIEWS);
+	camera.UpdateOrientation();
+	lightDirection = glm::normalize(lightDirection);
+	glm::vec3 lightUp = std::fabs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	// rotation into light space, used to snap the cascade centers
+	glm::mat3 lightRotation = glm::mat3(Camera::MyLookAt(glm::vec3(0.0f), lightDirection, lightUp));
+	glm::vec3 cameraPosition = camera.ToOriginRelative(camera.Position);
+	float tanY = std::tan(glm::radians(camera.Zoom) * 0.5f);
+	float tanX = tanY * aspect;
+	float nearPlane = camera.NearPlane;
+
+	glm::vec3 positions[MAX_BATCH_VIEWS], targets[MAX_BATCH_VIEWS], ups[MAX_BATCH_VIEWS];
+	float splitNear = nearPlane;
+	for (unsigned int i = 0; i < cascadeCount; i++)
+	{
+		float fraction = (float)(i + 1) / (float)cascadeCount;
+		float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+		float uniformSplit = nearPlane + (shadowDistance - nearPlane) * fraction;
+		float splitFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+
+		// bounding sphere of the slice between splitNear and splitFar, center on the view axis. The two rectangles
+		// have half diagonals k * distance, the center is where both far corners are equally far away
+		float k2 = tanX * tanX + tanY * tanY;
+		float centerDistance = std::min(0.5f * (splitNear + splitFar) * (1.0f + k2), splitFar);
+		float radius = std::sqrt(std::max((splitFar - centerDistance) * (splitFar - centerDistance) + k2 * splitFar * splitFar,
+			(centerDistance - splitNear) * (centerDistance - splitNear) + k2 * splitNear * splitNear));
+		radius = std::ceil(radius * 16.0f) / 16.0f; // keeps the box size from flickering through rounding
+
+		glm::vec3 center = lightRotation * (cameraPosition + camera.Front * centerDistance);
+		float texel = 2.0f * radius / (float)shadowMapSize;
+		center.x = std::floor(center.x / texel) * texel;
+		center.y = std::floor(center.y / texel) * texel;
+		center = glm::transpose(lightRotation) * center;
+
+		// from origin-relative to camera-relative coordinates
+		center -= cameraPosition;
+		positions[i] = center - lightDirection * radius;
+		targets[i] = center;
+		ups[i] = lightUp;
+		block.Projection[i] = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+		block.ViewData[i] = glm::vec4(splitFar, 0.0f, 0.0f, 0.0f);
+		splitNear = splitFar;
+	}
+	Camera::MyLookAtBatch(positions, targets, ups, cascadeCount, block.View);
+	MultiplyMatrixBatch(block.Projection, block.View, cascadeCount, block.ViewProjection);
+	block.ViewCount = (int)cascadeCount;
+}
+
+// Sets view index to what viewCamera sees, for split-screen players or picture-in-picture. Geometry is submitted relative
+// to renderCamera (see Camera::ToCameraRelative), so the view is moved by the offset between the two cameras
+inline void SetCameraView(MultiViewBlock& block, int index, Camera& viewCamera, const Camera& renderCamera, float aspect)
+{
+	const CameraMatrices& matrices = viewCamera.GetMatrices(aspect);
+	glm::vec3 offset = glm::vec3(viewCamera.Position - renderCamera.Position);
+	block.View[index] = matrices.RelativeView;
+	block.View[index][3] = matrices.RelativeView * glm::vec4(-offset, 1.0f);
+	block.Projection[index] = matrices.Projection;
+	block.ViewData[index] = glm::vec4(offset, 0.0f);
+	MultiplyMatrixBatch(&block.Projection[index], &block.View[index], 1, &block.ViewProjection[index]);
+	block.ViewCount = std::max(block.ViewCount, index + 1);
+}
+
+// Fills the block with a left and a right eye, eyeSeparation apart along the camera's Right axis and looking parallel.
+// Both eyes share the camera's projection
+inline void BuildStereoViews(Camera& camera, float aspect, float eyeSeparation, MultiViewBlock& block)
+{
+	const CameraMatrices& matrices = camera.GetMatrices(aspect);
+	glm::vec3 eyes[2] = { -0.5f * eyeSeparation * camera.Right, 0.5f * eyeSeparation * camera.Right };
+	glm::vec3 targets[2] = { eyes[0] + camera.Front, eyes[1] + camera.Front };
+	glm::vec3 ups[2] = { camera.Up, camera.Up };
+	Camera::MyLookAtBatch(eyes, targets, ups, 2, block.View);
+	for (int eye = 0; eye < 2; eye++)
+	{
+		block.Projection[eye] = matrices.Projection;
+		block.ViewData[eye] = glm::vec4(eyes[eye], 0.0f);
+	}
+	MultiplyMatrixBatch(block.Projection, block.View, 2, block.ViewProjection);
+	block.ViewCount = 2;
+}
+
+// One frustum containing every view of the block, so all views share a single culling pass. cameraPosition is the
+// render camera in the space of the bounding volumes (Camera::ToOriginRelative). Planes the views agree on in
+// orientation, like all but the outer side planes of stereo eyes, become the loosest of them; planes that differ
+// between views are dropped, which keeps the result conservative for unrelated cameras
+inline Frustum ExtractSharedFrustum(const MultiViewBlock& block, const glm::vec3& cameraPosition, bool zeroToOneDepth)
+{
+	glm::mat4 toCameraRelative = glm::translate(glm::mat4(1.0f), -cameraPosition);
+	Frustum shared = ExtractFrustum(block.ViewProjection[0] * toCameraRelative, zeroToOneDepth);
+	for (int view = 1; view < block.ViewCount; view++)
+	{
+		Frustum frustum = ExtractFrustum(block.ViewProjection[view] * toCameraRelative, zeroToOneDepth);
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec4& plane = shared.Planes[i];
+			if (glm::dot(glm::vec3(plane), glm::vec3(frustum.Planes[i])) > 0.9999f)
+				plane.w = std::max(plane.w, frustum.Planes[i].w);
+			else
+				plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+	return shared;
+}
+
+// Ways to get geometry into every layer of a LayeredRenderTarget in one submission, best first
+enum Multi_View_Path {
+	MULTIVIEW_PATH_OVR, // GL_OVR_multiview2, one instance, the driver broadcasts to the views
+	MULTIVIEW_PATH_VS_LAYER, // one instance per view, vertex shader picks the layer (GL_AMD_vertex_shader_layer)
+	MULTIVIEW_PATH_GS // one instance per view, geometry shader picks the layer
+};
+
+// Shader defines for multiView.vert
+inline void MultiViewDefines(Multi_View_Path path, int viewCount, char* defines, size_t size)
+{
+	const char* names[] = { "MULTIVIEW_OVR", "MULTIVIEW_VS_LAYER", "MULTIVIEW_GS" };
+	snprintf(defines, size, "#define %s\n#define MULTIVIEW_VIEW_COUNT %d\n", names[path], viewCount);
+}
+
+// Instances to draw per object so every view receives it
+inline int MultiViewInstances(Multi_View_Path path, int viewCount)
+{
+	return path == MULTIVIEW_PATH_OVR ? 1 : viewCount;
+}
+
+// Uniform buffer holding a MultiViewBlock, bound to a fixed binding point. Shaders pick it up with
+// glUniformBlockBinding(program, glGetUniformBlockIndex(program, "MultiView"), binding)
+class MultiViewBuffer
+{
+public:
+	unsigned int UBO = 0;
+	unsigned int Binding = 0;
+
+	void Create(unsigned int binding)
+	{
+		Binding = binding;
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(MultiViewBlock), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, Binding, UBO);
+	}
+
+	// One upload for all views instead of one uniform call per view and matrix
+	void Upload(const MultiViewBlock& block) const
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MultiViewBlock), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void Destroy()
+	{
+		if (UBO != 0)
+			glDeleteBuffers(1, &UBO);
+		UBO = 0;
+	}
+};
+
+// Times building cubemap and cascade matrices one by one with glm against the batch path
+inline void RunMultiViewBenchmark(unsigned int iterations)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	Camera camera(glm::vec3(0.0f, 1.0f, 3.0f));
+	MultiViewBlock block;
+	glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+	float checksum = 0.0f;
+
+	Clock::time_point start = Clock::now();
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		glm::vec3 position = lightPos + glm::vec3((float)(i & 7) * 0.01f);
+		BuildCubemapViews(position, 0.1f, 25.0f, block);
+		checksum += block.ViewProjection[i % 6][i & 3][(i >> 2) & 3];
+	}
+	double batchMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	// the scalar path fills the same block, as it would before an upload
+	MultiViewBlock scalarBlock;
+	float maxError = 0.0f;
+	start = Clock::now();
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		glm::vec3 position = lightPos + glm::vec3((float)(i & 7) * 0.01f);
+		glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 25.0f);
+		for (int face = 0; face < 6; face++)
+		{
+			scalarBlock.View[face] = glm::lookAt(position, position + CUBEMAP_DIRECTIONS[face], CUBEMAP_UPS[face]);
+			scalarBlock.Projection[face] = projection;
+			scalarBlock.ViewProjection[face] = projection * scalarBlock.View[face];
+			scalarBlock.ViewData[face] = glm::vec4(position, 25.0f);
+		}
+		checksum += scalarBlock.ViewProjection[i % 6][i & 3][(i >> 2) & 3];
+	}
+	double scalarMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	for (int face = 0; face < 6; face++)
+	{
+		glm::vec3 position = lightPos + glm::vec3((float)((iterations - 1) & 7) * 0.01f);
+		glm::mat4 reference = glm::lookAt(position, position + CUBEMAP_DIRECTIONS[face], CUBEMAP_UPS[face]);
+		for (int c = 0; c < 4; c++)
+			for (int r = 0; r < 4; r++)
+				maxError = std::max(maxError, std::fabs(reference[c][r] - block.View[face][c][r]));
+	}
+
+	start = Clock::now();
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		camera.Position.x = (double)(i & 7) * 0.01;
+		BuildShadowCascades(camera, 800.0f / 600.0f, glm::vec3(-0.3f, -1.0f, -0.2f), 4, 50.0f, 0.75f, 2048, block);
+		checksum += block.ViewProjection[i & 3][i & 3][(i >> 2) & 3];
+	}
+	double cascadeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	std::cout << "MULTIVIEW::BENCH cubemap scalar " << scalarMs * 1000000.0 / iterations << " ns, batch "
+		<< batchMs * 1000000.0 / iterations << " ns, max error " << maxError << std::endl;
+	std::cout << "MULTIVIEW::BENCH 4 cascades " << cascadeMs * 1000000.0 / iterations << " ns (checksum " << checksum << ")" << std::endl;
+}
+#endif
@@ -0,0 +1,162 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "TextureImage.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Command line options. Every mode is opt-in, running without arguments gives the plain interactive demo. Texture
+// import is the exception: by default imported textures are cached in textureCache/ under the working directory,
+// block compressed (lossy, --texture-compression normal) and get Kaiser filtered mips generated on the CPU.
+// --no-texture-cache, --texture-compression none and --mip-filter box change that
+struct AppOptions
+{
+	bool GLDebug = false; // --gl-debug: create a debug context and aggregate KHR_debug messages
+	bool QuaternionCamera = false; // --quat-camera: quaternion camera orientation instead of Euler angles
+	bool ReverseZ = false; // --reverse-z: reverse-Z infinite projection with a 32 bit float depth buffer
+	double WorldOffset = 0.0; // --world-offset <meters>: move the scene and camera far from the world origin
+	double RebaseDistance = 0.0; // --rebase-distance <meters>: floating origin rebase distance, 0 disables it
+	bool Headless = false; // --headless: render into a hidden window without vsync
+	const char* RecordPath = nullptr; // --record <file>: write camera inputs to a file
+	const char* ReplayPath = nullptr; // --replay <file>: drive the camera from a recording instead of live input
+	float ReplayDeltaTime = 1.0f / 60.0f; // --replay-dt <seconds>: fixed timestep used while replaying
+	const char* FlythroughPath = nullptr; // --flythrough <file>: headless benchmark along a spline camera path
+	const char* BenchOutPath = nullptr; // --bench-out <file>: write the per-segment summary for later comparison
+	const char* BenchBaselinePath = nullptr; // --bench-baseline <file>: compare against a summary from an earlier run
+	const char* PerfMarkersPath = nullptr; // --perf-markers <file>: log trace points with CLOCK_MONOTONIC timestamps
+	size_t BenchCullObjects = 0; // --bench-cull <objects>: run the CPU frustum culling benchmark and exit
+	unsigned int BenchViewIterations = 0; // --bench-views <iterations>: run the batched view matrix benchmark and exit
+	size_t BenchColliders = 0; // --bench-collision <boxes>: run the walking collision benchmark and exit
+	bool NoClip = false; // --noclip: walk through the scene like before collisions existed
+	const char* BenchJpegPath = nullptr; // --bench-jpeg <file>: run the JPEG decode benchmark at every SIMD level and exit
+	unsigned int ReprojectInterval = 0; // --reproject <n>: render every n-th frame and reproject the last one in between
+	bool ReprojectVerify = false; // --reproject-verify: compare the first reprojected frame against the CPU warp
+	size_t TextureBudget = 1024 * 1024; // --texture-budget <KB>: bytes of texture data streamed to the GPU per frame
+	const char* TextureCachePath = "textureCache"; // --texture-cache <dir>: imported textures, --no-texture-cache disables it
+	Texture_Compression TextureCompression = TEXTURE_COMPRESSION_NORMAL; // --texture-compression none|fast|normal|high
+	Mip_Filter TextureMipFilter = MIP_FILTER_KAISER; // --mip-filter box|kaiser|lanczos: kernel the texture mips are filtered with
+	std::vector<const char*> CookPaths; // --cook <file>: import a texture into the texture cache and exit, repeatable
+	const char* BenchBlockCompressionPath = nullptr; // --bench-bc <file>: run the block compression benchmark and exit
+	bool Atlas = false; // --atlas auto|array|packed: draw a row of cubes textured from one atlas in a single call
+	Atlas_Layout AtlasLayout = ATLAS_LAYOUT_AUTO;
+	std::vector<const char*> BenchDecodePaths; // --bench-decode <file>: batch decode benchmark, heap against decode arenas, repeatable
+	float StereoSeparation = 0.0f; // --stereo <eye separation>: render both eyes in one pass, side by side
+	float BenchTolerance = 0.1f; // --bench-tolerance <fraction>: allowed median slowdown per segment before failing
+};
+
+// Parses argv into AppOptions. Unknown arguments are reported and ignored
+inline AppOptions ParseOptions(int argc, char** argv)
+{
+	AppOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (strcmp(arg, "--gl-debug") == 0)
+			options.GLDebug = true;
+		else if (strcmp(arg, "--quat-camera") == 0)
+			options.QuaternionCamera = true;
+		else if (strcmp(arg, "--reverse-z") == 0)
+			options.ReverseZ = true;
+		else if (strcmp(arg, "--world-offset") == 0 && value)
+			options.WorldOffset = atof(argv[++i]);
+		else if (strcmp(arg, "--rebase-distance") == 0 && value)
+			options.RebaseDistance = atof(argv[++i]);
+		else if (strcmp(arg, "--headless") == 0)
+			options.Headless = true;
+		else if (strcmp(arg, "--record") == 0 && value)
+			options.RecordPath = argv[++i];
+		else if (strcmp(arg, "--replay") == 0 && value)
+			options.ReplayPath = argv[++i];
+		else if (strcmp(arg, "--replay-dt") == 0 && value)
+			options.ReplayDeltaTime = (float)atof(argv[++i]);
+		else if (strcmp(arg, "--flythrough") == 0 && value)
+		{
+			options.FlythroughPath = argv[++i];
+			options.Headless = true; // benchmarks run unattended
+		}
+		else if (strcmp(arg, "--bench-out") == 0 && value)
+			options.BenchOutPath = argv[++i];
+		else if (strcmp(arg, "--bench-baseline") == 0 && value)
+			options.BenchBaselinePath = argv[++i];
+		else if (strcmp(arg, "--bench-tolerance") == 0 && value)
+			options.BenchTolerance = (float)atof(argv[++i]);
+		else if (strcmp(arg, "--bench-cull") == 0 && value)
+			options.BenchCullObjects = (size_t)strtoull(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--reproject") == 0 && value)
+			options.ReprojectInterval = (unsigned int)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--reproject-verify") == 0)
+			options.ReprojectVerify = true;
+		else if (strcmp(arg, "--stereo") == 0 && value)
+			options.StereoSeparation = (float)atof(argv[++i]);
+		else if (strcmp(arg, "--bench-views") == 0 && value)
+			options.BenchViewIterations = (unsigned int)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--bench-collision") == 0 && value)
+			options.BenchColliders = (size_t)strtoull(argv[++i], nullptr, 10);
+		else if (strcmp(arg, "--noclip") == 0)
+			options.NoClip = true;
+		else if (strcmp(arg, "--bench-jpeg") == 0 && value)
+			options.BenchJpegPath = argv[++i];
+		else if (strcmp(arg, "--texture-budget") == 0 && value)
+			options.TextureBudget = (size_t)strtoull(argv[++i], nullptr, 10) * 1024;
+		else if (strcmp(arg, "--texture-cache") == 0 && value)
+			options.TextureCachePath = argv[++i];
+		else if (strcmp(arg, "--no-texture-cache") == 0)
+			options.TextureCachePath = nullptr;
+		else if (strcmp(arg, "--texture-compression") == 0 && value)
+		{
+			const char* names[4] = { "none", "fast", "normal", "high" };
+			const char* name = argv[++i];
+			int preset = 0;
+			while (preset < 4 && strcmp(name, names[preset]) != 0)
+				preset++;
+			if (preset < 4)
+				options.TextureCompression = (Texture_Compression)preset;
+			else
+				std::cout << "ERROR::OPTIONS::UNKNOWN_TEXTURE_COMPRESSION " << name << std::endl;
+		}
+		else if (strcmp(arg, "--mip-filter") == 0 && value)
+		{
+			const char* names[3] = { "box", "kaiser", "lanczos" };
+			const char* name = argv[++i];
+			int filter = 0;
+			while (filter < 3 && strcmp(name, names[filter]) != 0)
+				filter++;
+			if (filter < 3)
+				options.TextureMipFilter = (Mip_Filter)filter;
+			else
+				std::cout << "ERROR::OPTIONS::UNKNOWN_MIP_FILTER " << name << std::endl;
+		}
+		else if (strcmp(arg, "--cook") == 0 && value)
+			options.CookPaths.push_back(argv[++i]);
+		else if (strcmp(arg, "--bench-bc") == 0 && value)
+			options.BenchBlockCompressionPath = argv[++i];
+		else if (strcmp(arg, "--bench-decode") == 0 && value)
+			options.BenchDecodePaths.push_back(argv[++i]);
+		else if (strcmp(arg, "--atlas") == 0 && value)
+		{
+			const char* names[3] = { "auto", "array", "packed" };
+			const char* name = argv[++i];
+			int layout = 0;
+			while (layout < 3 && strcmp(name, names[layout]) != 0)
+				layout++;
+			if (layout < 3)
+			{
+				options.Atlas = true;
+				options.AtlasLayout = (Atlas_Layout)layout;
+			}
+			else
+				std::cout << "ERROR::OPTIONS::UNKNOWN_ATLAS_LAYOUT " << name << std::endl;
+		}
+		else if (strcmp(arg, "--perf-markers") == 0 && value)
+			options.PerfMarkersPath = argv[++i];
+		else
+			std::cout << "ERROR::OPTIONS::UNKNOWN_ARGUMENT " << arg << std::endl;
+	}
+	return options;
+}
+#endif
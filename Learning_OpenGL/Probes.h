@@ -0,0 +1,108 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <cstdio>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <time.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#endif
+
+// Static trace points on the render loop and loader hot paths.
+//
+// On Linux with systemtap's <sys/sdt.h> installed, every trace point is also a USDT probe of the "learning_opengl"
+// provider. A USDT probe compiles to a single nop plus a note in the ELF file, so it costs nothing until perf,
+// bpftrace or a uprobe attaches to it, e.g.
+//   perf buildid-cache --add ./Learning_OpenGL && perf record -e sdt_learning_opengl:frame_begin ...
+//   bpftrace -e 'usdt:./Learning_OpenGL:learning_opengl:draw { @draws = count(); }'
+// Elsewhere the probes compile away.
+//
+// Independently of USDT, --perf-markers <file> writes every trace point as a "<CLOCK_MONOTONIC ns> <name> <arg>"
+// line, the clock perf uses with "perf record -k mono", so markers line up with "perf script" output.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LEARNING_OPENGL_HAS_SDT 1
+#endif
+#endif
+
+#ifdef LEARNING_OPENGL_HAS_SDT
+#define LEARNING_OPENGL_PROBE1(name, arg) DTRACE_PROBE1(learning_opengl, name, arg)
+#define LEARNING_OPENGL_PROBE2(name, arg1, arg2) DTRACE_PROBE2(learning_opengl, name, arg1, arg2)
+#else
+#define LEARNING_OPENGL_PROBE1(name, arg) ((void)0)
+#define LEARNING_OPENGL_PROBE2(name, arg1, arg2) ((void)0)
+#endif
+
+// Marker file written when --perf-markers is given. Disabled markers cost one well predicted branch
+class PerfMarkers
+{
+public:
+	static bool Open(const char* path)
+	{
+		file() = fopen(path, "w");
+		if (file() == NULL)
+			return false;
+#if defined(__linux__)
+		fprintf(file(), "# perf markers, pid %d, clock CLOCK_MONOTONIC ns\n", (int)getpid());
+#endif
+		return true;
+	}
+
+	static void Close()
+	{
+		if (file() != NULL)
+			fclose(file());
+		file() = NULL;
+	}
+
+	static void Mark(const char* name, long long arg)
+	{
+		FILE* out = file();
+		if (out != NULL)
+			fprintf(out, "%llu %s %lld\n", (unsigned long long)nowNs(), name, arg);
+	}
+
+	static void Mark(const char* name, const char* arg)
+	{
+		FILE* out = file();
+		if (out != NULL)
+			fprintf(out, "%llu %s %s\n", (unsigned long long)nowNs(), name, arg);
+	}
+
+private:
+	// function local static so every translation unit shares the same file
+	static FILE*& file()
+	{
+		static FILE* markerFile = NULL;
+		return markerFile;
+	}
+
+	static uint64_t nowNs()
+	{
+#if defined(__linux__)
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+};
+
+// Trace points. Arguments are integers or C strings, which USDT consumers read with str()
+#define TRACE_POINT(name, arg) do { LEARNING_OPENGL_PROBE1(name, arg); PerfMarkers::Mark(#name, (long long)(arg)); } while (0)
+#define TRACE_POINT_STR(name, arg) do { LEARNING_OPENGL_PROBE1(name, arg); PerfMarkers::Mark(#name, (const char*)(arg)); } while (0)
+#define TRACE_POINT2(name, arg1, arg2) do { LEARNING_OPENGL_PROBE2(name, arg1, arg2); PerfMarkers::Mark(#name, (long long)(arg1)); } while (0)
+
+#define TRACE_FRAME_BEGIN(frame) TRACE_POINT(frame_begin, frame)
+#define TRACE_FRAME_END(frame) TRACE_POINT(frame_end, frame)
+#define TRACE_DRAW(vao, vertexCount) TRACE_POINT2(draw, vao, vertexCount)
+#define TRACE_SHADER_COMPILE_BEGIN(path) TRACE_POINT_STR(shader_compile_begin, path)
+#define TRACE_SHADER_COMPILE_END(program) TRACE_POINT(shader_compile_end, program)
+#define TRACE_IMAGE_DECODE_BEGIN(path) TRACE_POINT_STR(image_decode_begin, path)
+#define TRACE_IMAGE_DECODE_END(bytes) TRACE_POINT(image_decode_end, bytes)
+#endif
@@ -0,0 +1,221 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+
+// GL_OVR_multiview is not part of the generated glad loader, main loads it through glfwGetProcAddress
+typedef void (APIENTRYP PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC)(GLenum target, GLenum attachment, GLuint texture, GLint level, GLint baseViewIndex, GLsizei numViews);
+
+// function local static so every translation unit shares the same pointer
+inline PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC& FramebufferTextureMultiviewOVR()
+{
+	static PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC proc = NULL;
+	return proc;
+}
+
+// An offscreen framebuffer with a colour and a depth texture. The default framebuffer's depth format is picked by the
+// window system (usually 24 bit fixed point), rendering here allows a 32 bit float depth buffer and lets later passes
+// sample the scene's colour and depth.
+class RenderTarget
+{
+public:
+	unsigned int FBO = 0;
+	unsigned int ColorTexture = 0;
+	unsigned int DepthTexture = 0;
+	int Width = 0;
+	int Height = 0;
+	GLenum DepthFormat = GL_DEPTH_COMPONENT32F;
+
+	bool Create(int width, int height, GLenum depthFormat = GL_DEPTH_COMPONENT32F)
+	{
+		Destroy();
+		Width = width;
+		Height = height;
+		DepthFormat = depthFormat;
+
+		glGenTextures(1, &ColorTexture);
+		glBindTexture(GL_TEXTURE_2D, ColorTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		setSamplerState();
+
+		glGenTextures(1, &DepthTexture);
+		glBindTexture(GL_TEXTURE_2D, DepthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, depthFormat, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		setSamplerState();
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ColorTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, DepthTexture, 0);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::NOT_COMPLETE" << std::endl;
+			Destroy();
+		}
+		return complete;
+	}
+
+	// Recreates the attachments at a new size, keeping the formats
+	void Resize(int width, int height)
+	{
+		if (FBO != 0 && (width != Width || height != Height) && width > 0 && height > 0)
+			Create(width, height, DepthFormat);
+	}
+
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, Width, Height);
+	}
+
+	// Copies the colour attachment to the window, leaves the default framebuffer bound
+	void BlitToDefault(int windowWidth, int windowHeight) const
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, Width, Height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void Destroy()
+	{
+		if (FBO != 0)
+			glDeleteFramebuffers(1, &FBO);
+		if (ColorTexture != 0)
+			glDeleteTextures(1, &ColorTexture);
+		if (DepthTexture != 0)
+			glDeleteTextures(1, &DepthTexture);
+		FBO = ColorTexture = DepthTexture = 0;
+	}
+
+private:
+	static void setSamplerState()
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+};
+
+// An offscreen framebuffer whose colour and depth textures are 2D arrays with one layer per view, so a single pass can
+// render several views (see MultiView.h). With multiview the layers are attached through GL_OVR_multiview and the
+// driver picks the layer, otherwise the whole array is attached as a layered attachment and shaders write gl_Layer.
+class LayeredRenderTarget
+{
+public:
+	unsigned int FBO = 0;
+	unsigned int ColorTexture = 0;
+	unsigned int DepthTexture = 0;
+	std::vector<unsigned int> LayerFBOs; // one read framebuffer per layer, for blitting
+	int Width = 0;
+	int Height = 0;
+	int Layers = 0;
+	bool Multiview = false;
+	GLenum DepthFormat = GL_DEPTH_COMPONENT32F;
+
+	bool Create(int width, int height, int layers, bool multiview, GLenum depthFormat = GL_DEPTH_COMPONENT32F)
+	{
+		Destroy();
+		Width = width;
+		Height = height;
+		Layers = layers;
+		Multiview = multiview && FramebufferTextureMultiviewOVR() != NULL;
+		DepthFormat = depthFormat;
+
+		glGenTextures(1, &ColorTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ColorTexture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		setSamplerState();
+
+		glGenTextures(1, &DepthTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, DepthTexture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, depthFormat, width, height, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		setSamplerState();
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		if (Multiview)
+		{
+			FramebufferTextureMultiviewOVR()(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, ColorTexture, 0, 0, layers);
+			FramebufferTextureMultiviewOVR()(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, DepthTexture, 0, 0, layers);
+		}
+		else
+		{
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, ColorTexture, 0);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, DepthTexture, 0);
+		}
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+		LayerFBOs.resize(layers);
+		glGenFramebuffers(layers, LayerFBOs.data());
+		for (int layer = 0; layer < layers; layer++)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, LayerFBOs[layer]);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, ColorTexture, 0, layer);
+			complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::LAYERED_NOT_COMPLETE" << std::endl;
+			Destroy();
+		}
+		return complete;
+	}
+
+	// Recreates the attachments at a new size, keeping layers and formats
+	void Resize(int width, int height)
+	{
+		if (FBO != 0 && (width != Width || height != Height) && width > 0 && height > 0)
+			Create(width, height, Layers, Multiview, DepthFormat);
+	}
+
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, Width, Height);
+	}
+
+	// Copies the layers next to each other into the window, leaves the default framebuffer bound
+	void BlitLayersSideBySide(int windowWidth, int windowHeight) const
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		for (int layer = 0; layer < Layers; layer++)
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, LayerFBOs[layer]);
+			glBlitFramebuffer(0, 0, Width, Height, windowWidth * layer / Layers, 0, windowWidth * (layer + 1) / Layers, windowHeight,
+				GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void Destroy()
+	{
+		if (FBO != 0)
+			glDeleteFramebuffers(1, &FBO);
+		if (!LayerFBOs.empty())
+			glDeleteFramebuffers((GLsizei)LayerFBOs.size(), LayerFBOs.data());
+		if (ColorTexture != 0)
+			glDeleteTextures(1, &ColorTexture);
+		if (DepthTexture != 0)
+			glDeleteTextures(1, &DepthTexture);
+		FBO = ColorTexture = DepthTexture = 0;
+		LayerFBOs.clear();
+	}
+
+private:
+	static void setSamplerState()
+	{
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+};
+#endif
@@ -0,0 +1,239 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "RenderTarget.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Synthesizes frames between real ones by reprojecting the last rendered colour and depth buffer to the current camera
+// pose. Every source pixel is unprojected with its depth and splatted as a point where the current camera sees it,
+// with a depth test so the nearest surface wins. Pixels nothing landed on are disocclusions and get filled from the
+// background next to them. Both passes have a CPU twin doing the same arithmetic, so the GPU result can be checked.
+class Reprojector
+{
+public:
+	int FillRadius = 16; // pixels searched to each side for a disocclusion fill
+
+	bool Create(int width, int height)
+	{
+		if (!warpTarget.Create(width, height, GL_DEPTH_COMPONENT32F))
+			return false;
+		warpShader.reset(new Shader("reproject.vert", "reproject.frag"));
+		fillShader.reset(new Shader("reprojectFill.vert", "reprojectFill.frag"));
+		glGenVertexArrays(1, &emptyVAO); // core profile draws need a VAO even without attributes
+		return true;
+	}
+
+	void Resize(int width, int height)
+	{
+		warpTarget.Resize(width, height);
+		hasSource = false; // the old frame no longer matches the buffers
+	}
+
+	void Destroy()
+	{
+		warpTarget.Destroy();
+		if (emptyVAO != 0)
+			glDeleteVertexArrays(1, &emptyVAO);
+		emptyVAO = 0;
+		warpShader.reset();
+		fillShader.reset();
+	}
+
+	// Remembers the pose of the frame just rendered, matrices as returned by Camera::GetMatrices
+	void SetSource(const CameraMatrices& matrices, const glm::dvec3& position)
+	{
+		sourceInverse = matrices.InverseRelativeViewProjection;
+		sourcePosition = position;
+		hasSource = true;
+	}
+
+	bool HasSource() const
+	{
+		return hasSource;
+	}
+
+	// Maps source clip space to current clip space. Both frames render camera-relative, so the camera movement
+	// between them is applied as a translation computed in double precision
+	glm::mat4 WarpMatrix(const CameraMatrices& matrices, const glm::dvec3& position) const
+	{
+		glm::vec3 moved = glm::vec3(sourcePosition - position);
+		return matrices.RelativeViewProjection * glm::translate(glm::mat4(1.0f), moved) * sourceInverse;
+	}
+
+	// Warps source into the current pose and writes the filled result to framebuffer, 0 for the window. reverseZ
+	// selects the 0..1 clip depth and inverted depth test set up by enableReverseZ
+	void Synthesize(const RenderTarget& source, const glm::mat4& warp, bool reverseZ, unsigned int framebuffer, int width, int height)
+	{
+		// 1. splat every source pixel, keeping the nearest
+		warpTarget.Bind();
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		warpShader->use();
+		warpShader->setMat4("warp", warp);
+		warpShader->setBool("zeroToOneDepth", reverseZ);
+		warpShader->setInt("sourceColor", 0);
+		warpShader->setInt("sourceDepth", 1);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, source.ColorTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, source.DepthTexture);
+		glBindVertexArray(emptyVAO);
+		// background pixels sit exactly on the far plane (or at infinity with reverse-Z) and would be clipped by the
+		// slightest rounding, depth clamping keeps them and any surface that moved past the far plane. They also land
+		// on the cleared depth, so equal depth passes too and the last point drawn wins
+		glEnable(GL_DEPTH_CLAMP);
+		glDepthFunc(reverseZ ? GL_GEQUAL : GL_LEQUAL);
+		glDrawArrays(GL_POINTS, 0, source.Width * source.Height);
+		glDepthFunc(reverseZ ? GL_GREATER : GL_LESS);
+		glDisable(GL_DEPTH_CLAMP);
+
+		// 2. fill the holes while drawing to the output
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		glDisable(GL_DEPTH_TEST);
+		fillShader->use();
+		fillShader->setBool("reverseZ", reverseZ);
+		fillShader->setInt("fillRadius", FillRadius);
+		fillShader->setInt("warpedColor", 0);
+		fillShader->setInt("warpedDepth", 1);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, warpTarget.ColorTexture);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, warpTarget.DepthTexture);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glEnable(GL_DEPTH_TEST);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// Runs the CPU warp on the source buffers and compares it with what Synthesize just drew, before the buffers are
+	// swapped. Returns the number of pixels that differ by more than one step in any channel
+	size_t Verify(const RenderTarget& source, const glm::mat4& warp, bool reverseZ, unsigned int framebuffer)
+	{
+		size_t pixels = (size_t)source.Width * source.Height;
+		std::vector<uint32_t> color(pixels), warpedColor(pixels), expected(pixels), actual(pixels);
+		std::vector<float> depth(pixels), warpedDepth(pixels);
+		glBindTexture(GL_TEXTURE_2D, source.ColorTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, color.data());
+		glBindTexture(GL_TEXTURE_2D, source.DepthTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glReadPixels(0, 0, source.Width, source.Height, GL_RGBA, GL_UNSIGNED_BYTE, actual.data());
+
+		WarpCpu(color.data(), depth.data(), source.Width, source.Height, warp, reverseZ, warpedColor.data(), warpedDepth.data());
+		FillCpu(warpedColor.data(), warpedDepth.data(), source.Width, source.Height, reverseZ, FillRadius, expected.data());
+		size_t mismatched = 0;
+		for (size_t i = 0; i < pixels; i++)
+			mismatched += colorDiffers(expected[i], actual[i]) ? 1 : 0;
+		std::cout << "REPROJECT::VERIFY " << mismatched << " of " << pixels << " pixels differ between CPU and GPU" << std::endl;
+		return mismatched;
+	}
+
+	// CPU version of reproject.vert: RGBA8 colour and window depth in, splatted colour (alpha 0 = hole) and depth out
+	static void WarpCpu(const uint32_t* color, const float* depth, int width, int height, const glm::mat4& warp, bool reverseZ,
+		uint32_t* warpedColor, float* warpedDepth)
+	{
+		size_t pixels = (size_t)width * height;
+		float clearDepth = reverseZ ? 0.0f : 1.0f;
+		for (size_t i = 0; i < pixels; i++)
+		{
+			warpedColor[i] = 0;
+			warpedDepth[i] = clearDepth;
+		}
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				size_t index = (size_t)y * width + x;
+				glm::vec4 ndc((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f,
+					reverseZ ? depth[index] : depth[index] * 2.0f - 1.0f, 1.0f);
+				glm::vec4 clip = warp * ndc;
+				// side planes of the clip volume, which also drop everything behind the camera. Depth is clamped instead of
+				// clipped, like GL_DEPTH_CLAMP on the GPU
+				if (clip.w <= 0.0f || std::fabs(clip.x) > clip.w || std::fabs(clip.y) > clip.w)
+					continue;
+				float windowDepth = reverseZ ? clip.z / clip.w : clip.z / clip.w * 0.5f + 0.5f;
+				windowDepth = std::min(std::max(windowDepth, 0.0f), 1.0f);
+				int targetX = (int)std::floor((clip.x / clip.w * 0.5f + 0.5f) * width);
+				int targetY = (int)std::floor((clip.y / clip.w * 0.5f + 0.5f) * height);
+				if (targetX < 0 || targetX >= width || targetY < 0 || targetY >= height)
+					continue;
+				size_t target = (size_t)targetY * width + targetX;
+				bool nearer = reverseZ ? windowDepth >= warpedDepth[target] : windowDepth <= warpedDepth[target];
+				if (!nearer)
+					continue;
+				warpedDepth[target] = windowDepth;
+				warpedColor[target] = color[index] | 0xff000000u; // alpha 1 marks a covered pixel
+			}
+		}
+	}
+
+	// CPU version of reprojectFill.frag
+	static void FillCpu(const uint32_t* warpedColor, const float* warpedDepth, int width, int height, bool reverseZ, int radius,
+		uint32_t* out)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			const uint32_t* row = warpedColor + (size_t)y * width;
+			const float* depthRow = warpedDepth + (size_t)y * width;
+			for (int x = 0; x < width; x++)
+			{
+				uint32_t color = row[x];
+				if ((color >> 24) == 0)
+				{
+					bool found = false;
+					float bestDepth = 0.0f;
+					for (int side = -1; side <= 1; side += 2)
+					{
+						for (int step = 1; step <= radius; step++)
+						{
+							int sx = x + side * step;
+							if (sx < 0 || sx >= width)
+								break;
+							if ((row[sx] >> 24) == 0)
+								continue;
+							if (!found || (reverseZ ? depthRow[sx] < bestDepth : depthRow[sx] > bestDepth))
+							{
+								color = row[sx];
+								bestDepth = depthRow[sx];
+								found = true;
+							}
+							break;
+						}
+					}
+				}
+				out[(size_t)y * width + x] = color | 0xff000000u;
+			}
+		}
+	}
+
+private:
+	RenderTarget warpTarget;
+	std::unique_ptr<Shader> warpShader;
+	std::unique_ptr<Shader> fillShader;
+	unsigned int emptyVAO = 0;
+	glm::mat4 sourceInverse = glm::mat4(1.0f);
+	glm::dvec3 sourcePosition = glm::dvec3(0.0);
+	bool hasSource = false;
+
+	static bool colorDiffers(uint32_t a, uint32_t b)
+	{
+		for (int shift = 0; shift < 32; shift += 8)
+			if (std::abs((int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff)) > 1)
+				return true;
+		return false;
+	}
+};
+#endif
@@ -4,6 +4,9 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "AllocTracker.h"
+#include "Probes.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -13,10 +16,13 @@ class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly. defines, if given, are inserted after the #version line of every
+	// stage, e.g. "#define MULTIVIEW_GS\n", so one source file can be compiled in several variants
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const char* defines = nullptr)
 	{
+		AllocScope allocScope(ALLOC_SHADER); // file reading and source strings are charged to the shader subsystem
+		TRACE_SHADER_COMPILE_BEGIN(vertexPath);
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -57,6 +63,12 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		if (defines != nullptr)
+		{
+			insertDefines(vertexCode, defines);
+			insertDefines(fragmentCode, defines);
+			insertDefines(geometryCode, defines);
+		}
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
 		// 2. compile shaders
@@ -94,6 +106,7 @@ public:
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
+		TRACE_SHADER_COMPILE_END(ID);
 
 	}
 	// activate the shader
@@ -102,66 +115,76 @@ public:
 	{
 		glUseProgram(ID);
 	}
-	// utility uniform functions
+	// utility uniform functions, names are taken as C strings so per-frame uniform updates never build a std::string
 	// ------------------------------------------------------------------------
-	void setBool(const std::string& name, bool value) const
+	void setBool(const char* name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(glGetUniformLocation(ID, name), (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string& name, int value) const
+	void setInt(const char* name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(glGetUniformLocation(ID, name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string& name, float value) const
+	void setFloat(const char* name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(glGetUniformLocation(ID, name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string& name, const glm::vec2& value) const
+	void setVec2(const char* name, const glm::vec2& value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec2(const std::string& name, float x, float y) const
+	void setVec2(const char* name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(glGetUniformLocation(ID, name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string& name, const glm::vec3& value) const
+	void setVec3(const char* name, const glm::vec3& value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec3(const std::string& name, float x, float y, float z) const
+	void setVec3(const char* name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(glGetUniformLocation(ID, name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string& name, const glm::vec4& value) const
+	void setVec4(const char* name, const glm::vec4& value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec4(const std::string& name, float x, float y, float z, float w)
+	void setVec4(const char* name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(glGetUniformLocation(ID, name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string& name, const glm::mat2& mat) const
+	void setMat2(const char* name, const glm::mat2& mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string& name, const glm::mat3& mat) const
+	void setMat3(const char* name, const glm::mat3& mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string& name, const glm::mat4& mat) const
+	void setMat4(const char* name, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
+	// inserts the defines after the #version line, which has to stay the first directive
+	// ------------------------------------------------------------------------
+	static void insertDefines(std::string& code, const char* defines)
+	{
+		size_t version = code.find("#version");
+		size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return;
+		code.insert(lineEnd + 1, defines);
+	}
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
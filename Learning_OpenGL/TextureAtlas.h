@@ -0,0 +1,266 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "stb_image.h"
+#include "DecodeArena.h"
+#include "GLDebug.h"
+#include "MipGenerator.h"
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// most draws a shader batches into one call, the length of its per-draw material arrays
+const int ATLAS_MAX_DRAWS = 16;
+
+// Where a texture ended up in a TextureAtlas. Shaders map the texture's own coordinates into the atlas with
+// fract(uv) * UvTransform.xy + UvTransform.zw (clamp(uv, 0, 1) for a texture that doesn't repeat) and sample layer
+// Layer, this is all a draw needs to know of its texture
+struct AtlasRegion
+{
+	int Layer;
+	glm::vec4 UvTransform; // xy scale, zw offset
+};
+
+// Puts small textures into one GL_TEXTURE_2D_ARRAY, so draws with different textures need no glBindTexture in between
+// and can be batched into one call that passes every draw's AtlasRegion along as material data. Textures of one size
+// become whole layers with their full mip chains. Mixed sizes are shelf packed into a single layer, a padded 2D atlas
+// that is an array of one so the same shaders sample both. Packed textures sit in cells aligned to Padding texels with
+// a gutter of at least Padding around them, filled by continuing the texture the way its wrap mode would (GL_REPEAT
+// wraps, anything else clamps), so filtering never picks up a neighbour. Every level keeps a gutter of at least one
+// texel, which limits a packed atlas to log2(Padding) + 1 levels. The mips are filtered per texture before packing.
+// Textures are loaded as RGBA8 with the import's flip, mip filter and sRGB handling, they are not block compressed
+class TextureAtlas
+{
+public:
+	unsigned int ID = 0;
+	int Width = 0;
+	int Height = 0;
+	int Layers = 0;
+	int Levels = 0;
+	int Padding = 8; // a power of two, set before Build
+
+	// Loads the files and uploads the atlas, regions gets one entry per path in the same order. Fails without creating
+	// anything when a file doesn't load or the atlas would exceed the GL's texture size limits
+	bool Build(const std::vector<const char*>& paths, Atlas_Layout layout, GLint wrap, const TextureImport& import,
+		std::vector<AtlasRegion>& regions, ThreadPool* pool = nullptr)
+	{
+		Destroy();
+		std::vector<Source> sources(paths.size());
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			DecodeArenaScope arena;
+			int width, height, channels;
+			unsigned char* pixels = stbi_load(paths[i], &width, &height, &channels, 4);
+			if (pixels == NULL)
+			{
+				std::cout << "ERROR::TEXTURE_ATLAS::LOAD_FAILED " << paths[i] << ": " << stbi_failure_reason() << std::endl;
+				return false;
+			}
+			BuildMipChain(pixels, width, height, 4, import, sources[i].Storage, sources[i].Image, pool);
+			stbi_image_free(pixels);
+		}
+		if (sources.empty())
+			return false;
+
+		bool sameSize = true;
+		for (const Source& source : sources)
+			sameSize = sameSize && source.Image.Width() == sources[0].Image.Width() && source.Image.Height() == sources[0].Image.Height();
+		if (layout == ATLAS_LAYOUT_AUTO)
+			layout = sameSize ? ATLAS_LAYOUT_ARRAY : ATLAS_LAYOUT_PACKED;
+		bool padded = layout == ATLAS_LAYOUT_PACKED || !sameSize;
+		int padding = padded ? Padding : 0;
+		GLint maxSize = 0, maxLayers = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		if (layout == ATLAS_LAYOUT_ARRAY)
+			placeInLayers(sources, padding);
+		else
+			pack(sources, maxSize);
+		if (Width > maxSize || Height > maxSize || Layers > maxLayers)
+		{
+			std::cout << "ERROR::TEXTURE_ATLAS::TOO_LARGE " << Width << "x" << Height << "x" << Layers << std::endl;
+			Width = Height = Layers = 0;
+			return false;
+		}
+		Levels = MipLevelCount(Width, Height);
+		if (padded)
+		{
+			int gutterLevels = 1;
+			while ((Padding >> gutterLevels) > 0)
+				gutterLevels++;
+			Levels = std::min(Levels, gutterLevels);
+		}
+
+		glGenTextures(1, &ID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		std::vector<unsigned char> level;
+		for (int l = 0; l < Levels; l++)
+		{
+			int width = std::max(Width >> l, 1), height = std::max(Height >> l, 1);
+			level.assign((size_t)width * height * 4 * Layers, 0);
+			for (const Source& source : sources)
+			{
+				unsigned char* layer = &level[(size_t)width * height * 4 * source.Layer];
+				copyLevel(source, std::min(l, source.Image.LevelCount - 1), padding >> l, wrap == GL_REPEAT, l, layer, width, height);
+			}
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, width, height, Layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, level.data());
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, Levels - 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// whole layers wrap in hardware, packed textures are wrapped by the shader and their gutters
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, padded ? GL_CLAMP_TO_EDGE : wrap);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, padded ? GL_CLAMP_TO_EDGE : wrap);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		GLDebugLog::Label(GL_TEXTURE, ID, "textureAtlas");
+
+		regions.resize(sources.size());
+		double used = 0.0;
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			const Source& source = sources[i];
+			regions[i].Layer = source.Layer;
+			regions[i].UvTransform = glm::vec4((float)source.Image.Width() / Width, (float)source.Image.Height() / Height,
+				(float)source.X / Width, (float)source.Y / Height);
+			used += (double)source.Image.Width() * source.Image.Height();
+		}
+		std::cout << "TEXTURE_ATLAS::BUILT " << sources.size() << " textures, " << (padded ? "padded " : "")
+			<< (layout == ATLAS_LAYOUT_PACKED ? "packed " : "layers ") << Width << "x" << Height << "x" << Layers << ", "
+			<< Levels << " levels, " << 100.0 * used / ((double)Width * Height * Layers) << "% used" << std::endl;
+		return true;
+	}
+
+	void Destroy()
+	{
+		if (ID != 0)
+			glDeleteTextures(1, &ID);
+		ID = 0;
+		Width = Height = Layers = Levels = 0;
+	}
+
+private:
+	struct Source
+	{
+		std::vector<unsigned char> Storage;
+		TextureImage Image;
+		int Layer;
+		int X, Y; // of the texture's first texel in its layer
+	};
+
+	int align(int size) const
+	{
+		return (size + Padding - 1) / Padding * Padding;
+	}
+
+	// One texture per layer, at the origin when they all have the same size, otherwise inside a gutter in layers as
+	// large as the largest one
+	void placeInLayers(std::vector<Source>& sources, int padding)
+	{
+		Width = Height = 0;
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			sources[i].Layer = (int)i;
+			sources[i].X = sources[i].Y = padding;
+			Width = std::max(Width, sources[i].Image.Width() + 2 * padding);
+			Height = std::max(Height, sources[i].Image.Height() + 2 * padding);
+		}
+		if (padding > 0)
+		{
+			Width = align(Width);
+			Height = align(Height);
+		}
+		Layers = (int)sources.size();
+	}
+
+	// Shelves filled tallest texture first into one layer. Every power of two width from the widest cell up to four
+	// times the side of a square holding all cells, and no wider than maxWidth, is tried and the one with the least area
+	// wins. Cells are aligned to Padding, which keeps every texture on whole texels down the mip chain
+	void pack(std::vector<Source>& sources, int maxWidth)
+	{
+		std::vector<size_t> order(sources.size());
+		double area = 0.0;
+		int widest = 0;
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			order[i] = i;
+			int width = align(sources[i].Image.Width() + 2 * Padding), height = align(sources[i].Image.Height() + 2 * Padding);
+			area += (double)width * height;
+			widest = std::max(widest, width);
+		}
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sources[a].Image.Height() > sources[b].Image.Height(); });
+		int width = 1;
+		while (width < widest)
+			width *= 2;
+		int bestWidth = width, bestHeight = shelve(sources, order, width, false);
+		for (width *= 2; (double)width * width <= 16.0 * area && width <= maxWidth; width *= 2)
+		{
+			int height = shelve(sources, order, width, false);
+			if ((double)width * height < (double)bestWidth * bestHeight)
+			{
+				bestWidth = width;
+				bestHeight = height;
+			}
+		}
+		Width = bestWidth;
+		Height = shelve(sources, order, bestWidth, true);
+		Layers = 1;
+	}
+
+	// Height of the shelves at the given width, the textures are placed when place is set
+	int shelve(std::vector<Source>& sources, const std::vector<size_t>& order, int layerWidth, bool place) const
+	{
+		int x = 0, y = 0, shelfHeight = 0;
+		for (size_t i : order)
+		{
+			Source& source = sources[i];
+			int width = align(source.Image.Width() + 2 * Padding), height = align(source.Image.Height() + 2 * Padding);
+			if (x + width > layerWidth)
+			{
+				x = 0;
+				y += shelfHeight;
+				shelfHeight = 0;
+			}
+			if (place)
+			{
+				source.Layer = 0;
+				source.X = x + Padding;
+				source.Y = y + Padding;
+			}
+			x += width;
+			shelfHeight = std::max(shelfHeight, height);
+		}
+		return y + shelfHeight;
+	}
+
+	// Writes level sourceLevel of a texture into level atlasLevel of its layer, with gutter texels on every side
+	static void copyLevel(const Source& source, int sourceLevel, int gutter, bool repeat, int atlasLevel, unsigned char* layer,
+		int layerWidth, int layerHeight)
+	{
+		const TextureLevel& info = source.Image.Levels[sourceLevel];
+		const unsigned char* texels = source.Image.Data + info.Offset;
+		int originX = source.X >> atlasLevel, originY = source.Y >> atlasLevel;
+		int x0 = std::max(originX - gutter, 0), x1 = std::min(originX + info.Width + gutter, layerWidth);
+		int y0 = std::max(originY - gutter, 0), y1 = std::min(originY + info.Height + gutter, layerHeight);
+		auto fold = [repeat](int coordinate, int size)
+		{
+			if (repeat)
+				return (coordinate % size + size) % size;
+			return std::min(std::max(coordinate, 0), size - 1);
+		};
+		for (int y = y0; y < y1; y++)
+		{
+			const unsigned char* row = texels + (size_t)fold(y - originY, info.Height) * info.Width * 4;
+			unsigned char* out = layer + ((size_t)y * layerWidth + x0) * 4;
+			for (int x = x0; x < x1; x++, out += 4)
+				memcpy(out, row + (size_t)fold(x - originX, info.Width) * 4, 4);
+		}
+	}
+};
+#endif
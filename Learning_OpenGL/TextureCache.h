@@ -0,0 +1,289 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "MappedFile.h"
+#include "TextureImage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// KTX2 file identifier
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const char TEXTURE_CACHE_KEY_NAME[] = "LearningOpenGL.key";
+
+// On-disk cache of imported textures, keyed by a hash of the source file's bytes and the import settings, so a
+// changed file or setting simply misses. Every entry holds the whole mip chain in the format it is uploaded in, laid
+// out like a KTX2 file (identifier, header, level index, key/value data, levels from smallest to largest) but without
+// the data format descriptor. Entries are mapped on load and uploaded level by level straight from the mapping.
+// Loads and stores may run on several threads at once.
+class TextureCache
+{
+public:
+	// Creates the directory if needed
+	bool Open(const char* path)
+	{
+		directory = path;
+#if defined(_WIN32)
+		_mkdir(path);
+#else
+		mkdir(path, 0755);
+#endif
+		std::string probe = directory + "/.probe";
+		FILE* file = fopen(probe.c_str(), "wb");
+		if (file == NULL)
+		{
+			std::cout << "ERROR::TEXTURE_CACHE::DIRECTORY_NOT_WRITABLE " << path << std::endl;
+			directory.clear();
+			return false;
+		}
+		fclose(file);
+		remove(probe.c_str());
+		return true;
+	}
+
+	bool IsOpen() const
+	{
+		return !directory.empty();
+	}
+
+	// Hash of the source bytes and the import settings, 8 bytes per step. targetFormats is a bit mask of the
+	// Texture_Formats the importer may produce, it changes with what the GL supports
+	static uint64_t Key(const unsigned char* source, size_t size, const TextureImport& import, uint32_t targetFormats)
+	{
+		const uint64_t prime = 0x100000001B3ull;
+		uint64_t hash = 0xCBF29CE484222325ull ^ (FORMAT_VERSION * prime);
+		auto mix = [&](uint64_t value)
+		{
+			hash = (hash ^ value) * prime;
+			hash ^= hash >> 29;
+		};
+		mix((uint64_t)size);
+		uint32_t alphaCutoff;
+		memcpy(&alphaCutoff, &import.AlphaCutoff, 4);
+		mix((uint64_t)import.DesiredChannels | (uint64_t)import.FlipVertically << 8 | (uint64_t)import.Compression << 16
+			| (uint64_t)import.MipFilter << 24 | (uint64_t)import.Srgb << 28 | (uint64_t)targetFormats << 32);
+		mix(alphaCutoff);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, source + i, 8);
+			mix(word);
+		}
+		uint64_t tail = 0;
+		if (i < size)
+			memcpy(&tail, source + i, size - i);
+		mix(tail);
+		return hash * 0x9E3779B97F4A7C15ull;
+	}
+
+	// Maps the entry for key and points image at its levels. A missing, unreadable or mismatching entry is a miss
+	bool Load(uint64_t key, int desiredChannels, MappedFile& file, TextureImage& image)
+	{
+		std::string path = entryPath(key);
+		if (!file.Open(path.c_str()) || !parse(key, desiredChannels, file, image))
+		{
+			if (file.IsOpen())
+				std::cout << "ERROR::TEXTURE_CACHE::BAD_ENTRY " << path << std::endl;
+			file.Close();
+			misses.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Writes the entry for key. The file is written under a temporary name and renamed, so a reader never maps a
+	// partial entry
+	bool Store(uint64_t key, const TextureImage& image)
+	{
+		Header header = {};
+		memcpy(header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+		header.VkFormat = GetTextureFormatInfo(image.Format).VkFormat;
+		header.TypeSize = 1;
+		header.PixelWidth = (uint32_t)image.Width();
+		header.PixelHeight = (uint32_t)image.Height();
+		header.FaceCount = 1;
+		header.LevelCount = (uint32_t)image.LevelCount;
+
+		// key/value data right after the level index, then the levels from the smallest one up
+		char keyValue[KEY_VALUE_SIZE] = {};
+		uint32_t keyValueLength = (uint32_t)(sizeof(TEXTURE_CACHE_KEY_NAME) + KEY_DIGITS + 1);
+		memcpy(keyValue, &keyValueLength, 4);
+		memcpy(keyValue + 4, TEXTURE_CACHE_KEY_NAME, sizeof(TEXTURE_CACHE_KEY_NAME));
+		formatKey(key, keyValue + 4 + sizeof(TEXTURE_CACHE_KEY_NAME));
+		LevelIndex index[TEXTURE_MAX_LEVELS];
+		size_t offset = sizeof(Header) + image.LevelCount * sizeof(LevelIndex);
+		header.KvdByteOffset = (uint32_t)offset;
+		header.KvdByteLength = KEY_VALUE_SIZE;
+		offset += KEY_VALUE_SIZE;
+		size_t alignment = levelAlignment(image.Format);
+		for (int level = image.LevelCount - 1; level >= 0; level--)
+		{
+			offset = (offset + alignment - 1) / alignment * alignment;
+			index[level].ByteOffset = offset;
+			index[level].ByteLength = image.Levels[level].Size;
+			index[level].UncompressedByteLength = image.Levels[level].Size;
+			offset += image.Levels[level].Size;
+		}
+
+		std::string path = entryPath(key);
+		std::string temporary = path + ".tmp" + std::to_string(temporaryCounter.fetch_add(1, std::memory_order_relaxed));
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == NULL)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(index, sizeof(LevelIndex), image.LevelCount, file) == (size_t)image.LevelCount
+			&& fwrite(keyValue, KEY_VALUE_SIZE, 1, file) == 1;
+		size_t written = sizeof(Header) + image.LevelCount * sizeof(LevelIndex) + KEY_VALUE_SIZE;
+		const char zeros[16] = {};
+		for (int level = image.LevelCount - 1; ok && level >= 0; level--)
+		{
+			size_t padding = (size_t)index[level].ByteOffset - written;
+			ok = fwrite(zeros, 1, padding, file) == padding
+				&& fwrite(image.Data + image.Levels[level].Offset, 1, image.Levels[level].Size, file) == image.Levels[level].Size;
+			written = (size_t)(index[level].ByteOffset + index[level].ByteLength);
+		}
+		ok = fclose(file) == 0 && ok;
+		if (ok)
+		{
+			remove(path.c_str()); // rename doesn't replace on Windows
+			ok = rename(temporary.c_str(), path.c_str()) == 0;
+		}
+		if (!ok)
+		{
+			std::cout << "ERROR::TEXTURE_CACHE::WRITE_FAILED " << path << std::endl;
+			remove(temporary.c_str());
+		}
+		return ok;
+	}
+
+	void PrintReport() const
+	{
+		if (IsOpen())
+			std::cout << "TEXTURE_CACHE::REPORT " << directory << ": " << hits.load() << " hits, " << misses.load() << " misses" << std::endl;
+	}
+
+private:
+	static const uint64_t FORMAT_VERSION = 3; // bump when the import or the file layout changes
+	static const size_t KEY_DIGITS = 16;
+	static const size_t KEY_VALUE_SIZE = 40; // length, "LearningOpenGL.key\0", 16 hex digits and \0
+
+	struct Header
+	{
+		unsigned char Identifier[12];
+		uint32_t VkFormat;
+		uint32_t TypeSize;
+		uint32_t PixelWidth;
+		uint32_t PixelHeight;
+		uint32_t PixelDepth;
+		uint32_t LayerCount;
+		uint32_t FaceCount;
+		uint32_t LevelCount;
+		uint32_t SupercompressionScheme;
+		uint32_t DfdByteOffset;
+		uint32_t DfdByteLength;
+		uint32_t KvdByteOffset;
+		uint32_t KvdByteLength;
+		uint64_t SgdByteOffset;
+		uint64_t SgdByteLength;
+	};
+	static_assert(sizeof(Header) == 80, "the KTX2 header is 80 bytes");
+
+	struct LevelIndex
+	{
+		uint64_t ByteOffset;
+		uint64_t ByteLength;
+		uint64_t UncompressedByteLength;
+	};
+
+	std::string directory;
+	std::atomic<uint64_t> hits{ 0 };
+	std::atomic<uint64_t> misses{ 0 };
+	std::atomic<uint64_t> temporaryCounter{ 0 };
+
+	std::string entryPath(uint64_t key) const
+	{
+		char name[KEY_DIGITS + 1];
+		formatKey(key, name);
+		return directory + "/" + name + ".ktx2";
+	}
+
+	static void formatKey(uint64_t key, char* out)
+	{
+		snprintf(out, KEY_DIGITS + 1, "%016llx", (unsigned long long)key);
+	}
+
+	// KTX2 aligns levels to the least common multiple of the texel or block size and 4
+	static size_t levelAlignment(Texture_Format format)
+	{
+		int bytes = GetTextureFormatInfo(format).BlockBytes;
+		return bytes == 3 ? 12 : std::max(bytes, 4);
+	}
+
+	static bool parse(uint64_t key, int desiredChannels, const MappedFile& file, TextureImage& image)
+	{
+		const unsigned char* data = file.Data();
+		size_t size = file.Size();
+		Header header;
+		if (size < sizeof(Header))
+			return false;
+		memcpy(&header, data, sizeof(Header));
+		if (memcmp(header.Identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || header.LevelCount == 0
+			|| header.LevelCount > (uint32_t)TEXTURE_MAX_LEVELS || header.PixelWidth == 0 || header.PixelHeight == 0
+			|| header.PixelWidth > 65536 || header.PixelHeight > 65536)
+			return false;
+		int format = 0;
+		while (format < TEXTURE_FORMAT_COUNT && GetTextureFormatInfo((Texture_Format)format).VkFormat != header.VkFormat)
+			format++;
+		if (format == TEXTURE_FORMAT_COUNT)
+			return false;
+		int channels = GetTextureFormatInfo((Texture_Format)format).Channels;
+		if (desiredChannels != 0 && channels != desiredChannels)
+			return false;
+
+		// the key stored inside must match the one in the name
+		char expected[KEY_DIGITS + 1];
+		formatKey(key, expected);
+		if (header.KvdByteLength != KEY_VALUE_SIZE || (size_t)header.KvdByteOffset + KEY_VALUE_SIZE > size
+			|| memcmp(data + header.KvdByteOffset + 4, TEXTURE_CACHE_KEY_NAME, sizeof(TEXTURE_CACHE_KEY_NAME)) != 0
+			|| memcmp(data + header.KvdByteOffset + 4 + sizeof(TEXTURE_CACHE_KEY_NAME), expected, KEY_DIGITS) != 0)
+			return false;
+
+		size_t indexEnd = sizeof(Header) + header.LevelCount * sizeof(LevelIndex);
+		if (indexEnd > size)
+			return false;
+		image.Data = data;
+		image.Format = (Texture_Format)format;
+		image.LevelCount = (int)header.LevelCount;
+		int width = (int)header.PixelWidth, height = (int)header.PixelHeight;
+		for (int level = 0; level < image.LevelCount; level++)
+		{
+			LevelIndex index;
+			memcpy(&index, data + sizeof(Header) + level * sizeof(LevelIndex), sizeof(LevelIndex));
+			TextureLevel& info = image.Levels[level];
+			info.Width = width;
+			info.Height = height;
+			info.Offset = (size_t)index.ByteOffset;
+			info.Size = TextureRowBytes(image.Format, width) * TextureRowCount(image.Format, height);
+			if (index.ByteLength != info.Size || index.ByteOffset > size || size - index.ByteOffset < info.Size)
+				return false;
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+		}
+		return true;
+	}
+};
+#endif
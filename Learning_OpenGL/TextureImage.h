@@ -0,0 +1,161 @@
+#ifndef TEXTURE_IMAGE_H
+#define TEXTURE_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+const int TEXTURE_MAX_LEVELS = 16;
+
+// Texel layouts a texture is imported to. Uncompressed formats are tightly packed 8 bit channels, the block
+// compressed ones store 4x4 texel blocks
+enum Texture_Format {
+	TEXTURE_FORMAT_R8,
+	TEXTURE_FORMAT_RG8,
+	TEXTURE_FORMAT_RGB8,
+	TEXTURE_FORMAT_RGBA8,
+	TEXTURE_FORMAT_BC1, // RGB, 8 bytes per block
+	TEXTURE_FORMAT_BC4, // R, 8 bytes per block
+	TEXTURE_FORMAT_BC5, // RG, 16 bytes per block
+	TEXTURE_FORMAT_BC7, // RGBA, 16 bytes per block, only mode 6 is written
+	TEXTURE_FORMAT_COUNT
+};
+
+struct TextureFormatInfo
+{
+	const char* Name;
+	int Channels;
+	int BlockSize; // texels along each side of a block, 1 for uncompressed formats
+	int BlockBytes;
+	uint32_t VkFormat; // the Vulkan format KTX2 files identify it by
+};
+
+inline const TextureFormatInfo& GetTextureFormatInfo(Texture_Format format)
+{
+	static const TextureFormatInfo infos[TEXTURE_FORMAT_COUNT] = {
+		{ "R8", 1, 1, 1, 9 },
+		{ "RG8", 2, 1, 2, 16 },
+		{ "RGB8", 3, 1, 3, 23 },
+		{ "RGBA8", 4, 1, 4, 37 },
+		{ "BC1", 3, 4, 8, 131 },
+		{ "BC4", 1, 4, 8, 139 },
+		{ "BC5", 2, 4, 16, 141 },
+		{ "BC7", 4, 4, 16, 145 },
+	};
+	return infos[format];
+}
+
+inline Texture_Format UncompressedTextureFormat(int channels)
+{
+	return (Texture_Format)(TEXTURE_FORMAT_R8 + channels - 1);
+}
+
+// Quality presets of the block compression encoder, NONE keeps textures uncompressed
+enum Texture_Compression {
+	TEXTURE_COMPRESSION_NONE,
+	TEXTURE_COMPRESSION_FAST,
+	TEXTURE_COMPRESSION_NORMAL,
+	TEXTURE_COMPRESSION_HIGH
+};
+
+// Kernels the mip generator can downsample with. Box averages the 2x2 texels under a texel of the level below, Kaiser
+// and Lanczos are windowed sincs 3 texels of the smaller level wide that keep mips sharper
+enum Mip_Filter {
+	MIP_FILTER_BOX,
+	MIP_FILTER_KAISER,
+	MIP_FILTER_LANCZOS
+};
+
+// How a TextureAtlas arranges its textures. Auto makes layers of an array when every texture has the same size and packs
+// them otherwise, array gives every texture a layer of its own even when the sizes differ
+enum Atlas_Layout {
+	ATLAS_LAYOUT_AUTO,
+	ATLAS_LAYOUT_ARRAY,
+	ATLAS_LAYOUT_PACKED
+};
+
+// How a source image is turned into a texture. Part of the texture cache key, so changing any of it re-imports
+struct TextureImport
+{
+	int DesiredChannels = 0; // as for stbi_load, 0 keeps the file's channels
+	bool FlipVertically = true; // first row at the bottom, the way OpenGL expects it
+	Texture_Compression Compression = TEXTURE_COMPRESSION_NONE;
+	Mip_Filter MipFilter = MIP_FILTER_KAISER;
+	bool Srgb = true; // colour channels are sRGB encoded and filtered in linear space, off for normal maps and masks
+	float AlphaCutoff = 0.0f; // alpha test threshold of a cutout texture, above 0 every level keeps the coverage of level 0
+};
+
+struct TextureLevel
+{
+	int Width;
+	int Height;
+	size_t Offset; // from TextureImage::Data
+	size_t Size;
+};
+
+// A full mip chain, level 0 first. Data points into memory owned elsewhere, a cache file mapping or the buffer
+// BuildMipChain or CompressMipChain filled
+struct TextureImage
+{
+	const unsigned char* Data = nullptr;
+	Texture_Format Format = TEXTURE_FORMAT_RGBA8;
+	int LevelCount = 0;
+	TextureLevel Levels[TEXTURE_MAX_LEVELS];
+
+	int Width() const
+	{
+		return Levels[0].Width;
+	}
+
+	int Height() const
+	{
+		return Levels[0].Height;
+	}
+};
+
+// Rows of texels, or of blocks for compressed formats, in a level of the given size, and the bytes in one of them
+inline int TextureRowCount(Texture_Format format, int height)
+{
+	int blockSize = GetTextureFormatInfo(format).BlockSize;
+	return (height + blockSize - 1) / blockSize;
+}
+
+inline size_t TextureRowBytes(Texture_Format format, int width)
+{
+	const TextureFormatInfo& info = GetTextureFormatInfo(format);
+	return (size_t)(width + info.BlockSize - 1) / info.BlockSize * info.BlockBytes;
+}
+
+// Number of levels down to 1x1, halving and rounding down like GL does
+inline int MipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while ((width > 1 || height > 1) && levels < TEXTURE_MAX_LEVELS)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		levels++;
+	}
+	return levels;
+}
+
+// Fills in the size of every level of a full chain in the given format, levels are packed 16 byte aligned starting at
+// offset 0. Returns the total size
+inline size_t LayoutMipChain(Texture_Format format, int width, int height, TextureImage& image)
+{
+	image.Format = format;
+	image.LevelCount = MipLevelCount(width, height);
+	size_t total = 0;
+	for (int level = 0; level < image.LevelCount; level++)
+	{
+		TextureLevel& info = image.Levels[level];
+		info.Width = width;
+		info.Height = height;
+		info.Offset = total;
+		info.Size = TextureRowBytes(format, width) * TextureRowCount(format, height);
+		total += (info.Size + 15) & ~(size_t)15;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return total;
+}
+#endif
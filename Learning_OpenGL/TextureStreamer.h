@@ -0,0 +1,664 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "AllocTracker.h"
+#include "BlockCompression.h"
+#include "DecodeArena.h"
+#include "GLDebug.h"
+#include "MappedFile.h"
+#include "MipGenerator.h"
+#include "Probes.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0 // EXT_texture_compression_s3tc, not part of core GL
+#endif
+
+// Loads textures without stalling the render thread. Request() hands a file to the decode threads and returns a
+// handle, Texture() gives a shared placeholder for it until every level has been uploaded. A decode thread decodes the
+// file straight into level 0 of a full mip chain and generates the rest, block compressed when the import asks for it
+// and the GL supports the format, or maps it from the TextureCache when one is set. Update(), called once per frame,
+// copies rows (of blocks for compressed formats) into a staging pixel buffer and issues glTexSubImage2D or
+// glCompressedTexSubImage2D from it, at most FrameBudget bytes per frame. The staging buffer is split into one region
+// per frame in flight, a region is only written again once the fence of its last uploads has signaled, and a frame
+// whose region is still busy simply uploads nothing.
+//
+// With GL 4.4 the staging buffer is persistently mapped (glBufferStorage), otherwise each region is mapped
+// unsynchronized for the copies of one frame. Flipping is part of the import, stbi_set_flip_vertically_on_load must stay
+// off. Update does not allocate, decoding and Request charge their allocations to ALLOC_TEXTURE and the decode threads
+// stay out of the per-frame allocation count.
+//
+// The decode threads share a ThreadPool of their own for splitting up a large JPEG, mip generation and compression, so
+// the shared pool stays free for the render thread. Together they take about half the hardware threads by default.
+class TextureStreamer
+{
+public:
+	typedef unsigned int Handle;
+
+	size_t FrameBudget = 0; // bytes uploaded per frame, set by Create
+	TextureCache* Cache = nullptr; // consulted before importing and filled after, optional. Set before Create
+
+	// decodeThreads = 0 picks half the hardware threads, at least one. The decode pool gets one worker less than that,
+	// a thread submitting a job works on it too
+	bool Create(size_t frameBudget, unsigned int decodeThreads = 0)
+	{
+		AllocScope allocScope(ALLOC_TEXTURE);
+		FrameBudget = std::max<size_t>(frameBudget, 4096);
+		regionSize = FrameBudget;
+		stagingSize = regionSize * STAGING_REGIONS;
+
+		// mid grey, neutral under the scene's lighting while the real image is on its way
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &placeholder);
+		glBindTexture(GL_TEXTURE_2D, placeholder);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLDebugLog::Label(GL_TEXTURE, placeholder, "texturePlaceholder");
+
+		// RGTC is core since 3.0 and BPTC since 4.2, S3TC only ever came as an extension
+		supportedFormats = 1u << TEXTURE_FORMAT_R8 | 1u << TEXTURE_FORMAT_RG8 | 1u << TEXTURE_FORMAT_RGB8 | 1u << TEXTURE_FORMAT_RGBA8
+			| 1u << TEXTURE_FORMAT_BC4 | 1u << TEXTURE_FORMAT_BC5;
+		if (GLAD_GL_VERSION_4_2)
+			supportedFormats |= 1u << TEXTURE_FORMAT_BC7;
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; i++)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+				supportedFormats |= 1u << TEXTURE_FORMAT_BC1;
+			else if (strcmp(extension, "GL_ARB_texture_compression_bptc") == 0)
+				supportedFormats |= 1u << TEXTURE_FORMAT_BC7;
+		}
+
+		glGenBuffers(1, &stagingBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+		GLDebugLog::Label(GL_BUFFER, stagingBuffer, "textureStaging");
+		persistent = glBufferStorage != NULL;
+		if (persistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)stagingSize, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)stagingSize, flags);
+			if (mapped == NULL)
+			{
+				std::cout << "ERROR::TEXTURE::STAGING_NOT_MAPPED" << std::endl;
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				Destroy();
+				return false;
+			}
+		}
+		else
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)stagingSize, NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		stopping = false;
+		if (decodeThreads == 0)
+			decodeThreads = std::thread::hardware_concurrency() / 2;
+		decodeThreads = std::max(decodeThreads, 1u);
+		decodePool.reset(new ThreadPool(decodeThreads - 1, &initDecodeWorker));
+		for (unsigned int i = 0; i < decodeThreads; i++)
+			workers.emplace_back(&TextureStreamer::decodeLoop, this);
+		return true;
+	}
+
+	// only stops the decode threads, the GL objects need Destroy while the context is current
+	~TextureStreamer()
+	{
+		stopDecoding();
+	}
+
+	void Destroy()
+	{
+		stopDecoding();
+		for (Entry& entry : entries)
+		{
+			if (entry.Texture != 0)
+				glDeleteTextures(1, &entry.Texture);
+		}
+		entries.clear();
+		requests.clear();
+		decoded.clear();
+		arrived.clear();
+		uploads.clear();
+		for (GLsync& fence : fences)
+		{
+			if (fence != NULL)
+				glDeleteSync(fence);
+			fence = NULL;
+		}
+		if (stagingBuffer != 0)
+		{
+			if (mapped != NULL)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &stagingBuffer);
+		}
+		if (placeholder != 0)
+			glDeleteTextures(1, &placeholder);
+		stagingBuffer = placeholder = 0;
+		mapped = NULL;
+	}
+
+	// Queues a file for importing. The texture object is created right away with the given wrap mode and trilinear
+	// filtering, it replaces the placeholder once all its levels are uploaded
+	Handle Request(const char* path, GLint wrap = GL_REPEAT, const TextureImport& import = TextureImport())
+	{
+		AllocScope allocScope(ALLOC_TEXTURE);
+		entries.emplace_back();
+		Entry& entry = entries.back();
+		entry.Path = path;
+		entry.Import = import;
+		glGenTextures(1, &entry.Texture);
+		glBindTexture(GL_TEXTURE_2D, entry.Texture);
+		GLDebugLog::Label(GL_TEXTURE, entry.Texture, path);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// room for every entry in the hand-over lists, so Update never grows them
+		arrived.reserve(entries.size());
+		uploads.reserve(entries.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.reserve(entries.size());
+			requests.push_back(&entry);
+			outstanding++;
+		}
+		wake.notify_one();
+		return (Handle)(entries.size() - 1);
+	}
+
+	// Imports a file into the cache right away, spreading mip generation and block compression over the pool. The
+	// offline cook step: run it for every texture before shipping and the streamer only ever maps finished chains.
+	// Needs Create, which finds the formats the GL supports, and a Cache
+	bool Cook(const char* path, const TextureImport& import, ThreadPool* pool)
+	{
+		if (Cache == nullptr)
+		{
+			std::cout << "ERROR::TEXTURE::COOK_WITHOUT_CACHE " << path << std::endl;
+			return false;
+		}
+		AllocScope allocScope(ALLOC_TEXTURE);
+		Entry entry;
+		entry.Path = path;
+		entry.Import = import;
+		typedef std::chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+		Import_Result result = importEntry(entry, pool);
+		double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (result == IMPORT_FAILED)
+		{
+			std::cout << "ERROR::TEXTURE::COOK_FAILED " << path << ": " << entry.Failure << std::endl;
+			return false;
+		}
+		std::cout << "TEXTURE::COOKED " << path << " " << GetTextureFormatInfo(entry.Image.Format).Name << " "
+			<< entry.Image.Width() << "x" << entry.Image.Height() << ", " << (result == IMPORT_CACHED ? "already cached" : "imported")
+			<< " in " << milliseconds << " ms" << std::endl;
+		return true;
+	}
+
+	// The texture to bind for a handle, the placeholder until the image is fully uploaded
+	unsigned int Texture(Handle handle) const
+	{
+		const Entry& entry = entries[handle];
+		return entry.Ready ? entry.Texture : placeholder;
+	}
+
+	bool IsReady(Handle handle) const
+	{
+		return entries[handle].Ready;
+	}
+
+	// True once nothing is waiting to be decoded or uploaded
+	bool Idle() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return outstanding == 0 && uploads.empty();
+	}
+
+	// Uploads decoded rows for at most FrameBudget bytes, returns the number of bytes uploaded. Call once per frame on
+	// the thread owning the GL context; leaves GL_TEXTURE_2D unbound on the active texture unit when it uploaded
+	size_t Update()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arrived.swap(decoded);
+		}
+		for (Entry* entry : arrived)
+		{
+			if (entry->Image.Data != NULL)
+				uploads.push_back(entry);
+			else
+				std::cout << "ERROR::TEXTURE::DECODE_FAILED " << entry->Path << ": " << entry->Failure << std::endl;
+		}
+		arrived.clear();
+		if (uploads.empty())
+			return 0;
+
+		// the region written three frames ago must have been consumed by the GPU, otherwise skip this frame
+		GLsync& fence = fences[region];
+		if (fence != NULL)
+		{
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+				return 0;
+			glDeleteSync(fence);
+			fence = NULL;
+		}
+
+		// plan the copies: whole rows of the oldest images, level after level, until the region is full
+		size_t regionOffset = region * regionSize;
+		size_t used = 0;
+		int chunkCount = 0;
+		bool full = false;
+		for (size_t i = 0; i < uploads.size() && !full; i++)
+		{
+			Entry* entry = uploads[i];
+			while (entry->Level < entry->Image.LevelCount)
+			{
+				if (chunkCount == MAX_CHUNKS)
+				{
+					full = true;
+					break;
+				}
+				const TextureLevel& level = entry->Image.Levels[entry->Level];
+				size_t rowBytes = TextureRowBytes(entry->Image.Format, level.Width);
+				int rowCount = TextureRowCount(entry->Image.Format, level.Height);
+				size_t start = (used + 3) & ~(size_t)3;
+				int rows = start < regionSize ? (int)std::min<size_t>((regionSize - start) / rowBytes, (size_t)(rowCount - entry->RowsQueued)) : 0;
+				bool direct = false;
+				if (rows == 0)
+				{
+					// a row wider than a region goes straight from client memory, anything else waits for the next frame
+					full = true;
+					if (rowBytes <= regionSize || used != 0)
+						break;
+					rows = 1;
+					direct = true;
+					start = 0;
+				}
+				chunks[chunkCount++] = Chunk{ entry, entry->Level, entry->RowsQueued, rows, start, direct };
+				entry->RowsQueued += rows;
+				used = direct ? regionSize : start + rows * rowBytes;
+				if (entry->RowsQueued < rowCount)
+				{
+					full = true; // the region is full
+					break;
+				}
+				entry->Level++;
+				entry->RowsQueued = 0;
+				if (direct)
+					break;
+			}
+		}
+		if (chunkCount == 0)
+			return 0;
+
+		// storage for every level of images seen the first time, before the staging buffer is bound since a NULL pointer
+		// would then mean offset 0 in it
+		for (int i = 0; i < chunkCount; i++)
+		{
+			Entry* entry = chunks[i].Owner;
+			if (entry->Allocated)
+				continue;
+			glBindTexture(GL_TEXTURE_2D, entry->Texture);
+			Texture_Format format = entry->Image.Format;
+			for (int level = 0; level < entry->Image.LevelCount; level++)
+			{
+				const TextureLevel& info = entry->Image.Levels[level];
+				if (isCompressed(format))
+					glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat(format), info.Width, info.Height, 0, (GLsizei)info.Size, NULL);
+				else
+					glTexImage2D(GL_TEXTURE_2D, level, internalFormat(format), info.Width, info.Height, 0, pixelFormat(format), GL_UNSIGNED_BYTE, NULL);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry->Image.LevelCount - 1);
+			entry->Allocated = true;
+		}
+
+		// copy into the staging region, then let the GL read from it
+		unsigned char* destination = mapped != NULL ? mapped + regionOffset : NULL;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+		bool staged = !chunks[0].Direct;
+		if (staged && !persistent)
+		{
+			// the fence above already guarantees the GPU is done with this region
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			destination = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, (GLintptr)regionOffset, (GLsizeiptr)used, flags);
+			if (destination == NULL)
+			{
+				// rewind, the first chunk of an image always starts where the image stood before this frame
+				for (int i = chunkCount - 1; i >= 0; i--)
+				{
+					chunks[i].Owner->Level = chunks[i].Level;
+					chunks[i].Owner->RowsQueued = chunks[i].FirstRow;
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				return 0;
+			}
+		}
+		for (int i = 0; i < chunkCount; i++)
+		{
+			const Chunk& chunk = chunks[i];
+			if (!chunk.Direct)
+				memcpy(destination + chunk.Offset, chunkPixels(chunk), chunk.Rows * chunkRowBytes(chunk));
+		}
+		if (staged && !persistent)
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t uploaded = 0;
+		for (int i = 0; i < chunkCount; i++)
+		{
+			const Chunk& chunk = chunks[i];
+			glBindTexture(GL_TEXTURE_2D, chunk.Owner->Texture);
+			if (chunk.Direct)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				uploadRows(chunk, chunkPixels(chunk));
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+			}
+			else
+				uploadRows(chunk, (const void*)(regionOffset + chunk.Offset));
+			uploaded += chunk.Rows * chunkRowBytes(chunk);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		region = (region + 1) % STAGING_REGIONS;
+
+		// finished images drop their source, the cache mapping or the imported mip chain, the GL owns the texels now
+		size_t kept = 0;
+		for (size_t i = 0; i < uploads.size(); i++)
+		{
+			Entry* entry = uploads[i];
+			if (entry->Level < entry->Image.LevelCount)
+			{
+				uploads[kept++] = entry;
+				continue;
+			}
+			entry->Mapping.Close();
+			std::vector<unsigned char>().swap(entry->Storage);
+			entry->Image.Data = NULL;
+			entry->Ready = true;
+			std::lock_guard<std::mutex> lock(mutex);
+			outstanding--;
+		}
+		uploads.resize(kept);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return uploaded;
+	}
+
+private:
+	static const int STAGING_REGIONS = 3; // frames the GPU may lag behind
+	static const int MAX_CHUNKS = 64; // texture updates per frame
+
+	struct Entry
+	{
+		std::string Path;
+		TextureImport Import;
+		unsigned int Texture = 0;
+		// written by the decode thread before the entry is handed over through decoded. Image points into the cache
+		// mapping or into Storage
+		TextureImage Image;
+		MappedFile Mapping;
+		std::vector<unsigned char> Storage;
+		const char* Failure = "";
+		// render thread only
+		int Level = 0; // being uploaded
+		int RowsQueued = 0; // of Level, rows of blocks for compressed formats
+		bool Allocated = false;
+		bool Ready = false;
+	};
+
+	struct Chunk
+	{
+		Entry* Owner;
+		int Level;
+		int FirstRow;
+		int Rows;
+		size_t Offset; // in the staging region
+		bool Direct; // uploaded from client memory
+	};
+
+	std::deque<Entry> entries; // stable addresses, the decode threads keep pointers
+	std::vector<std::thread> workers;
+	std::unique_ptr<ThreadPool> decodePool; // shared by the decode threads
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::deque<Entry*> requests; // waiting for a decode thread
+	std::vector<Entry*> decoded; // decoded or failed, waiting for Update
+	size_t outstanding = 0; // requested and not yet uploaded
+
+	// render thread only
+	std::vector<Entry*> arrived;
+	std::vector<Entry*> uploads;
+	Chunk chunks[MAX_CHUNKS];
+	unsigned int placeholder = 0;
+	unsigned int stagingBuffer = 0;
+	unsigned char* mapped = NULL;
+	bool persistent = false;
+	size_t regionSize = 0;
+	size_t stagingSize = 0;
+	int region = 0;
+	GLsync fences[STAGING_REGIONS] = {};
+	uint32_t supportedFormats = 0; // bit per Texture_Format, set by Create before the decode threads start
+
+	static bool isCompressed(Texture_Format format)
+	{
+		return GetTextureFormatInfo(format).BlockSize > 1;
+	}
+
+	static GLenum pixelFormat(Texture_Format format)
+	{
+		const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+		return formats[GetTextureFormatInfo(format).Channels - 1];
+	}
+
+	static GLint internalFormat(Texture_Format format)
+	{
+		const GLint formats[TEXTURE_FORMAT_COUNT] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+			GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2, GL_COMPRESSED_RGBA_BPTC_UNORM };
+		return formats[format];
+	}
+
+	// The format an import ends up in, the uncompressed one when compression is off or the GL lacks the block format
+	Texture_Format targetFormat(int channels, Texture_Compression compression) const
+	{
+		const Texture_Format compressed[4] = { TEXTURE_FORMAT_BC4, TEXTURE_FORMAT_BC5, TEXTURE_FORMAT_BC1, TEXTURE_FORMAT_BC7 };
+		Texture_Format format = compressed[channels - 1];
+		if (compression == TEXTURE_COMPRESSION_NONE || (supportedFormats & 1u << format) == 0)
+			return UncompressedTextureFormat(channels);
+		return format;
+	}
+
+	// Uploads the rows of a chunk from pixels, a client pointer or an offset into the bound staging buffer. Compressed
+	// rows are 4 texels high, the last one may cover fewer
+	static void uploadRows(const Chunk& chunk, const void* pixels)
+	{
+		const TextureImage& image = chunk.Owner->Image;
+		const TextureLevel& level = image.Levels[chunk.Level];
+		int blockSize = GetTextureFormatInfo(image.Format).BlockSize;
+		int y = chunk.FirstRow * blockSize;
+		int height = std::min(chunk.Rows * blockSize, level.Height - y);
+		if (isCompressed(image.Format))
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, chunk.Level, 0, y, level.Width, height, (GLenum)internalFormat(image.Format),
+				(GLsizei)(chunk.Rows * chunkRowBytes(chunk)), pixels);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, chunk.Level, 0, y, level.Width, height, pixelFormat(image.Format), GL_UNSIGNED_BYTE, pixels);
+	}
+
+	static size_t chunkRowBytes(const Chunk& chunk)
+	{
+		return TextureRowBytes(chunk.Owner->Image.Format, chunk.Owner->Image.Levels[chunk.Level].Width);
+	}
+
+	static const unsigned char* chunkPixels(const Chunk& chunk)
+	{
+		const TextureImage& image = chunk.Owner->Image;
+		return image.Data + image.Levels[chunk.Level].Offset + chunk.FirstRow * chunkRowBytes(chunk);
+	}
+
+	void stopDecoding()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+		decodePool.reset();
+	}
+
+	// the decode pool's workers allocate for mip generation and compression, like the decode threads they stay out of
+	// the frame counts and charge ALLOC_TEXTURE. The scope lives as long as the worker
+	static void initDecodeWorker()
+	{
+		AllocTracker::ExcludeThreadFromFrames();
+		static thread_local AllocScope allocScope(ALLOC_TEXTURE);
+		(void)allocScope;
+	}
+
+	void decodeLoop()
+	{
+		AllocScope allocScope(ALLOC_TEXTURE);
+		AllocTracker::ExcludeThreadFromFrames();
+		SetLoaderThreadPool(decodePool.get()); // a large JPEG would otherwise occupy the shared pool the render thread culls with
+		for (;;)
+		{
+			Entry* entry;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !requests.empty(); });
+				if (stopping)
+					return;
+				entry = requests.front();
+				requests.pop_front();
+			}
+
+			bool ok = importEntry(*entry, decodePool.get()) != IMPORT_FAILED;
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(entry);
+			if (!ok)
+				outstanding--;
+		}
+	}
+
+	enum Import_Result {
+		IMPORT_FAILED,
+		IMPORT_CACHED,
+		IMPORT_DONE
+	};
+
+	// Fills entry.Image from the cache or by decoding the file, generating mips and compressing, and stores what it
+	// imported in the cache. The decode threads run it on their decode pool, the shared pool belongs to the render thread
+	Import_Result importEntry(Entry& entry, ThreadPool* pool)
+	{
+		// the source is mapped and hashed, a cache hit skips decoding and mip generation
+		MappedFile source;
+		if (!source.Open(entry.Path.c_str()) || source.Size() == 0 || source.Size() > (size_t)INT_MAX)
+		{
+			entry.Failure = "can't open the file";
+			return IMPORT_FAILED;
+		}
+		uint64_t key = 0;
+		if (Cache != nullptr)
+		{
+			key = TextureCache::Key(source.Data(), source.Size(), entry.Import, supportedFormats);
+			if (Cache->Load(key, entry.Import.DesiredChannels, entry.Mapping, entry.Image))
+			{
+				volatile unsigned int touched = entry.Mapping.Prefetch(); // page faults belong on this thread
+				(void)touched;
+				return IMPORT_CACHED;
+			}
+		}
+
+		// level 0 of the chain is decoded in place with its rows already in upload order, so there is no decoded copy
+		// to allocate, flip and copy over. Should the channels stbi_info reports not be the ones the decoder writes,
+		// the image is decoded again the ordinary way. stb_image's own allocations come from this thread's decode arena
+		int width, height, channels;
+		bool inPlace;
+		{
+			DecodeArenaScope arena;
+			TRACE_IMAGE_DECODE_BEGIN(entry.Path.c_str());
+			inPlace = stbi_info_from_memory(source.Data(), (int)source.Size(), &width, &height, &channels) != 0;
+			if (inPlace)
+			{
+				if (entry.Import.DesiredChannels != 0)
+					channels = entry.Import.DesiredChannels;
+				entry.Storage.resize(LayoutMipChain(UncompressedTextureFormat(channels), width, height, entry.Image));
+				entry.Image.Data = entry.Storage.data();
+				inPlace = stbi_load_from_memory_into(source.Data(), (int)source.Size(), &width, &height, nullptr,
+					entry.Import.DesiredChannels, entry.Storage.data(), entry.Image.Levels[0].Size, entry.Import.FlipVertically) == channels;
+			}
+			if (inPlace)
+				TRACE_IMAGE_DECODE_END(width * height * channels);
+			else
+			{
+				unsigned char* pixels = stbi_load_from_memory(source.Data(), (int)source.Size(), &width, &height, &channels,
+					entry.Import.DesiredChannels);
+				if (entry.Import.DesiredChannels != 0)
+					channels = entry.Import.DesiredChannels;
+				TRACE_IMAGE_DECODE_END(pixels ? width * height * channels : 0);
+				if (pixels == NULL)
+				{
+					entry.Failure = stbi_failure_reason();
+					return IMPORT_FAILED;
+				}
+				BuildMipChain(pixels, width, height, channels, entry.Import, entry.Storage, entry.Image, pool);
+				stbi_image_free(pixels);
+			}
+		}
+		if (inPlace)
+			MipGenerator::Generate(entry.Storage.data(), entry.Image, entry.Import, pool);
+		Texture_Format format = targetFormat(channels, entry.Import.Compression);
+		if (format != entry.Image.Format)
+			compress(entry, format, pool);
+		if (Cache != nullptr)
+			Cache->Store(key, entry.Image);
+		return IMPORT_DONE;
+	}
+
+	// Replaces the imported chain with its block compressed version
+	static void compress(Entry& entry, Texture_Format format, ThreadPool* pool)
+	{
+		typedef std::chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+		std::vector<unsigned char> storage;
+		TextureImage image;
+		BlockCompressionStats stats;
+		CompressMipChain(entry.Image, format, entry.Import.Compression, storage, image, pool, &stats);
+		double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		std::cout << "TEXTURE::COMPRESSED " << entry.Path << " " << GetTextureFormatInfo(format).Name << " " << image.Width()
+			<< "x" << image.Height() << ", " << image.LevelCount << " levels, " << milliseconds << " ms, RMSE " << stats.Rmse()
+			<< ", PSNR " << stats.Psnr() << " dB" << std::endl;
+		entry.Storage.swap(storage);
+		entry.Image = image;
+	}
+};
+#endif
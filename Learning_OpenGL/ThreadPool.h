@@ -0,0 +1,188 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for data-parallel loops. Workers sleep on a condition variable between jobs, and a
+// job hands out chunks through an atomic counter. Dispatching a job never allocates, so it is safe inside the render loop.
+class ThreadPool
+{
+public:
+	static const unsigned int HARDWARE_THREADS = ~0u;
+
+	// threads = HARDWARE_THREADS creates one worker per hardware thread minus the calling thread, 0 creates none and
+	// every job runs on the calling thread. initWorker, if given, runs once on every worker before its first job, for
+	// thread state like the allocation tracking of a background system's workers
+	explicit ThreadPool(unsigned int threads = HARDWARE_THREADS, void (*initWorker)() = nullptr)
+	{
+		if (threads == HARDWARE_THREADS)
+		{
+			unsigned int hardware = std::thread::hardware_concurrency();
+			threads = hardware > 1 ? hardware - 1 : 0;
+		}
+		workers.reserve(threads);
+		for (unsigned int i = 0; i < threads; i++)
+			workers.emplace_back(&ThreadPool::workerLoop, this, initWorker);
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads a job can run on, including the calling thread
+	unsigned int ThreadCount() const
+	{
+		return (unsigned int)workers.size() + 1;
+	}
+
+	// Calls fn(begin, end) for consecutive ranges of at most chunkSize covering [0, count). The calling thread works
+	// too and the call returns once every range is done. The pool runs one job at a time, a job started while another
+	// thread's job is running, or from inside a running range (say a loader called from a pool task), runs inline on
+	// the calling thread instead of waiting for the workers
+	template<typename Function>
+	void ParallelFor(size_t count, size_t chunkSize, const Function& fn)
+	{
+		if (count == 0)
+			return;
+		chunkSize = std::max<size_t>(chunkSize, 1);
+		std::unique_lock<std::mutex> submit(submitMutex, std::defer_lock);
+		if (workers.empty() || count <= chunkSize || insideTask() || !submit.try_lock())
+		{
+			fn((size_t)0, count);
+			return;
+		}
+		run(&invoke<Function>, (void*)&fn, count, chunkSize);
+	}
+
+private:
+	typedef void (*Task)(void* context, size_t begin, size_t end);
+
+	std::vector<std::thread> workers;
+	std::mutex submitMutex; // one job at a time
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool stopping = false;
+	uint64_t generation = 0;
+	unsigned int busyWorkers = 0;
+
+	// current job, published under mutex before generation is bumped
+	Task task = nullptr;
+	void* context = nullptr;
+	size_t jobCount = 0;
+	size_t jobChunk = 0;
+	std::atomic<size_t> nextBegin{ 0 };
+
+	template<typename Function>
+	static void invoke(void* context, size_t begin, size_t end)
+	{
+		(*(const Function*)context)(begin, end);
+	}
+
+	// set while this thread runs a range of any pool's job
+	static bool& insideTask()
+	{
+		static thread_local bool inside = false;
+		return inside;
+	}
+
+	void work()
+	{
+		insideTask() = true;
+		for (;;)
+		{
+			size_t begin = nextBegin.fetch_add(jobChunk, std::memory_order_relaxed);
+			if (begin >= jobCount)
+				break;
+			task(context, begin, std::min(begin + jobChunk, jobCount));
+		}
+		insideTask() = false;
+	}
+
+	// called with submitMutex held
+	void run(Task fn, void* ctx, size_t count, size_t chunkSize)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			task = fn;
+			context = ctx;
+			jobCount = count;
+			jobChunk = chunkSize;
+			nextBegin.store(0, std::memory_order_relaxed);
+			busyWorkers = (unsigned int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+		work();
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this] { return busyWorkers == 0; });
+	}
+
+	void workerLoop(void (*initWorker)())
+	{
+		if (initWorker != nullptr)
+			initWorker();
+		uint64_t seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			work();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busyWorkers--;
+			}
+			finished.notify_one();
+		}
+	}
+};
+
+// Pool shared by the loaders and per-frame systems, created on first use
+inline ThreadPool& SharedThreadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+inline ThreadPool*& threadLoaderPool()
+{
+	static thread_local ThreadPool* pool = nullptr;
+	return pool;
+}
+
+// Gives the loaders called from this thread a pool of their own, background loaders (the texture streamer's decode
+// threads) use it to keep their jobs off the shared pool the render thread culls with. Null goes back to the shared pool
+inline void SetLoaderThreadPool(ThreadPool* pool)
+{
+	threadLoaderPool() = pool;
+}
+
+// Pool the image loaders spread a large decode over, see SetLoaderThreadPool
+inline ThreadPool& LoaderThreadPool()
+{
+	ThreadPool* pool = threadLoaderPool();
+	return pool != nullptr ? *pool : SharedThreadPool();
+}
+#endif
@@ -0,0 +1,33 @@
+#version 330 core
+out vec4 FragColor;
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+flat in vec4 UvTransform;
+flat in float Layer;
+
+uniform sampler2DArray atlas;
+uniform vec3 lightColor;
+uniform vec3 lightPos;
+
+void main()
+{
+	// repeat inside the texture's region. The gradients come from the unwrapped coordinates, so the jump at the wrap
+	// doesn't select the smallest mip
+	vec2 uv = fract(TexCoords) * UvTransform.xy + UvTransform.zw;
+	vec2 dx = dFdx(TexCoords) * UvTransform.xy;
+	vec2 dy = dFdy(TexCoords) * UvTransform.xy;
+	vec3 objectColor = textureGrad(atlas, vec3(uv, Layer), dx, dy).rgb;
+
+	vec3 norm = normalize(Normal);
+	vec3 lightDir = normalize(lightPos - FragPos);
+
+	float diff = max(dot(norm, lightDir), 0.0f);
+	vec3 diffuse = diff * lightColor;
+
+	float ambientStrength = 0.1f;
+	vec3 ambient = ambientStrength * lightColor;
+
+	vec3 result = (ambient + diffuse) * objectColor;
+	FragColor = vec4(result, 1.0f);
+}
@@ -0,0 +1,31 @@
+// Vertex shader for drawing many textured cubes in one instanced call. Every instance is a draw with its own model
+// matrix and material, the material being where its texture lies in the atlas (see AtlasRegion). Compiled with
+// ATLAS_MAX_DRAWS set to the length of the per-draw arrays
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 models[ATLAS_MAX_DRAWS];
+uniform vec4 uvTransforms[ATLAS_MAX_DRAWS]; // xy scale, zw offset
+uniform int layers[ATLAS_MAX_DRAWS];
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out vec4 UvTransform;
+flat out float Layer;
+
+void main()
+{
+	vec4 worldPos = models[gl_InstanceID] * vec4(aPos, 1.0f);
+	gl_Position = projection * view * worldPos;
+	FragPos = vec3(worldPos);
+	Normal = aNormal;
+	// the cube has no texture coordinates, every face shows the whole texture
+	vec3 axis = abs(aNormal);
+	TexCoords = (axis.x > 0.5f ? aPos.zy : axis.y > 0.5f ? aPos.xz : aPos.xy) + 0.5f;
+	UvTransform = uvTransforms[gl_InstanceID];
+	Layer = float(layers[gl_InstanceID]);
+}
@@ -8,36 +8,158 @@
 
 #include "Shader.h"
 #include "Camera.h"
+#include "AllocTracker.h"
+#include "GLDebug.h"
+#include "Options.h"
+#include "InputRecorder.h"
+#include "FrameStats.h"
+#include "Flythrough.h"
+#include "Probes.h"
+#include "Culling.h"
+#include "RenderTarget.h"
+#include "MultiView.h"
+#include "Input.h"
+#include "Reprojection.h"
+#include "Collision.h"
+#include "ImageBenchmark.h"
+#include "TextureStreamer.h"
+#include "TextureAtlas.h"
 
 #include <iostream>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void mouse_callback(GLFWwindow* window, double xpos, double ypos);
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
+bool enableReverseZ(int width, int height);
+Multi_View_Path selectMultiViewPath();
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// scene objects, indices into the bounding volumes that get frustum culled every frame
+enum Scene_Object {
+	SCENE_LAMP,
+	SCENE_CUBE,
+	SCENE_ATLAS_CUBES, // the whole row, drawn in one call
+	SCENE_OBJECT_COUNT
+};
+const float CUBE_BOUNDING_RADIUS = 0.8660254f; // half the diagonal of the unit cube
+
+// window framebuffer and the offscreen target the scene renders into when it needs its own depth format
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+RenderTarget sceneTarget;
+
+// stereo, both eyes are layers of one target rendered in a single pass, see --stereo
+const int STEREO_VIEWS = 2;
+const unsigned int MULTIVIEW_BINDING = 0; // uniform buffer binding of the MultiView block
+LayeredRenderTarget stereoTarget;
+
+// frames synthesized from the last rendered one, see --reproject
+Reprojector reprojector;
+
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 7.0f));
-float lastX = SCR_WIDTH / 2.0f;
-float lastY = SCR_HEIGHT / 2.0f;
-bool firstMouse = true;
+
+// keyboard and mouse, buffered by the GLFW callbacks and read once per frame
+InputSystem input;
+
+// walking collides with the scene's boxes, see --noclip
+CollisionWorld collisionWorld;
+CapsuleShape walkCapsule;
+bool walkCollision = true;
 
 // timing
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
-int main()
+// scripted input, see --record / --replay
+InputRecorder inputRecorder;
+InputReplayer inputReplayer;
+bool replaying = false;
+float replayDeltaTime = 1.0f / 60.0f;
+
+// spline camera benchmark, see --flythrough
+Flythrough flythrough;
+bool flyingThrough = false;
+size_t flythroughFrame = 0;
+int flythroughSegment = -1; // segment of the frame being rendered
+
+// gl debug output, only installed with --gl-debug
+GLDebugLog glDebugLog;
+bool glDebugEnabled = false;
+
+// textures are decoded in the background and uploaded a slice per frame, see --texture-budget
+TextureStreamer textureStreamer;
+TextureCache textureCache;
+
+// allocations
+const unsigned int ALLOC_WARMUP_FRAMES = 3; // frames allowed to allocate before the loop is expected to be allocation free
+
+int main(int argc, char** argv)
 {
+	AppOptions options = ParseOptions(argc, argv);
+	if (options.BenchCullObjects > 0)
+	{
+		RunCullingBenchmark(options.BenchCullObjects, 20);
+		return 0;
+	}
+	if (options.BenchViewIterations > 0)
+	{
+		RunMultiViewBenchmark(options.BenchViewIterations);
+		return 0;
+	}
+	if (options.BenchColliders > 0)
+	{
+		RunCollisionBenchmark(options.BenchColliders, 200);
+		return 0;
+	}
+	if (options.BenchJpegPath)
+	{
+		RunJpegBenchmark(options.BenchJpegPath, 20);
+		return 0;
+	}
+	if (options.BenchBlockCompressionPath)
+	{
+		RunBlockCompressionBenchmark(options.BenchBlockCompressionPath, 3);
+		return 0;
+	}
+	if (!options.BenchDecodePaths.empty())
+	{
+		RunDecodeBenchmark(options.BenchDecodePaths, 10);
+		return 0;
+	}
+	if (options.QuaternionCamera)
+		camera.SetQuaternionMode(true);
+	if (options.PerfMarkersPath && !PerfMarkers::Open(options.PerfMarkersPath))
+		std::cout << "ERROR::PROBES::MARKER_FILE_NOT_OPENED " << options.PerfMarkersPath << std::endl;
+	if (options.RecordPath)
+		inputRecorder.Open(options.RecordPath);
+	if (options.ReplayPath)
+	{
+		replaying = inputReplayer.Load(options.ReplayPath);
+		if (!replaying)
+			return -1;
+		replayDeltaTime = options.ReplayDeltaTime;
+	}
+	if (options.FlythroughPath)
+	{
+		flyingThrough = flythrough.Load(options.FlythroughPath);
+		if (!flyingThrough)
+			return -1;
+	}
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	if (options.GLDebug)
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	if (options.Headless)
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
 
 	// glfw window creation
 	// --------------------
@@ -49,12 +171,12 @@ int main()
 		return -1;
 	}
 	glfwMakeContextCurrent(window);
+	if (options.Headless)
+		glfwSwapInterval(0); // measure render cost, not the display refresh
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetScrollCallback(window, scroll_callback);
 
-	// tell GLFW to capture our mouse
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	// queue key, mouse and scroll events and tell GLFW to capture our mouse
+	input.Install(window);
 
 	// glad: load all OpenGL function pointers
 	// ---------------------------------------
@@ -64,14 +186,65 @@ int main()
 		return -1;
 	}
 
+	// route driver debug messages (performance warnings, undefined behavior) into the debug log
+	if (options.GLDebug)
+		glDebugEnabled = glDebugLog.Install((GLADloadproc)glfwGetProcAddress);
+
 	// configure global opengl state
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (options.ReverseZ)
+		camera.ReverseZ = enableReverseZ(framebufferWidth, framebufferHeight);
 
 	// build and compile our shader zprogram
 	// ------------------------------------
 	Shader lampShader("lampShader.vert", "lampShader.frag");
 	Shader lightingShader("lightingShader.vert", "lightingShader.frag");
+	Shader* lampProgram = &lampShader;
+	Shader* lightingProgram = &lightingShader;
+
+	// stereo: the same objects drawn once into every eye's layer, with the eye matrices coming from a uniform buffer
+	std::unique_ptr<Shader> lampMultiView, lightingMultiView;
+	MultiViewBlock multiViewBlock;
+	MultiViewBuffer multiViewBuffer;
+	int multiViewInstances = 0; // instances per draw, 0 while rendering a single view
+	if (options.StereoSeparation > 0.0f)
+	{
+		Multi_View_Path path = selectMultiViewPath();
+		GLenum depthFormat = camera.ReverseZ ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
+		if (stereoTarget.Create(framebufferWidth / STEREO_VIEWS, framebufferHeight, STEREO_VIEWS, path == MULTIVIEW_PATH_OVR, depthFormat))
+		{
+			char defines[128];
+			MultiViewDefines(path, STEREO_VIEWS, defines, sizeof(defines));
+			const char* geometryPath = path == MULTIVIEW_PATH_GS ? "multiView.geom" : nullptr;
+			lampMultiView.reset(new Shader("multiView.vert", "lampShader.frag", geometryPath, defines));
+			lightingMultiView.reset(new Shader("multiView.vert", "lightingShader.frag", geometryPath, defines));
+			for (Shader* program : { lampMultiView.get(), lightingMultiView.get() })
+				glUniformBlockBinding(program->ID, glGetUniformBlockIndex(program->ID, "MultiView"), MULTIVIEW_BINDING);
+			multiViewBuffer.Create(MULTIVIEW_BINDING);
+			lampProgram = lampMultiView.get();
+			lightingProgram = lightingMultiView.get();
+			multiViewInstances = MultiViewInstances(path, STEREO_VIEWS);
+		}
+	}
+
+	// reprojection: only every reprojectInterval-th frame renders the scene, the ones in between warp its colour and
+	// depth, which the scene target keeps around
+	unsigned int reprojectInterval = 0;
+	bool verifyReprojection = options.ReprojectVerify;
+	if (options.ReprojectInterval > 1)
+	{
+		if (multiViewInstances > 0)
+			std::cout << "ERROR::REPROJECT::STEREO_NOT_SUPPORTED" << std::endl;
+		else
+		{
+			if (sceneTarget.FBO == 0)
+				sceneTarget.Create(framebufferWidth, framebufferHeight, GL_DEPTH_COMPONENT32F);
+			if (sceneTarget.FBO != 0 && reprojector.Create(framebufferWidth, framebufferHeight))
+				reprojectInterval = options.ReprojectInterval;
+		}
+	}
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -118,9 +291,13 @@ int main()
 	-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
 	-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
 	};
-	// world space positions of our cubes
-	glm::vec3 cubePositions = glm::vec3(0.0f, 0.0f, 0.0f);
-	glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+	// world space positions of our cubes, in double precision and rendered relative to the camera so the scene stays
+	// stable arbitrarily far from the origin (try --world-offset 100000)
+	glm::dvec3 worldOffset(options.WorldOffset, 0.0, options.WorldOffset);
+	glm::dvec3 cubePositions = worldOffset + glm::dvec3(0.0, 0.0, 0.0);
+	glm::dvec3 lightPos = worldOffset + glm::dvec3(1.2, 1.0, 2.0);
+	camera.Position += worldOffset;
+	camera.RebaseDistance = options.RebaseDistance;
 
 
 	// cube vao vbo setup
@@ -149,133 +326,391 @@ int main()
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
+	// name the objects so debug messages refer to them by name
+	GLDebugLog::Label(GL_VERTEX_ARRAY, cubeVAO, "cubeVAO");
+	GLDebugLog::Label(GL_VERTEX_ARRAY, lightVAO, "lightVAO");
+	GLDebugLog::Label(GL_BUFFER, VBO, "cubeVBO");
+	GLDebugLog::Label(GL_PROGRAM, lampShader.ID, "lampShader");
+	GLDebugLog::Label(GL_PROGRAM, lightingShader.ID, "lightingShader");
 
 	// load and create a texture 
 	// -------------------------
-	unsigned int texture1;
-	// texture 1
-	// ---------
-	glGenTextures(1, &texture1);
-	glBindTexture(GL_TEXTURE_2D, texture1);
-	// set the texture wrapping parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// set texture filtering parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// load image, create texture and generate mipmaps
-	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-	unsigned char* data = stbi_load("container.jpg", &width, &height, &nrChannels, 0);
-	if (data)
+	// imported on a background thread, or mapped from the texture cache after the first run, a placeholder is bound
+	// until every mip level has arrived. Textures are flipped on the y-axis, mipmapped in linear space and block
+	// compressed while importing, --cook does the same ahead of time
+	if (options.TextureCachePath && textureCache.Open(options.TextureCachePath))
+		textureStreamer.Cache = &textureCache;
+	textureStreamer.Create(options.TextureBudget);
+	TextureImport textureImport;
+	textureImport.Compression = options.TextureCompression;
+	textureImport.MipFilter = options.TextureMipFilter;
+	if (!options.CookPaths.empty())
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		// offline import into the texture cache, every core helps
+		int failures = 0;
+		for (const char* path : options.CookPaths)
+			failures += textureStreamer.Cook(path, textureImport, &SharedThreadPool()) ? 0 : 1;
+		textureStreamer.Destroy();
+		glfwTerminate();
+		return failures == 0 ? 0 : -1;
 	}
-	else
+	TextureStreamer::Handle texture1 = textureStreamer.Request("container.jpg", GL_REPEAT, textureImport);
+
+	// atlas: a row of cubes with a texture each, all in one atlas so the row is a single instanced draw. Every instance
+	// gets the layer and UV transform of its texture instead of a texture binding of its own
+	const std::vector<const char*> atlasPaths = { "container.jpg", "awesomeface.png", "ron.jpg" };
+	TextureAtlas atlas;
+	std::vector<AtlasRegion> atlasRegions;
+	std::unique_ptr<Shader> atlasShader;
+	int atlasCubes = 0;
+	GLint atlasModelsLocation = -1;
+	glm::dvec3 atlasRowCenter = worldOffset + glm::dvec3(0.0, -1.5, -1.0);
+	const double ATLAS_CUBE_SPACING = 1.5;
+	if (options.Atlas)
 	{
-		std::cout << "Failed to load texture" << std::endl;
+		if (multiViewInstances > 0)
+			std::cout << "ERROR::ATLAS::STEREO_NOT_SUPPORTED" << std::endl;
+		else if (atlas.Build(atlasPaths, options.AtlasLayout, GL_REPEAT, textureImport, atlasRegions, &SharedThreadPool()))
+		{
+			atlasCubes = std::min((int)atlasRegions.size(), ATLAS_MAX_DRAWS);
+			char defines[64];
+			snprintf(defines, sizeof(defines), "#define ATLAS_MAX_DRAWS %d\n", ATLAS_MAX_DRAWS);
+			atlasShader.reset(new Shader("atlas.vert", "atlas.frag", nullptr, defines));
+			GLDebugLog::Label(GL_PROGRAM, atlasShader->ID, "atlasShader");
+			// the materials never change, only the model matrices follow the camera
+			glm::vec4 uvTransforms[ATLAS_MAX_DRAWS];
+			GLint layers[ATLAS_MAX_DRAWS];
+			for (int i = 0; i < atlasCubes; i++)
+			{
+				uvTransforms[i] = atlasRegions[i].UvTransform;
+				layers[i] = atlasRegions[i].Layer;
+			}
+			atlasShader->use();
+			glUniform4fv(glGetUniformLocation(atlasShader->ID, "uvTransforms"), atlasCubes, glm::value_ptr(uvTransforms[0]));
+			glUniform1iv(glGetUniformLocation(atlasShader->ID, "layers"), atlasCubes, layers);
+			atlasShader->setInt("atlas", 1);
+			atlasShader->setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+			atlasModelsLocation = glGetUniformLocation(atlasShader->ID, "models");
+		}
 	}
-	stbi_image_free(data);
+	auto atlasCubePosition = [&](int i) { return atlasRowCenter + glm::dvec3((i - (atlasCubes - 1) * 0.5) * ATLAS_CUBE_SPACING, 0.0, 0.0); };
 
 	// tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
 	// -------------------------------------------------------------------------------------------
 	// set up light object shader
 
+	// bounding spheres for frustum culling
+	// ------------------------------------
+	// centers are stored relative to the camera's floating origin and rebuilt whenever it moves
+	const glm::dvec3 sceneCenters[SCENE_OBJECT_COUNT] = { lightPos, cubePositions, atlasRowCenter }; // order must match Scene_Object
+	SphereSoA sceneBounds;
+	sceneBounds.Add(camera.ToOriginRelative(lightPos), 0.2f * CUBE_BOUNDING_RADIUS);
+	sceneBounds.Add(camera.ToOriginRelative(cubePositions), CUBE_BOUNDING_RADIUS);
+	sceneBounds.Add(camera.ToOriginRelative(atlasRowCenter), (float)((atlasCubes - 1) * ATLAS_CUBE_SPACING * 0.5) + CUBE_BOUNDING_RADIUS);
+	FrustumCuller culler;
+	std::vector<uint32_t> visibleObjects;
+
+	// collision boxes for walking, relative to the scene so they stay precise with --world-offset
+	walkCollision = !options.NoClip;
+	collisionWorld.Clear(worldOffset);
+	collisionWorld.AddBox(cubePositions - glm::dvec3(0.5), cubePositions + glm::dvec3(0.5));
+	collisionWorld.AddBox(lightPos - glm::dvec3(0.1), lightPos + glm::dvec3(0.1));
+	for (int i = 0; i < atlasCubes; i++)
+		collisionWorld.AddBox(atlasCubePosition(i) - glm::dvec3(0.5), atlasCubePosition(i) + glm::dvec3(0.5));
+	collisionWorld.Build();
+	visibleObjects.reserve(SCENE_OBJECT_COUNT);
+	// camera matrix version the culling result and each object's uniforms were computed for, see Camera::MatrixVersion
+	unsigned int culledVersion = 0;
+	unsigned int uploadedVersion[SCENE_OBJECT_COUNT] = {};
+
 	// render loop
 	// -----------
+	unsigned int frameCount = 0;
+	FrameStats frameStats(replaying ? inputReplayer.FrameCount() : 0);
+	bool reportedFrameAllocations = false;
 	while (!glfwWindowShouldClose(window))
 	{
+		AllocTracker::BeginFrame();
+		AllocScope frameAllocScope(ALLOC_RENDER);
+		TRACE_FRAME_BEGIN(frameCount);
+
 		// per-frame time logic
 		// --------------------
 		float currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
+		if (replaying && frameCount > 0)
+			frameStats.Add(deltaTime);
+		if (flyingThrough)
+			flythrough.AddFrameTime(flythroughSegment, deltaTime); // time of the previous frame, still tagged with its segment
+		inputRecorder.BeginFrame(currentFrame, deltaTime);
 
 		// input
 		// -----
 		processInput(window);
 
-		// render
-		// ------
-		glClearColor(0.13f, 0.12f, 0.12f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// bind textures on corresponding texture units
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture1);
-
-		// pass projection matrix to shader (note that in this case it could change every frame)
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-
-		// camera/view transformation
-		glm::mat4 view = camera.GetViewMatrix();
-
-		// calculate the model matrix for each object and pass it to shader before drawing
-		glm::mat4 model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-		model = glm::translate(model, lightPos);
-		model = glm::scale(model, glm::vec3(0.2f));
-
-		// render lamp
-		lampShader.use();
-		lampShader.setMat4("projection", projection);
-		lampShader.setMat4("view", view);
-		lampShader.setMat4("model", model);		
-
-		glBindVertexArray(lightVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		// render box
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, cubePositions);
-
-		lightingShader.use();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
-		lightingShader.setMat4("model", model);
-
-		lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
-		lightingShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("lightPos", lightPos);
-
-		glBindVertexArray(cubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
+		// upload whatever the decode threads finished, within the frame's budget
+		textureStreamer.Update();
+
+		// keep float-side data near the camera, see Camera::UpdateFloatingOrigin
+		if (camera.UpdateFloatingOrigin())
+		{
+			for (int i = 0; i < SCENE_OBJECT_COUNT; i++)
+			{
+				glm::vec3 center = camera.ToOriginRelative(sceneCenters[i]);
+				sceneBounds.X[i] = center.x;
+				sceneBounds.Y[i] = center.y;
+				sceneBounds.Z[i] = center.z;
+			}
+		}
+
+		// projection and camera/view transformation, cached by the camera and only rebuilt when it moved, turned or zoomed.
+		// The view used for drawing is rotation only since positions are made camera-relative in the model matrices
+		float aspect = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+		if (multiViewInstances > 0)
+			aspect /= STEREO_VIEWS; // every eye gets its share of the window
+		const CameraMatrices& matrices = camera.GetMatrices(aspect);
+		unsigned int matrixVersion = camera.MatrixVersion();
+		const glm::mat4& projection = matrices.Projection;
+		const glm::mat4& view = matrices.RelativeView;
+
+		// reprojection: between real frames the last one is warped to the current pose instead of rendering the scene
+		bool synthesize = reprojectInterval > 1 && reprojector.HasSource() && frameCount % reprojectInterval != 0;
+		if (synthesize)
+		{
+			glm::mat4 warp = reprojector.WarpMatrix(matrices, camera.Position);
+			reprojector.Synthesize(sceneTarget, warp, camera.ReverseZ, 0, framebufferWidth, framebufferHeight);
+			if (verifyReprojection)
+			{
+				reprojector.Verify(sceneTarget, warp, camera.ReverseZ, 0);
+				verifyReprojection = false;
+				AllocTracker::BeginFrame(); // the one-off check is allowed to allocate
+			}
+		}
+		else
+		{
+			// render
+			// ------
+			if (multiViewInstances > 0)
+				stereoTarget.Bind();
+			else if (sceneTarget.FBO != 0)
+				sceneTarget.Bind();
+			glClearColor(0.13f, 0.12f, 0.12f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			// bind textures on corresponding texture units
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, textureStreamer.Texture(texture1));
+
+			// skip objects outside the view frustum, culling works in floating origin space like the bounds. A rebase moves
+			// the bounds and the origin together, so the result only changes with the camera matrices. Stereo eyes share
+			// one culling pass against a frustum around both of them
+			if (matrixVersion != culledVersion)
+			{
+				if (multiViewInstances > 0)
+				{
+					BuildStereoViews(camera, aspect, options.StereoSeparation, multiViewBlock);
+					multiViewBuffer.Upload(multiViewBlock);
+					glm::vec3 cameraPosition = camera.ToOriginRelative(camera.Position);
+					culler.CullSpheres(ExtractSharedFrustum(multiViewBlock, cameraPosition, camera.ReverseZ), sceneBounds, visibleObjects);
+				}
+				else
+					culler.CullSpheres(ExtractFrustum(matrices.ViewProjection, camera.ReverseZ), sceneBounds, visibleObjects);
+				culledVersion = matrixVersion;
+			}
+			bool visible[SCENE_OBJECT_COUNT] = {};
+			for (uint32_t index : visibleObjects)
+				visible[index] = true;
+
+			// calculate the model matrix for each object and pass it to shader before drawing. Uniforms stay set on their
+			// program, and camera-relative model matrices only change with the camera, so uploads are skipped while the
+			// matrix version is unchanged
+			// render lamp
+			if (visible[SCENE_LAMP])
+			{
+				lampProgram->use();
+				if (uploadedVersion[SCENE_LAMP] != matrixVersion)
+				{
+					glm::mat4 model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
+					model = glm::scale(model, glm::vec3(0.2f));
+					model = camera.GetRelativeModelMatrix(lightPos, model);
+					lampProgram->setMat4("projection", projection);
+					lampProgram->setMat4("view", view);
+					lampProgram->setMat4("model", model);
+					uploadedVersion[SCENE_LAMP] = matrixVersion;
+				}
+
+				glBindVertexArray(lightVAO);
+				TRACE_DRAW(lightVAO, 36);
+				if (multiViewInstances > 0)
+					glDrawArraysInstanced(GL_TRIANGLES, 0, 36, multiViewInstances);
+				else
+					glDrawArrays(GL_TRIANGLES, 0, 36);
+			}
+
+			// render box
+			if (visible[SCENE_CUBE])
+			{
+				lightingProgram->use();
+				if (uploadedVersion[SCENE_CUBE] != matrixVersion)
+				{
+					glm::mat4 model = camera.GetRelativeModelMatrix(cubePositions);
+					lightingProgram->setMat4("projection", projection);
+					lightingProgram->setMat4("view", view);
+					lightingProgram->setMat4("model", model);
+
+					lightingProgram->setVec3("objectColor", 1.0f, 0.5f, 0.31f);
+					lightingProgram->setVec3("lightColor", 1.0f, 1.0f, 1.0f);
+					lightingProgram->setVec3("lightPos", camera.ToCameraRelative(lightPos)); // lighting happens in camera-relative space
+					uploadedVersion[SCENE_CUBE] = matrixVersion;
+				}
+
+				glBindVertexArray(cubeVAO);
+				TRACE_DRAW(cubeVAO, 36);
+				if (multiViewInstances > 0)
+					glDrawArraysInstanced(GL_TRIANGLES, 0, 36, multiViewInstances);
+				else
+					glDrawArrays(GL_TRIANGLES, 0, 36);
+			}
+
+			// render the atlas cubes, one draw whatever their textures
+			if (visible[SCENE_ATLAS_CUBES] && atlasCubes > 0)
+			{
+				atlasShader->use();
+				if (uploadedVersion[SCENE_ATLAS_CUBES] != matrixVersion)
+				{
+					glm::mat4 models[ATLAS_MAX_DRAWS];
+					for (int i = 0; i < atlasCubes; i++)
+						models[i] = camera.GetRelativeModelMatrix(atlasCubePosition(i));
+					glUniformMatrix4fv(atlasModelsLocation, atlasCubes, GL_FALSE, glm::value_ptr(models[0]));
+					atlasShader->setMat4("projection", projection);
+					atlasShader->setMat4("view", view);
+					atlasShader->setVec3("lightPos", camera.ToCameraRelative(lightPos));
+					uploadedVersion[SCENE_ATLAS_CUBES] = matrixVersion;
+				}
+
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.ID);
+				glActiveTexture(GL_TEXTURE0);
+				glBindVertexArray(cubeVAO);
+				TRACE_DRAW(cubeVAO, 36 * atlasCubes);
+				glDrawArraysInstanced(GL_TRIANGLES, 0, 36, atlasCubes);
+			}
+
+			if (multiViewInstances > 0)
+				stereoTarget.BlitLayersSideBySide(framebufferWidth, framebufferHeight);
+			else if (sceneTarget.FBO != 0)
+				sceneTarget.BlitToDefault(framebufferWidth, framebufferHeight);
+			if (reprojectInterval > 1)
+				reprojector.SetSource(matrices, camera.Position);
+		}
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		TRACE_FRAME_END(frameCount);
+		if (glDebugEnabled)
+			glDebugLog.EndFrame();
+
+		// a steady-state frame must not touch the heap
+		// ---------------------------------------------
+		uint64_t frameAllocations = AllocTracker::FrameAllocations();
+		if (++frameCount > ALLOC_WARMUP_FRAMES && frameAllocations != 0 && !reportedFrameAllocations)
+		{
+			std::cout << "ERROR::ALLOC::STEADY_STATE_FRAME_ALLOCATED frame " << frameCount << ": " << frameAllocations
+				<< " allocations, " << AllocTracker::FrameBytes() << " bytes" << std::endl;
+			AllocTracker::PrintReport();
+			reportedFrameAllocations = true;
+		}
 	}
+	if (replaying)
+		FrameStats::Print("REPLAY::FRAME_TIMES", frameStats.Summarize());
+	inputRecorder.Close();
+	PerfMarkers::Close();
+	int exitCode = 0;
+	if (flyingThrough)
+	{
+		flythrough.PrintSummary(options.BenchOutPath);
+		if (options.BenchBaselinePath && !flythrough.CompareBaseline(options.BenchBaselinePath, options.BenchTolerance))
+			exitCode = 2;
+	}
+	AllocTracker::PrintReport();
+	textureCache.PrintReport();
+	if (glDebugEnabled)
+		glDebugLog.PrintSummary();
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
 	glDeleteVertexArrays(1, &cubeVAO);
 	glDeleteBuffers(1, &VBO);
+	sceneTarget.Destroy();
+	stereoTarget.Destroy();
+	multiViewBuffer.Destroy();
+	reprojector.Destroy();
+	textureStreamer.Destroy();
+	atlas.Destroy();
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
-	return 0;
+	return exitCode;
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
+// process all input: fold the events queued since the last frame and react to them
+// ---------------------------------------------------------------------------------
 void processInput(GLFWwindow* window)
 {
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+	const FrameInput& frameInput = input.BeginFrame();
+	if (frameInput.Held(GLFW_KEY_ESCAPE))
 		glfwSetWindowShouldClose(window, true);
 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-		camera.ProcessKeyboard(FLY, deltaTime);
+	// a replay drives the camera on its own, with a fixed timestep, and ends the run when the recording does
+	glm::dvec3 previousPosition = camera.Position;
+	if (replaying)
+	{
+		if (!inputReplayer.ReplayFrame(camera, replayDeltaTime))
+			glfwSetWindowShouldClose(window, true);
+	}
+	else if (flyingThrough)
+	{
+		flythroughSegment = flythrough.Apply(camera, flythroughFrame++);
+		if (flythroughSegment < 0)
+			glfwSetWindowShouldClose(window, true);
+	}
+	else
+	{
+		const int keys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_LEFT_SHIFT };
+		const Camera_Movement movements[] = { FORWARD, BACKWARD, LEFT, RIGHT, FLY };
+		for (int i = 0; i < 5; i++)
+		{
+			if (frameInput.Held(keys[i]))
+			{
+				inputRecorder.Key(movements[i]);
+				camera.ProcessKeyboard(movements[i], deltaTime);
+			}
+		}
+		// all mouse movement of the frame arrives as one offset
+		if (frameInput.MouseX != 0.0f || frameInput.MouseY != 0.0f)
+		{
+			inputRecorder.Mouse(frameInput.MouseX, frameInput.MouseY);
+			camera.ProcessMouseMovement(frameInput.MouseX, frameInput.MouseY);
+		}
+		if (frameInput.ScrollY != 0.0f)
+		{
+			inputRecorder.Scroll(frameInput.ScrollY);
+			camera.ProcessMouseScroll(frameInput.ScrollY);
+		}
+	}
+
+	// walking slides along the scene instead of passing through it, scripted camera paths and flying ignore collisions.
+	// Replays collide too, so they still end where the recorded run did
+	if (walkCollision && !flyingThrough && !camera.Fly)
+		camera.Position = collisionWorld.Move(walkCapsule, previousPosition, camera.Position - previousPosition);
+
+	// dump the gl debug summary once per key press
+	if (frameInput.Pressed[GLFW_KEY_F1] && glDebugEnabled)
+		glDebugLog.PrintSummary();
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -285,32 +720,45 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	// make sure the viewport matches the new window dimensions; note that width and 
 	// height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
+	framebufferWidth = width;
+	framebufferHeight = height;
+	sceneTarget.Resize(width, height);
+	stereoTarget.Resize(width / STEREO_VIEWS, height);
+	reprojector.Resize(width, height);
 }
 
-
-// glfw: whenever the mouse moves, this callback is called
-// -------------------------------------------------------
-void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+// reverse-Z: render into a 32 bit float depth buffer with 0..1 clip depth and an inverted depth test, so depth
+// precision is spent evenly over distance. Returns false if the context lacks glClipControl
+// ---------------------------------------------------------------------------------------------------------------
+bool enableReverseZ(int width, int height)
 {
-	if (firstMouse)
+	if (glad_glClipControl == NULL && glfwExtensionSupported("GL_ARB_clip_control"))
+		glad_glClipControl = (PFNGLCLIPCONTROLPROC)glfwGetProcAddress("glClipControl");
+	if (glad_glClipControl == NULL)
 	{
-		lastX = xpos;
-		lastY = ypos;
-		firstMouse = false;
+		std::cout << "ERROR::REVERSE_Z::CLIP_CONTROL_NOT_SUPPORTED" << std::endl;
+		return false;
 	}
+	if (!sceneTarget.Create(width, height, GL_DEPTH_COMPONENT32F))
+		return false;
 
-	float xoffset = xpos - lastX;
-	float yoffset = lastY - ypos; // reversed since y-coordinates go from bottom to top
-
-	lastX = xpos;
-	lastY = ypos;
-
-	camera.ProcessMouseMovement(xoffset, yoffset);
+	glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+	glDepthFunc(GL_GREATER); // nearer fragments have larger depth
+	glClearDepth(0.0); // clear to the far plane
+	return true;
 }
 
-// glfw: whenever the mouse scroll wheel scrolls, this callback is called
-// ----------------------------------------------------------------------
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+// multi-view: pick the cheapest way this context offers to render every view of a layered target in one submission
+// ------------------------------------------------------------------------------------------------------------------
+Multi_View_Path selectMultiViewPath()
 {
-	camera.ProcessMouseScroll(yoffset);
+	if (glfwExtensionSupported("GL_OVR_multiview2"))
+	{
+		FramebufferTextureMultiviewOVR() = (PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC)glfwGetProcAddress("glFramebufferTextureMultiviewOVR");
+		if (FramebufferTextureMultiviewOVR() != NULL)
+			return MULTIVIEW_PATH_OVR;
+	}
+	if (glfwExtensionSupported("GL_AMD_vertex_shader_layer"))
+		return MULTIVIEW_PATH_VS_LAYER;
+	return MULTIVIEW_PATH_GS;
 }
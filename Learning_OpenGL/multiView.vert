@@ -0,0 +1,55 @@
+// Vertex shader for rendering all views of a MultiView block in one pass. Compiled with one of
+//   MULTIVIEW_OVR       GL_OVR_multiview2, the driver runs the shader once per view and routes it to its layer
+//   MULTIVIEW_VS_LAYER  one instance per view, the vertex shader writes gl_Layer (GL_AMD_vertex_shader_layer)
+//   MULTIVIEW_GS        one instance per view, multiView.geom forwards the triangle to its layer
+// and MULTIVIEW_VIEW_COUNT set to the number of views
+#version 330 core
+#if defined(MULTIVIEW_OVR)
+#extension GL_OVR_multiview2 : require
+layout (num_views = MULTIVIEW_VIEW_COUNT) in;
+#elif defined(MULTIVIEW_VS_LAYER)
+#extension GL_AMD_vertex_shader_layer : require
+#endif
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+
+// see MultiViewBlock
+layout (std140) uniform MultiView
+{
+	mat4 views[8];
+	mat4 projections[8];
+	mat4 viewProjections[8];
+	vec4 viewData[8];
+	int viewCount;
+};
+
+uniform mat4 model;
+
+#if defined(MULTIVIEW_GS)
+// the geometry shader outputs FragPos and Normal for the fragment shader
+#define FragPos VertexFragPos
+#define Normal VertexNormal
+#endif
+out vec3 FragPos;
+out vec3 Normal;
+#if defined(MULTIVIEW_GS)
+flat out int ViewIndex;
+#endif
+
+void main()
+{
+#if defined(MULTIVIEW_OVR)
+	int viewIndex = int(gl_ViewID_OVR);
+#else
+	int viewIndex = gl_InstanceID;
+#endif
+	vec4 worldPos = model * vec4(aPos, 1.0f);
+	gl_Position = viewProjections[viewIndex] * worldPos;
+	FragPos = vec3(worldPos);
+	Normal = aNormal;
+#if defined(MULTIVIEW_VS_LAYER)
+	gl_Layer = viewIndex;
+#elif defined(MULTIVIEW_GS)
+	ViewIndex = viewIndex;
+#endif
+}
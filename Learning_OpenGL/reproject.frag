@@ -0,0 +1,8 @@
+#version 330 core
+in vec4 Color;
+out vec4 FragColor;
+
+void main()
+{
+	FragColor = vec4(Color.rgb, 1.0f); // alpha 1 marks a covered pixel, holes keep the cleared alpha 0
+}
@@ -0,0 +1,21 @@
+// Forward warp of the last rendered frame: one point per source pixel, moved to where the current camera sees it.
+// Drawn with glDrawArrays(GL_POINTS, 0, width * height) and no vertex buffer, the pixel comes from gl_VertexID
+#version 330 core
+uniform sampler2D sourceColor;
+uniform sampler2D sourceDepth;
+uniform mat4 warp; // source clip space to current clip space, see Reprojector::WarpMatrix
+uniform bool zeroToOneDepth;
+
+out vec4 Color;
+
+void main()
+{
+	ivec2 size = textureSize(sourceDepth, 0);
+	ivec2 texel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+	float depth = texelFetch(sourceDepth, texel, 0).r;
+	vec2 ndc = (vec2(texel) + 0.5f) / vec2(size) * 2.0f - 1.0f;
+	float ndcDepth = zeroToOneDepth ? depth : depth * 2.0f - 1.0f;
+	// stays homogeneous, so pixels at infinite depth (reverse-Z sky) move like directions
+	gl_Position = warp * vec4(ndc, ndcDepth, 1.0f);
+	Color = texelFetch(sourceColor, texel, 0);
+}
@@ -0,0 +1,42 @@
+#version 330 core
+uniform sampler2D warpedColor;
+uniform sampler2D warpedDepth;
+uniform bool reverseZ;
+uniform int fillRadius;
+
+out vec4 FragColor;
+
+// Disocclusion fill: pixels no source pixel landed on take the nearest covered pixel to their left or right, and of
+// those two the one further away, since uncovered areas show background. Must match Reprojector::FillCpu
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 color = texelFetch(warpedColor, texel, 0);
+	if (color.a == 0.0f)
+	{
+		int width = textureSize(warpedColor, 0).x;
+		bool found = false;
+		float bestDepth = 0.0f;
+		for (int side = -1; side <= 1; side += 2)
+		{
+			for (int step = 1; step <= fillRadius; step++)
+			{
+				int x = texel.x + side * step;
+				if (x < 0 || x >= width)
+					break;
+				vec4 candidate = texelFetch(warpedColor, ivec2(x, texel.y), 0);
+				if (candidate.a == 0.0f)
+					continue;
+				float depth = texelFetch(warpedDepth, ivec2(x, texel.y), 0).r;
+				if (!found || (reverseZ ? depth < bestDepth : depth > bestDepth))
+				{
+					color = candidate;
+					bestDepth = depth;
+					found = true;
+				}
+				break;
+			}
+		}
+	}
+	FragColor = vec4(color.rgb, 1.0f);
+}
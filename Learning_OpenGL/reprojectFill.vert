@@ -0,0 +1,8 @@
+// Fullscreen triangle, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and no vertex buffer
+#version 330 core
+
+void main()
+{
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+}
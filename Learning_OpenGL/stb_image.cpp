@@ -1,2 +1,23 @@
+#include "DecodeArena.h"
+#include "ThreadPool.h"
+
+// route stb_image's heap traffic through the thread's decode arena inside a DecodeArenaScope, through the allocation
+// tracker otherwise
+#define STBI_MALLOC(sz)           DecodeArena::Malloc(sz)
+#define STBI_REALLOC(p,newsz)     DecodeArena::Realloc(p,newsz)
+#define STBI_FREE(p)              DecodeArena::Free(p)
+
+// decode large JPEGs on the calling thread's loader pool, the shared one unless it picked its own
+static void stbiParallelFor(int count, void (*fn)(void* user, int index), void* user)
+{
+	LoaderThreadPool().ParallelFor((size_t)count, 1, [=](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			fn(user, (int)i);
+	});
+}
+#define STBI_PARALLEL_FOR(count, fn, user) stbiParallelFor(count, fn, user)
+#define STBI_PARALLEL_THREADS()            ((int)LoaderThreadPool().ThreadCount())
+
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
\ No newline at end of file
+#include "stb_image.h"
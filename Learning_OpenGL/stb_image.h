@@ -208,6 +208,53 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// On top of SSE2, AVX2 versions of the IDCT (two blocks at a time), the 2x2
+// upsampler and the YCbCr conversion (16 pixels at a time) are picked by a
+// run-time test. They are compiled with a target attribute on GCC/Clang, so
+// no -mavx2 is needed; define STBI_NO_AVX2 to leave them out. They produce
+// the same bits as the SSE2 kernels.
+//
+// ===========================================================================
+//
+// Multithreaded JPEG decoding
+//
+// Large baseline JPEGs can be decoded on several threads. Define
+//
+//     #define STBI_PARALLEL_FOR(count, fn, user)  my_parallel_for(count, fn, user)
+//     #define STBI_PARALLEL_THREADS()             my_thread_count()
+//
+// before including the implementation, where my_parallel_for calls
+// fn(user, i) once for every i in [0, count), possibly on several threads
+// at once, and returns when all calls are done. STBI_PARALLEL_THREADS is the
+// number of threads that may run them; with 1 the single threaded decoder is
+// used. Jobs are only dispatched from the thread calling stbi_load*, never
+// from inside fn.
+//
+// With restart markers (DRI) every restart interval is decoded
+// independently. Without them Huffman decoding stays serial, but runs
+// concurrently with the IDCT of the previous band of MCU rows. Upsampling and
+// colour conversion are split into bands of output rows either way. Images
+// smaller than STBI_PARALLEL_MIN_PIXELS (default 1 megapixel) and
+// progressive scans use the single threaded path. The failure reason is
+// thread local when STBI_PARALLEL_FOR is defined.
+//
+// ===========================================================================
+//
+// Decoding into your own buffer
+//
+//    int n = stbi_load_from_memory_into(buffer, len, &x, &y, &comp, req_comp,
+//                                       dest, dest_size, flip_vertically);
+//
+// writes the 8-bit image straight into dest, which must hold x*y*n bytes,
+// instead of allocating it, and returns n, the number of channels written, or
+// 0 on failure. The image size and channel count can be had up front from
+// stbi_info_from_memory. dest may be any writable memory, like a mapped pixel
+// buffer. flip_vertically puts the first row at the end of dest; it only
+// applies to this call, stbi_set_flip_vertically_on_load is ignored. The JPEG
+// decoder writes its rows straight to their final place; the other formats
+// decode into a buffer of their own that is copied over (and flipped) in one
+// pass.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -350,6 +397,7 @@ extern "C" {
 
 	STBIDEF stbi_uc* stbi_load_from_memory(stbi_uc           const* buffer, int len, int* x, int* y, int* channels_in_file, int desired_channels);
 	STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk, void* user, int* x, int* y, int* channels_in_file, int desired_channels);
+	STBIDEF int      stbi_load_from_memory_into(stbi_uc const* buffer, int len, int* x, int* y, int* channels_in_file, int desired_channels, stbi_uc* dest, size_t dest_size, int flip_vertically);
 
 #ifndef STBI_NO_STDIO
 	STBIDEF stbi_uc* stbi_load(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels);
@@ -445,6 +493,13 @@ extern "C" {
 	// flip the image vertically, so the first pixel in the output array is the bottom left
 	STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+	// SIMD level of the JPEG kernels: 0 generic C, 1 SSE2 or NEON, 2 AVX2.
+	// stbi_jpeg_simd_level reports the best one the build and CPU support,
+	// stbi_set_jpeg_simd_limit caps the level later loads pick (-1 removes the
+	// cap), for benchmarks and tests. not thread safe
+	STBIDEF int stbi_jpeg_simd_level(void);
+	STBIDEF void stbi_set_jpeg_simd_limit(int level);
+
 	// ZLIB client - used by PNG, available for other purposes
 
 	STBIDEF char* stbi_zlib_decode_malloc_guesssize(const char* buffer, int len, int initial_size, int* outlen);
@@ -555,6 +610,12 @@ typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
 #endif
 
+#ifdef _MSC_VER
+typedef unsigned __int64 stbi__uint64;
+#else
+typedef uint64_t stbi__uint64;
+#endif
+
 // should produce compiler error if size is wrong
 typedef unsigned char validate_uint32[sizeof(stbi__uint32) == 4 ? 1 : -1];
 
@@ -654,7 +715,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
 	int info3 = stbi__cpuid3();
@@ -665,7 +726,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
 	// If we're even attempting to compile this on GCC/Clang, that means
@@ -675,6 +736,50 @@ static int stbi__sse2_available(void)
 }
 #endif
 
+#endif
+
+// AVX2 kernels. unlike SSE2 they are only run after a run-time check, and
+// GCC/Clang compile them with a per-function target attribute
+#if !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2)
+#if defined(_MSC_VER) && _MSC_VER >= 1700
+#define STBI_AVX2
+#define STBI__AVX2_TARGET
+#elif (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#define STBI_AVX2
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef STBI_AVX2
+#include <immintrin.h>
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+// needs AVX and OSXSAVE (cpuid 1 ecx), ymm state enabled by the OS (xcr0)
+// and AVX2 (cpuid 7 ebx)
+#ifdef _MSC_VER
+static int stbi__avx2_available(void)
+{
+	int info[4];
+	__cpuid(info, 1);
+	if (((info[2] >> 27) & 3) != 3) return 0;
+	if ((_xgetbv(0) & 6) != 6) return 0;
+	__cpuidex(info, 7, 0);
+	return ((info[1] >> 5) & 1) != 0;
+}
+#else
+static int stbi__avx2_available(void)
+{
+	unsigned int a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+	if (((c >> 27) & 3) != 3) return 0;
+	__asm__ __volatile__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	if ((a & 6) != 6) return 0;
+	if (__get_cpuid_max(0, NULL) < 7) return 0;
+	__cpuid_count(7, 0, a, b, c, d);
+	return ((b >> 5) & 1) != 0;
+}
+#endif
 #endif
 #endif
 
@@ -713,6 +818,10 @@ typedef struct
 
 	stbi_uc* img_buffer, * img_buffer_end;
 	stbi_uc* img_buffer_original, * img_buffer_original_end;
+
+	stbi_uc* out_dest;   // caller's buffer for the 8-bit image, or NULL to allocate one
+	size_t out_dest_size;
+	int out_flip;        // write the rows bottom-up
 } stbi__context;
 
 
@@ -725,6 +834,9 @@ static void stbi__start_mem(stbi__context * s, stbi_uc const* buffer, int len)
 	s->read_from_callbacks = 0;
 	s->img_buffer = s->img_buffer_original = (stbi_uc*)buffer;
 	s->img_buffer_end = s->img_buffer_original_end = (stbi_uc*)buffer + len;
+	s->out_dest = NULL;
+	s->out_dest_size = 0;
+	s->out_flip = 0;
 }
 
 // initialize a callback-based context
@@ -737,6 +849,9 @@ static void stbi__start_callbacks(stbi__context * s, stbi_io_callbacks * c, void
 	s->img_buffer_original = s->buffer_start;
 	stbi__refill_buffer(s);
 	s->img_buffer_original_end = s->img_buffer_end;
+	s->out_dest = NULL;
+	s->out_dest_size = 0;
+	s->out_flip = 0;
 }
 
 #ifndef STBI_NO_STDIO
@@ -792,6 +907,7 @@ typedef struct
 	int bits_per_channel;
 	int num_channels;
 	int channel_order;
+	int flipped; // the decoder already wrote the rows bottom-up
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -851,8 +967,20 @@ static void* stbi__pnm_load(stbi__context * s, int* x, int* y, int* comp, int re
 static int      stbi__pnm_info(stbi__context * s, int* x, int* y, int* comp);
 #endif
 
-// this is not threadsafe
-static const char* stbi__g_failure_reason;
+// this is not threadsafe, unless parallel decoding makes it thread local
+#ifdef STBI_PARALLEL_FOR
+#if defined(__cplusplus) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900))
+#define STBI__THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define STBI__THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define STBI__THREAD_LOCAL __thread
+#endif
+#endif
+#ifndef STBI__THREAD_LOCAL
+#define STBI__THREAD_LOCAL
+#endif
+static STBI__THREAD_LOCAL const char* stbi__g_failure_reason;
 
 STBIDEF const char* stbi_failure_reason(void)
 {
@@ -975,6 +1103,15 @@ static stbi_uc* stbi__hdr_to_ldr(float* data, int x, int y, int comp);
 
 static int stbi__vertically_flip_on_load = 0;
 
+#ifndef STBI_NO_JPEG
+static int stbi__jpeg_simd_limit = -1;
+
+STBIDEF void stbi_set_jpeg_simd_limit(int level)
+{
+	stbi__jpeg_simd_limit = level;
+}
+#endif
+
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
 	stbi__vertically_flip_on_load = flag_true_if_should_flip;
@@ -1098,7 +1235,13 @@ static void stbi__vertical_flip_slices(void* image, int w, int h, int z, int byt
 static unsigned char* stbi__load_and_postprocess_8bit(stbi__context * s, int* x, int* y, int* comp, int req_comp)
 {
 	stbi__result_info ri;
-	void* result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+	void* result;
+	int channels;
+
+	// decoders that can write the rows bottom-up do it themselves
+	if (!s->out_dest)
+		s->out_flip = stbi__vertically_flip_on_load;
+	result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
 
 	if (result == NULL)
 		return NULL;
@@ -1111,11 +1254,24 @@ static unsigned char* stbi__load_and_postprocess_8bit(stbi__context * s, int* x,
 
 	// @TODO: move stbi__convert_format to here
 
-	if (stbi__vertically_flip_on_load) {
-		int channels = req_comp ? req_comp : *comp;
-		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+	channels = req_comp ? req_comp : *comp;
+	if (s->out_dest && result != s->out_dest) {
+		// the decoder allocated its own buffer; copy it to the caller's, flipping on the way
+		size_t row_bytes = (size_t)*x * channels;
+		int row;
+		if (s->out_dest_size < row_bytes * *y) {
+			STBI_FREE(result);
+			return stbi__errpuc("dest too small", "Destination buffer too small");
+		}
+		for (row = 0; row < *y; ++row)
+			memcpy(s->out_dest + row_bytes * row, (stbi_uc*)result + row_bytes * (s->out_flip ? *y - 1 - row : row), row_bytes);
+		STBI_FREE(result);
+		return s->out_dest;
 	}
 
+	if (s->out_flip && !ri.flipped)
+		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+
 	return (unsigned char*)result;
 }
 
@@ -1267,6 +1423,21 @@ STBIDEF stbi_uc* stbi_load_from_memory(stbi_uc const* buffer, int len, int* x, i
 	return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+STBIDEF int stbi_load_from_memory_into(stbi_uc const* buffer, int len, int* x, int* y, int* comp, int req_comp, stbi_uc * dest, size_t dest_size, int flip_vertically)
+{
+	stbi__context s;
+	int file_comp;
+	if (dest == NULL) return stbi__err("no dest", "Destination buffer is NULL");
+	stbi__start_mem(&s, buffer, len);
+	s.out_dest = dest;
+	s.out_dest_size = dest_size;
+	s.out_flip = flip_vertically;
+	if (!stbi__load_and_postprocess_8bit(&s, x, y, &file_comp, req_comp))
+		return 0;
+	if (comp)* comp = file_comp;
+	return req_comp ? req_comp : file_comp;
+}
+
 STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk, void* user, int* x, int* y, int* comp, int req_comp)
 {
 	stbi__context s;
@@ -1794,6 +1965,8 @@ typedef struct
 
 	// kernels
 	void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
+	// two blocks in one call, NULL if there is no such kernel
+	void (*idct_block2_kernel)(stbi_uc* out0, int out_stride0, short data0[64], stbi_uc* out1, int out_stride1, short data1[64]);
 	void (*YCbCr_to_RGB_kernel)(stbi_uc* out, const stbi_uc* y, const stbi_uc* pcb, const stbi_uc* pcr, int count, int step);
 	stbi_uc* (*resample_row_hv_2_kernel)(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs);
 } stbi__jpeg;
@@ -2499,6 +2672,186 @@ static void stbi__idct_simd(stbi_uc * out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two blocks at once, one in each 128-bit lane. the
+// unpack and pack instructions stay within their lane, so this is the sse2
+// version step for step and gives the same bits.
+static STBI__AVX2_TARGET void stbi__idct_avx2(stbi_uc * out0, int out_stride0, short data0[64], stbi_uc * out1, int out_stride1, short data1[64])
+{
+	__m256i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m256i tmp;
+
+	// dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_set1_epi32((int) (((unsigned int) (y) << 16) | ((x) & 0xffff)))
+
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+#define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+#define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+#define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+	// row r of the first block in the low lane, of the second in the high lane
+#define dct_load(r) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i*) (data0 + (r) * 8))), \
+         _mm_load_si128((const __m128i*) (data1 + (r) * 8)), 1)
+
+	// two output rows of each block
+#define dct_store(p) \
+      { \
+         __m128i lo = _mm256_castsi256_si128(p); \
+         __m128i hi = _mm256_extracti128_si256(p, 1); \
+         _mm_storel_epi64((__m128i*) out0, lo); out0 += out_stride0; \
+         _mm_storel_epi64((__m128i*) out0, _mm_shuffle_epi32(lo, 0x4e)); out0 += out_stride0; \
+         _mm_storel_epi64((__m128i*) out1, hi); out1 += out_stride1; \
+         _mm_storel_epi64((__m128i*) out1, _mm_shuffle_epi32(hi, 0x4e)); out1 += out_stride1; \
+      }
+
+	__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	__m256i bias_0 = _mm256_set1_epi32(512);
+	__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+	row0 = dct_load(0);
+	row1 = dct_load(1);
+	row2 = dct_load(2);
+	row3 = dct_load(3);
+	row4 = dct_load(4);
+	row5 = dct_load(5);
+	row6 = dct_load(6);
+	row7 = dct_load(7);
+
+	// column pass
+	dct_pass(bias_0, 10);
+
+	{
+		// 16bit 8x8 transpose, both lanes at once
+		dct_interleave16(row0, row4);
+		dct_interleave16(row1, row5);
+		dct_interleave16(row2, row6);
+		dct_interleave16(row3, row7);
+
+		dct_interleave16(row0, row2);
+		dct_interleave16(row1, row3);
+		dct_interleave16(row4, row6);
+		dct_interleave16(row5, row7);
+
+		dct_interleave16(row0, row1);
+		dct_interleave16(row2, row3);
+		dct_interleave16(row4, row5);
+		dct_interleave16(row6, row7);
+	}
+
+	// row pass
+	dct_pass(bias_1, 17);
+
+	{
+		// pack
+		__m256i p0 = _mm256_packus_epi16(row0, row1);
+		__m256i p1 = _mm256_packus_epi16(row2, row3);
+		__m256i p2 = _mm256_packus_epi16(row4, row5);
+		__m256i p3 = _mm256_packus_epi16(row6, row7);
+
+		// 8bit 8x8 transpose
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+
+		dct_interleave8(p0, p1);
+		dct_interleave8(p2, p3);
+
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+
+		// store
+		dct_store(p0);
+		dct_store(p2);
+		dct_store(p1);
+		dct_store(p3);
+	}
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store
+}
+
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2707,6 +3060,46 @@ static void stbi__idct_simd(stbi_uc * out, int out_stride, short data[64])
 
 #endif // STBI_NEON
 
+// a block waiting for a second one, so both can go through idct_block2_kernel
+typedef struct
+{
+	stbi_uc* out;
+	int out_stride;
+	short* data; // NULL if nothing is waiting
+} stbi__idct_pending;
+
+// transforms the block now or once a second one arrives. data has to stay
+// untouched until then; stbi__jpeg_idct_flush transforms a leftover block
+static void stbi__jpeg_idct_add(stbi__jpeg * z, stbi__idct_pending * p, stbi_uc * out, int out_stride, short * data)
+{
+	if (!z->idct_block2_kernel) {
+		z->idct_block_kernel(out, out_stride, data);
+	}
+	else if (p->data) {
+		z->idct_block2_kernel(p->out, p->out_stride, p->data, out, out_stride, data);
+		p->data = NULL;
+	}
+	else {
+		p->out = out;
+		p->out_stride = out_stride;
+		p->data = data;
+	}
+}
+
+static void stbi__jpeg_idct_flush(stbi__jpeg * z, stbi__idct_pending * p)
+{
+	if (p->data) {
+		z->idct_block_kernel(p->out, p->out_stride, p->data);
+		p->data = NULL;
+	}
+}
+
+// of two block buffers, the one that is not waiting to be transformed
+static short* stbi__jpeg_idct_free_block(stbi__idct_pending * p, short * blocks)
+{
+	return p->data == blocks ? blocks + 64 : blocks;
+}
+
 #define STBI__MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -2741,13 +3134,296 @@ static void stbi__jpeg_reset(stbi__jpeg * j)
 	// since we don't even allow 1<<30 pixels
 }
 
+#ifdef STBI_PARALLEL_FOR
+#ifndef STBI_PARALLEL_THREADS
+#define STBI_PARALLEL_THREADS() 2
+#endif
+#ifndef STBI_PARALLEL_MIN_PIXELS
+#define STBI_PARALLEL_MIN_PIXELS (1 << 20)
+#endif
+
+// the parallel paths walk a scan in units: one MCU of an interleaved scan, one
+// block of a single component scan. A restart interval counts the same units
+static int stbi__jpeg_parallel_worthwhile(stbi__jpeg * z)
+{
+	return STBI_PARALLEL_THREADS() > 1 && (double)z->s->img_x * z->s->img_y >= STBI_PARALLEL_MIN_PIXELS;
+}
+
+static int stbi__jpeg_units_x(stbi__jpeg * z)
+{
+	return z->scan_n == 1 ? (z->img_comp[z->order[0]].x + 7) >> 3 : z->img_mcu_x;
+}
+
+static int stbi__jpeg_units_y(stbi__jpeg * z)
+{
+	return z->scan_n == 1 ? (z->img_comp[z->order[0]].y + 7) >> 3 : z->img_mcu_y;
+}
+
+static int stbi__jpeg_unit_blocks(stbi__jpeg * z)
+{
+	int k, blocks = 0;
+	if (z->scan_n == 1) return 1;
+	for (k = 0; k < z->scan_n; ++k)
+		blocks += z->img_comp[z->order[k]].h * z->img_comp[z->order[k]].v;
+	return blocks;
+}
+
+// huffman decode the blocks of unit (i,j). with coeff set, the dequantized
+// blocks are stored there for stbi__jpeg_idct_unit, otherwise they are
+// transformed right away
+static int stbi__jpeg_decode_unit(stbi__jpeg * z, int i, int j, short * coeff)
+{
+	STBI_SIMD_ALIGN(short, blocks[128]);
+	stbi__idct_pending pending = { NULL, 0, NULL };
+	int k, x, y;
+	for (k = 0; k < z->scan_n; ++k) {
+		int n = z->order[k];
+		int bw = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+		int bh = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+		int ha = z->img_comp[n].ha;
+		for (y = 0; y < bh; ++y) {
+			for (x = 0; x < bw; ++x) {
+				short* data = coeff ? coeff : stbi__jpeg_idct_free_block(&pending, blocks);
+				if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+				if (coeff)
+					coeff += 64;
+				else
+					stbi__jpeg_idct_add(z, &pending, z->img_comp[n].data + z->img_comp[n].w2 * (j * bh + y) * 8 + (i * bw + x) * 8, z->img_comp[n].w2, data);
+			}
+		}
+	}
+	stbi__jpeg_idct_flush(z, &pending);
+	return 1;
+}
+
+// the caller flushes pending after its last unit
+static void stbi__jpeg_idct_unit(stbi__jpeg * z, stbi__idct_pending * pending, int i, int j, short * coeff)
+{
+	int k, x, y;
+	for (k = 0; k < z->scan_n; ++k) {
+		int n = z->order[k];
+		int bw = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+		int bh = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+		for (y = 0; y < bh; ++y)
+			for (x = 0; x < bw; ++x, coeff += 64)
+				stbi__jpeg_idct_add(z, pending, z->img_comp[n].data + z->img_comp[n].w2 * (j * bh + y) * 8 + (i * bw + x) * 8, z->img_comp[n].w2, coeff);
+	}
+}
+
+// restart intervals: the entropy coded data of the scan is read up front with
+// the restart markers taken out, then every interval is decoded on its own
+typedef struct
+{
+	stbi__jpeg* z;
+	stbi_uc* data;
+	int* start;           // interval k is data[start[k] .. start[k+1])
+	const char** reason;  // failure reason per task, NULL if it succeeded
+	int intervals, tasks;
+	int units_x, units;
+} stbi__jpeg_interval_job;
+
+static void stbi__jpeg_decode_intervals(void* user, int task)
+{
+	stbi__jpeg_interval_job* job = (stbi__jpeg_interval_job*)user;
+	// every task gets its own bit reader and dc predictors; the tables are copied
+	// along, which is cheap next to a share of the intervals
+	stbi__jpeg z = *job->z;
+	stbi__context s;
+	int k, first = (int)((size_t)job->intervals * task / job->tasks);
+	int last = (int)((size_t)job->intervals * (task + 1) / job->tasks);
+	z.s = &s;
+	job->reason[task] = NULL;
+	for (k = first; k < last; ++k) {
+		int unit = k * z.restart_interval;
+		int end = job->units - unit < z.restart_interval ? job->units : unit + z.restart_interval;
+		stbi__start_mem(&s, job->data + job->start[k], job->start[k + 1] - job->start[k]);
+		stbi__jpeg_reset(&z);
+		for (; unit < end; ++unit) {
+			if (!stbi__jpeg_decode_unit(&z, unit % job->units_x, unit / job->units_x, NULL)) {
+				job->reason[task] = stbi__g_failure_reason;
+				return;
+			}
+		}
+	}
+}
+
+static int stbi__jpeg_parse_intervals_parallel(stbi__jpeg * z)
+{
+	stbi__jpeg_interval_job job;
+	int size = 0, capacity, starts = 1, start_capacity, k, failed = 0;
+	stbi_uc* data;
+	int* start;
+
+	job.units_x = stbi__jpeg_units_x(z);
+	job.units = job.units_x * stbi__jpeg_units_y(z);
+	start_capacity = (job.units + z->restart_interval - 1) / z->restart_interval + 1;
+	capacity = z->s->read_from_callbacks ? 1 << 16 : (int)(z->s->img_buffer_end - z->s->img_buffer) + 1;
+	data = (stbi_uc*)stbi__malloc(capacity);
+	start = (int*)stbi__malloc_mad2(start_capacity, sizeof(int), 0);
+	if (!data || !start) {
+		STBI_FREE(data);
+		STBI_FREE(start);
+		return stbi__err("outofmem", "Out of memory");
+	}
+
+	// copy up to the first marker that is not a restart. stuffed 0xff 0x00 pairs
+	// stay, the bit reader undoes them
+	start[0] = 0;
+	for (;;) {
+		int c;
+		if (stbi__at_eof(z->s)) break;
+		c = stbi__get8(z->s);
+		if (c == 0xff) {
+			int m = stbi__get8(z->s);
+			while (m == 0xff) m = stbi__get8(z->s); // consume fill bytes
+			if (STBI__RESTART(m)) {
+				if (starts < start_capacity) start[starts++] = size;
+				continue;
+			}
+			if (m != 0) {
+				z->marker = (unsigned char)m;
+				break;
+			}
+		}
+		if (size + 2 > capacity) {
+			stbi_uc* grown = (stbi_uc*)STBI_REALLOC_SIZED(data, capacity, capacity * 2);
+			if (!grown) {
+				STBI_FREE(data);
+				STBI_FREE(start);
+				return stbi__err("outofmem", "Out of memory");
+			}
+			data = grown;
+			capacity *= 2;
+		}
+		data[size++] = (stbi_uc)c;
+		if (c == 0xff) data[size++] = 0;
+	}
+	start[starts] = size;
+
+	// a file cut short decodes the intervals it has, like the serial decoder
+	job.z = z;
+	job.data = data;
+	job.start = start;
+	job.intervals = starts;
+	job.tasks = STBI_PARALLEL_THREADS() * 4;
+	if (job.tasks > job.intervals) job.tasks = job.intervals;
+	job.reason = (const char**)stbi__malloc_mad2(job.tasks, sizeof(const char*), 0);
+	if (!job.reason) {
+		STBI_FREE(data);
+		STBI_FREE(start);
+		return stbi__err("outofmem", "Out of memory");
+	}
+	STBI_PARALLEL_FOR(job.tasks, stbi__jpeg_decode_intervals, &job);
+	for (k = 0; k < job.tasks; ++k) {
+		if (job.reason[k]) {
+			stbi__g_failure_reason = job.reason[k];
+			failed = 1;
+			break;
+		}
+	}
+	STBI_FREE(job.reason);
+	STBI_FREE(data);
+	STBI_FREE(start);
+	return !failed;
+}
+
+// no restart markers: task 0 huffman decodes the next band of unit rows into
+// one coefficient buffer while the other tasks transform the rows of the band
+// before it from the other buffer
+#define STBI__PIPELINE_BAND_ROWS 8
+
+typedef struct
+{
+	stbi__jpeg* z;
+	short* coeff[2];
+	int units_x, units_y, unit_blocks;
+	int decode_band, idct_band; // -1 for none
+	const char* reason;
+} stbi__jpeg_pipeline;
+
+static void stbi__jpeg_pipeline_task(void* user, int task)
+{
+	stbi__jpeg_pipeline* p = (stbi__jpeg_pipeline*)user;
+	int i, j, row_coeffs = p->units_x * p->unit_blocks * 64;
+	if (task == 0) {
+		int first = p->decode_band * STBI__PIPELINE_BAND_ROWS;
+		short* coeff = p->coeff[p->decode_band & 1];
+		if (p->decode_band < 0) return;
+		for (j = first; j < first + STBI__PIPELINE_BAND_ROWS && j < p->units_y; ++j) {
+			for (i = 0; i < p->units_x; ++i) {
+				if (!stbi__jpeg_decode_unit(p->z, i, j, coeff + (j - first) * row_coeffs + i * p->unit_blocks * 64)) {
+					p->reason = stbi__g_failure_reason;
+					return;
+				}
+			}
+		}
+	}
+	else {
+		short* coeff = p->coeff[p->idct_band & 1] + (task - 1) * row_coeffs;
+		stbi__idct_pending pending = { NULL, 0, NULL };
+		j = p->idct_band * STBI__PIPELINE_BAND_ROWS + task - 1;
+		if (p->idct_band < 0 || j >= p->units_y) return;
+		for (i = 0; i < p->units_x; ++i)
+			stbi__jpeg_idct_unit(p->z, &pending, i, j, coeff + i * p->unit_blocks * 64);
+		stbi__jpeg_idct_flush(p->z, &pending);
+	}
+}
+
+// returns -1 if the buffers could not be allocated, the serial decoder runs instead
+static int stbi__jpeg_parse_pipelined(stbi__jpeg * z)
+{
+	stbi__jpeg_pipeline p;
+	size_t band_bytes;
+	void* raw;
+	int band, bands;
+
+	p.z = z;
+	p.units_x = stbi__jpeg_units_x(z);
+	p.units_y = stbi__jpeg_units_y(z);
+	p.unit_blocks = stbi__jpeg_unit_blocks(z);
+	p.reason = NULL;
+	band_bytes = (size_t)p.units_x * p.unit_blocks * 64 * sizeof(short) * STBI__PIPELINE_BAND_ROWS;
+	raw = stbi__malloc(band_bytes * 2 + 15);
+	if (!raw) return -1;
+	// the SIMD IDCT loads its input aligned
+	p.coeff[0] = (short*)(((size_t)raw + 15) & ~(size_t)15);
+	p.coeff[1] = p.coeff[0] + band_bytes / sizeof(short);
+
+	bands = (p.units_y + STBI__PIPELINE_BAND_ROWS - 1) / STBI__PIPELINE_BAND_ROWS;
+	for (band = 0; band <= bands && !p.reason; ++band) {
+		p.decode_band = band < bands ? band : -1;
+		p.idct_band = band - 1;
+		STBI_PARALLEL_FOR(1 + STBI__PIPELINE_BAND_ROWS, stbi__jpeg_pipeline_task, &p);
+	}
+	STBI_FREE(raw);
+	if (p.reason) {
+		stbi__g_failure_reason = p.reason;
+		return 0;
+	}
+	return 1;
+}
+#endif // STBI_PARALLEL_FOR
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg * z)
 {
 	stbi__jpeg_reset(z);
+#ifdef STBI_PARALLEL_FOR
+	if (!z->progressive && stbi__jpeg_parallel_worthwhile(z)) {
+		int result;
+		if (z->restart_interval)
+			return stbi__jpeg_parse_intervals_parallel(z);
+		result = stbi__jpeg_parse_pipelined(z);
+		if (result >= 0)
+			return result;
+	}
+#endif
 	if (!z->progressive) {
+		// blocks go through the IDCT in pairs, so one is decoded while the
+		// other waits in the second buffer
+		STBI_SIMD_ALIGN(short, blocks[128]);
+		stbi__idct_pending pending = { NULL, 0, NULL };
 		if (z->scan_n == 1) {
 			int i, j;
-			STBI_SIMD_ALIGN(short, data[64]);
 			int n = z->order[0];
 			// non-interleaved data, we just need to process one block at a time,
 			// in trivial scanline order
@@ -2758,23 +3434,27 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg * z)
 			for (j = 0; j < h; ++j) {
 				for (i = 0; i < w; ++i) {
 					int ha = z->img_comp[n].ha;
+					short* data = stbi__jpeg_idct_free_block(&pending, blocks);
 					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+					stbi__jpeg_idct_add(z, &pending, z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
 					// every data block is an MCU, so countdown the restart interval
 					if (--z->todo <= 0) {
 						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
 						// if it's NOT a restart, then just bail, so we get corrupt data
 						// rather than no data
-						if (!STBI__RESTART(z->marker)) return 1;
+						if (!STBI__RESTART(z->marker)) {
+							stbi__jpeg_idct_flush(z, &pending);
+							return 1;
+						}
 						stbi__jpeg_reset(z);
 					}
 				}
 			}
+			stbi__jpeg_idct_flush(z, &pending);
 			return 1;
 		}
 		else { // interleaved
 			int i, j, k, x, y;
-			STBI_SIMD_ALIGN(short, data[64]);
 			for (j = 0; j < z->img_mcu_y; ++j) {
 				for (i = 0; i < z->img_mcu_x; ++i) {
 					// scan an interleaved mcu... process scan_n components in order
@@ -2787,8 +3467,9 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg * z)
 								int x2 = (i * z->img_comp[n].h + x) * 8;
 								int y2 = (j * z->img_comp[n].v + y) * 8;
 								int ha = z->img_comp[n].ha;
+								short* data = stbi__jpeg_idct_free_block(&pending, blocks);
 								if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-								z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
+								stbi__jpeg_idct_add(z, &pending, z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
 							}
 						}
 					}
@@ -2796,11 +3477,15 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg * z)
 					// so now count down the restart interval
 					if (--z->todo <= 0) {
 						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker)) return 1;
+						if (!STBI__RESTART(z->marker)) {
+							stbi__jpeg_idct_flush(z, &pending);
+							return 1;
+						}
 						stbi__jpeg_reset(z);
 					}
 				}
 			}
+			stbi__jpeg_idct_flush(z, &pending);
 			return 1;
 		}
 	}
@@ -2881,6 +3566,7 @@ static void stbi__jpeg_finish(stbi__jpeg * z)
 	if (z->progressive) {
 		// dequantize and idct the data
 		int i, j, n;
+		stbi__idct_pending pending = { NULL, 0, NULL };
 		for (n = 0; n < z->s->img_n; ++n) {
 			int w = (z->img_comp[n].x + 7) >> 3;
 			int h = (z->img_comp[n].y + 7) >> 3;
@@ -2888,10 +3574,11 @@ static void stbi__jpeg_finish(stbi__jpeg * z)
 				for (i = 0; i < w; ++i) {
 					short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
 					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+					stbi__jpeg_idct_add(z, &pending, z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
 				}
 			}
 		}
+		stbi__jpeg_idct_flush(z, &pending);
 	}
 }
 
@@ -3592,25 +4279,157 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc * out, stbi_uc const* y, stbi_uc con
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 upsampler on 16 pixels at a time, with a scalar tail
+static STBI__AVX2_TARGET stbi_uc * stbi__resample_row_hv_2_avx2(stbi_uc * out, stbi_uc * in_near, stbi_uc * in_far, int w, int hs)
+{
+	int i = 0, t0, t1;
+
+	if (w == 1) {
+		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+		return out;
+	}
+
+	t1 = 3 * in_near[0] + in_far[0];
+	for (; i < ((w - 1) & ~15); i += 16) {
+		// vertical pass, 3*x + y = 4*x + (y - x)
+		__m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_far + i)));
+		__m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_near + i)));
+		__m256i curr = _mm256_add_epi16(_mm256_slli_epi16(nearw, 2), _mm256_sub_epi16(farw, nearw));
+
+		// shift the row by a pixel across the lane boundary: alignr works per
+		// lane, so each lane gets the neighbouring lane (or zero) next to it
+		__m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+		__m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+		__m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+		__m256i next = _mm256_insert_epi16(nxt0, 3 * in_near[i + 16] + in_far[i + 16], 15);
+
+		// horizontal pass, even = cur*4 + (prev - cur), odd = cur*4 + (next - cur)
+		__m256i curb = _mm256_add_epi16(_mm256_slli_epi16(curr, 2), _mm256_set1_epi16(8));
+		__m256i even = _mm256_add_epi16(_mm256_sub_epi16(prev, curr), curb);
+		__m256i odd = _mm256_add_epi16(_mm256_sub_epi16(next, curr), curb);
+
+		// interleave and descale. lane 0 holds pixels 0..7, lane 1 pixels 8..15,
+		// so the packed result is already in order
+		__m256i de0 = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+		__m256i de1 = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+		_mm256_storeu_si256((__m256i*) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+		t1 = 3 * in_near[i + 15] + in_far[i + 15];
+	}
+
+	t0 = t1;
+	t1 = 3 * in_near[i] + in_far[i];
+	out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+	for (++i; i < w; ++i) {
+		t0 = t1;
+		t1 = 3 * in_near[i] + in_far[i];
+		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+
+// the sse2 colour conversion on 16 pixels at a time for step == 4, the rest
+// is left to the sse2 version
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc * out, stbi_uc const* y, stbi_uc const* pcb, stbi_uc const* pcr, int count, int step)
+{
+	int i = 0;
+	if (step == 4) {
+		__m256i signflip = _mm256_set1_epi16(0x80);
+		__m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+		__m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+		__m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+		__m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+		__m256i y_bias = _mm256_set1_epi16(128);
+		__m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+		for (; i + 15 < count; i += 16) {
+			// widen to short: y << 8 with the 128 bias below it, cr and cb
+			// flipped to signed and shifted up by 8
+			__m256i yw = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (y + i))), 8), y_bias);
+			__m256i crw = _mm256_slli_epi16(_mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (pcr + i))), signflip), 8);
+			__m256i cbw = _mm256_slli_epi16(_mm256_xor_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (pcb + i))), signflip), 8);
+
+			// color transform
+			__m256i yws = _mm256_srli_epi16(yw, 4);
+			__m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+			__m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+			__m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+			__m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+			__m256i rws = _mm256_add_epi16(cr0, yws);
+			__m256i gwt = _mm256_add_epi16(cb0, yws);
+			__m256i bws = _mm256_add_epi16(yws, cb1);
+			__m256i gws = _mm256_add_epi16(gwt, cr1);
+
+			// descale
+			__m256i rw = _mm256_srai_epi16(rws, 4);
+			__m256i bw = _mm256_srai_epi16(bws, 4);
+			__m256i gw = _mm256_srai_epi16(gws, 4);
+
+			// back to byte and interleave the channels, within each lane
+			__m256i brb = _mm256_packus_epi16(rw, bw);
+			__m256i gxb = _mm256_packus_epi16(gw, xw);
+			__m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+			__m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+			__m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0..3, 8..11
+			__m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4..7, 12..15
+
+			// store
+			_mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+			_mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+			out += 64;
+		}
+	}
+	stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
+STBIDEF int stbi_jpeg_simd_level(void)
+{
+#ifdef STBI_AVX2
+	if (stbi__avx2_available()) return 2;
+#endif
+#ifdef STBI_SSE2
+	if (stbi__sse2_available()) return 1;
+#endif
+#ifdef STBI_NEON
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg * j)
 {
+	int level = stbi_jpeg_simd_level();
+	if (stbi__jpeg_simd_limit >= 0 && level > stbi__jpeg_simd_limit) level = stbi__jpeg_simd_limit;
+
 	j->idct_block_kernel = stbi__idct_block;
+	j->idct_block2_kernel = NULL;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
-#ifdef STBI_SSE2
-	if (stbi__sse2_available()) {
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+	if (level >= 1) {
 		j->idct_block_kernel = stbi__idct_simd;
 		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
 		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 	}
 #endif
 
-#ifdef STBI_NEON
-	j->idct_block_kernel = stbi__idct_simd;
-	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+#ifdef STBI_AVX2
+	if (level >= 2) {
+		j->idct_block2_kernel = stbi__idct_avx2;
+		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+	}
 #endif
 }
 
@@ -3637,6 +4456,213 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 	return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
+// resample and colour convert output rows [begin, end) to output, which
+// points at row begin. res_comp holds the resampler state at row begin and is
+// advanced. some kernels write one byte past the last row
+// output is row begin, the rows are stride bytes apart. a row may be written
+// one byte past its end; with a negative stride that byte is the start of the
+// row above, which is put back
+static void stbi__jpeg_convert_rows(stbi__jpeg * z, stbi__resample * res_comp, stbi_uc ** linebuf, stbi_uc * output, ptrdiff_t stride, int n, int decode_n, int is_rgb, unsigned int begin, unsigned int end)
+{
+	int k;
+	unsigned int i, j;
+	stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
+	size_t row_bytes = (size_t)n * z->s->img_x;
+	for (j = begin; j < end; ++j) {
+		stbi_uc* out = output + stride * (ptrdiff_t)(j - begin);
+		stbi_uc* row = out;
+		stbi_uc kept = stride < 0 ? row[row_bytes] : 0;
+		for (k = 0; k < decode_n; ++k) {
+			stbi__resample* r = &res_comp[k];
+			int y_bot = r->ystep >= (r->vs >> 1);
+			coutput[k] = r->resample(linebuf[k],
+				y_bot ? r->line1 : r->line0,
+				y_bot ? r->line0 : r->line1,
+				r->w_lores, r->hs);
+			if (++r->ystep >= r->vs) {
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < z->img_comp[k].y)
+					r->line1 += z->img_comp[k].w2;
+			}
+		}
+		if (n >= 3) {
+			stbi_uc* y = coutput[0];
+			if (z->s->img_n == 3) {
+				if (is_rgb) {
+					for (i = 0; i < z->s->img_x; ++i) {
+						out[0] = y[i];
+						out[1] = coutput[1][i];
+						out[2] = coutput[2][i];
+						out[3] = 255;
+						out += n;
+					}
+				}
+				else {
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else if (z->s->img_n == 4) {
+				if (z->app14_color_transform == 0) { // CMYK
+					for (i = 0; i < z->s->img_x; ++i) {
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(coutput[0][i], m);
+						out[1] = stbi__blinn_8x8(coutput[1][i], m);
+						out[2] = stbi__blinn_8x8(coutput[2][i], m);
+						out[3] = 255;
+						out += n;
+					}
+				}
+				else if (z->app14_color_transform == 2) { // YCCK
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+					for (i = 0; i < z->s->img_x; ++i) {
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(255 - out[0], m);
+						out[1] = stbi__blinn_8x8(255 - out[1], m);
+						out[2] = stbi__blinn_8x8(255 - out[2], m);
+						out += n;
+					}
+				}
+				else { // YCbCr + alpha?  Ignore the fourth channel for now
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = out[1] = out[2] = y[i];
+					out[3] = 255; // not used if n==3
+					out += n;
+				}
+		}
+		else {
+			if (is_rgb) {
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i)
+						* out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+				else {
+					for (i = 0; i < z->s->img_x; ++i, out += 2) {
+						out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+						out[1] = 255;
+					}
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+					stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+					stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+					out[0] = stbi__compute_y(r, g, b);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else {
+				stbi_uc* y = coutput[0];
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+				else
+					for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+			}
+		}
+		if (stride < 0)
+			row[row_bytes] = kept;
+	}
+}
+
+// converts rows [begin, end) of an image whose row 0 is at row0. the one row
+// whose overhanging byte would land outside the band (the last one going
+// down, the first one going up) is converted into scratch and copied
+static void stbi__jpeg_convert_band(stbi__jpeg * z, stbi__resample * res_comp, stbi_uc ** linebuf, stbi_uc * row0, ptrdiff_t stride, stbi_uc * scratch, int n, int decode_n, int is_rgb, unsigned int begin, unsigned int end)
+{
+	size_t row_bytes = (size_t)n * z->s->img_x;
+	if (begin == end) return;
+	if (stride > 0) {
+		stbi__jpeg_convert_rows(z, res_comp, linebuf, row0 + stride * (ptrdiff_t)begin, stride, n, decode_n, is_rgb, begin, end - 1);
+		stbi__jpeg_convert_rows(z, res_comp, linebuf, scratch, stride, n, decode_n, is_rgb, end - 1, end);
+		memcpy(row0 + stride * (ptrdiff_t)(end - 1), scratch, row_bytes);
+	}
+	else {
+		stbi__jpeg_convert_rows(z, res_comp, linebuf, scratch, stride, n, decode_n, is_rgb, begin, begin + 1);
+		memcpy(row0 + stride * (ptrdiff_t)begin, scratch, row_bytes);
+		stbi__jpeg_convert_rows(z, res_comp, linebuf, row0 + stride * (ptrdiff_t)(begin + 1), stride, n, decode_n, is_rgb, begin + 1, end);
+	}
+}
+
+#ifdef STBI_PARALLEL_FOR
+// every task converts a band of output rows with its own line buffers. the
+// edge row of a band goes through a scratch row, since writing one byte past
+// it would race with the neighbouring band
+typedef struct
+{
+	stbi__jpeg* z;
+	stbi__resample* res_comp; // state at row 0
+	stbi_uc* row0, * linebuf;
+	ptrdiff_t stride;
+	size_t task_bytes;        // line buffers and scratch row of one task
+	int n, decode_n, is_rgb, tasks;
+} stbi__jpeg_convert_job;
+
+static void stbi__jpeg_convert_task(void* user, int task)
+{
+	stbi__jpeg_convert_job* job = (stbi__jpeg_convert_job*)user;
+	stbi__jpeg* z = job->z;
+	stbi__resample res_comp[4];
+	stbi_uc* linebuf[4];
+	unsigned int begin = (unsigned int)((size_t)z->s->img_y * task / job->tasks);
+	unsigned int end = (unsigned int)((size_t)z->s->img_y * (task + 1) / job->tasks);
+	stbi_uc* task_buffer = job->linebuf + job->task_bytes * task;
+	stbi_uc* scratch = task_buffer + (size_t)job->decode_n * (z->s->img_x + 3);
+	unsigned int j;
+	int k;
+	if (begin == end) return;
+	for (k = 0; k < job->decode_n; ++k) {
+		stbi__resample* r = &res_comp[k];
+		*r = job->res_comp[k];
+		linebuf[k] = task_buffer + (size_t)k * (z->s->img_x + 3);
+		// replay the row stepping of the rows above the band
+		for (j = 0; j < begin; ++j) {
+			if (++r->ystep >= r->vs) {
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < z->img_comp[k].y)
+					r->line1 += z->img_comp[k].w2;
+			}
+		}
+	}
+	stbi__jpeg_convert_band(z, res_comp, linebuf, job->row0, job->stride, scratch, job->n, job->decode_n, job->is_rgb, begin, end);
+}
+
+// returns 0 if the line buffers could not be allocated
+static int stbi__jpeg_convert_parallel(stbi__jpeg * z, stbi__resample * res_comp, stbi_uc * row0, ptrdiff_t stride, int n, int decode_n, int is_rgb)
+{
+	stbi__jpeg_convert_job job;
+	job.tasks = STBI_PARALLEL_THREADS() * 4;
+	if ((unsigned int)job.tasks > z->s->img_y / 16) job.tasks = z->s->img_y / 16; // bands of at least 16 rows
+	if (job.tasks < 1) job.tasks = 1;
+	job.task_bytes = (size_t)decode_n * (z->s->img_x + 3) + (size_t)n * z->s->img_x + 1;
+	job.linebuf = (stbi_uc*)stbi__malloc_mad2(job.tasks, (int)job.task_bytes, 0);
+	if (!job.linebuf) return 0;
+	job.z = z;
+	job.res_comp = res_comp;
+	job.row0 = row0;
+	job.stride = stride;
+	job.n = n;
+	job.decode_n = decode_n;
+	job.is_rgb = is_rgb;
+	STBI_PARALLEL_FOR(job.tasks, stbi__jpeg_convert_task, &job);
+	STBI_FREE(job.linebuf);
+	return 1;
+}
+#endif
+
 static stbi_uc * load_jpeg_image(stbi__jpeg * z, int* out_x, int* out_y, int* comp, int req_comp)
 {
 	int n, decode_n, is_rgb;
@@ -3661,9 +4687,9 @@ static stbi_uc * load_jpeg_image(stbi__jpeg * z, int* out_x, int* out_y, int* co
 	// resample and color-convert
 	{
 		int k;
-		unsigned int i, j;
-		stbi_uc* output;
-		stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
+		stbi_uc* output, * row0, * scratch;
+		size_t row_bytes = (size_t)n * z->s->img_x;
+		ptrdiff_t stride;
 
 		stbi__resample res_comp[4];
 
@@ -3689,114 +4715,38 @@ static stbi_uc * load_jpeg_image(stbi__jpeg * z, int* out_x, int* out_y, int* co
 			else                               r->resample = stbi__resample_row_generic;
 		}
 
+		scratch = (stbi_uc*)stbi__malloc_mad2(n, z->s->img_x, 1);
+		if (!scratch) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
 		// can't error after this so, this is safe
-		output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+		if (z->s->out_dest) {
+			if (!stbi__mad3sizes_valid(n, z->s->img_x, z->s->img_y, 0) || z->s->out_dest_size < row_bytes * z->s->img_y) {
+				STBI_FREE(scratch);
+				stbi__cleanup_jpeg(z);
+				return stbi__errpuc("dest too small", "Destination buffer too small");
+			}
+			output = z->s->out_dest;
+		}
+		else {
+			output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+			if (!output) { STBI_FREE(scratch); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+		}
+
+		// rows go straight to their final place, bottom-up when flipping
+		stride = z->s->out_flip ? -(ptrdiff_t)row_bytes : (ptrdiff_t)row_bytes;
+		row0 = z->s->out_flip ? output + row_bytes * (z->s->img_y - 1) : output;
 
 		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j) {
-			stbi_uc* out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k) {
-				stbi__resample* r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
-				coutput[k] = r->resample(z->img_comp[k].linebuf,
-					y_bot ? r->line1 : r->line0,
-					y_bot ? r->line0 : r->line1,
-					r->w_lores, r->hs);
-				if (++r->ystep >= r->vs) {
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
-			}
-			if (n >= 3) {
-				stbi_uc* y = coutput[0];
-				if (z->s->img_n == 3) {
-					if (is_rgb) {
-						for (i = 0; i < z->s->img_x; ++i) {
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else {
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else if (z->s->img_n == 4) {
-					if (z->app14_color_transform == 0) { // CMYK
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2) { // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else { // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
-						out += n;
-					}
-			}
-			else {
-				if (is_rgb) {
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							* out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else {
-						for (i = 0; i < z->s->img_x; ++i, out += 2) {
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else {
-					stbi_uc* y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-				}
-			}
+#ifdef STBI_PARALLEL_FOR
+		if (!stbi__jpeg_parallel_worthwhile(z) || !stbi__jpeg_convert_parallel(z, res_comp, row0, stride, n, decode_n, is_rgb))
+#endif
+		{
+			stbi_uc* linebuf[4];
+			for (k = 0; k < decode_n; ++k)
+				linebuf[k] = z->img_comp[k].linebuf;
+			stbi__jpeg_convert_band(z, res_comp, linebuf, row0, stride, scratch, n, decode_n, is_rgb, 0, z->s->img_y);
 		}
+		STBI_FREE(scratch);
 		stbi__cleanup_jpeg(z);
 		*out_x = z->s->img_x;
 		*out_y = z->s->img_y;
@@ -3809,10 +4759,10 @@ static void* stbi__jpeg_load(stbi__context * s, int* x, int* y, int* comp, int r
 {
 	unsigned char* result;
 	stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
-	STBI_NOTUSED(ri);
 	j->s = s;
 	stbi__setup_jpeg(j);
 	result = load_jpeg_image(j, x, y, comp, req_comp);
+	if (result) ri->flipped = s->out_flip;
 	STBI_FREE(j);
 	return result;
 }
@@ -3857,14 +4807,32 @@ static int stbi__jpeg_info(stbi__context * s, int* x, int* y, int* comp)
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
-//      - fast huffman
+//      - fast huffman, with one-probe tables for literal pairs and for
+//        lengths and distances with their extra bits
+//      - 64-bit bit buffer, refilled 8 bytes at a time
+//      - matches copied in 8 or 16 byte chunks where they don't overlap
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most literal pairs
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
+// the bit buffer is refilled 8 bytes at a time with an unaligned load where
+// that is a little-endian load
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define STBI__ZLOAD64
+#endif
+
+// entries of the one-probe tables of stbi__zbuf. bits 0-7 are the bits the
+// entry consumes, bits 8-9 its kind, bits 16-31 its value
+#define STBI__ZENTRY_MISS     0  // code longer than STBI__ZFAST_BITS, decode the slow way
+#define STBI__ZENTRY_LITERAL  1  // literal in bits 16-23, a second one in bits 24-31 if STBI__ZENTRY_PAIR is set
+#define STBI__ZENTRY_VALUE    2  // length or distance with its extra bits already added
+#define STBI__ZENTRY_SYMBOL   3  // symbol whose extra bits did not fit, or end of block
+#define STBI__ZENTRY_PAIR     (1 << 10)
+#define STBI__ZENTRY(bits, kind, value)  ((stbi__uint32) (bits) | ((stbi__uint32) (kind) << 8) | ((stbi__uint32) (value) << 16))
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -3951,7 +4919,7 @@ typedef struct
 {
 	stbi_uc* zbuffer, * zbuffer_end;
 	int num_bits;
-	stbi__uint32 code_buffer;
+	stbi__uint64 code_buffer;
 
 	char* zout;
 	char* zout_start;
@@ -3959,6 +4927,10 @@ typedef struct
 	int   z_expandable;
 
 	stbi__zhuffman z_length, z_distance;
+	// literal/length and distance codes with their extra bits, or two
+	// literals, resolved in one lookup
+	stbi__uint32 fast_length[1 << STBI__ZFAST_BITS];
+	stbi__uint32 fast_distance[1 << STBI__ZFAST_BITS];
 } stbi__zbuf;
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf * z)
@@ -3970,17 +4942,37 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf * z)
 static void stbi__fill_bits(stbi__zbuf * z)
 {
 	do {
-		STBI_ASSERT(z->code_buffer < (1U << z->num_bits));
-		z->code_buffer |= (unsigned int)stbi__zget8(z) << z->num_bits;
+		STBI_ASSERT(z->code_buffer < ((stbi__uint64)1 << z->num_bits));
+		z->code_buffer |= (stbi__uint64)stbi__zget8(z) << z->num_bits;
 		z->num_bits += 8;
-	} while (z->num_bits <= 24);
+	} while (z->num_bits <= 56);
+}
+
+// tops the bit buffer up to at least 56 bits, enough for a length and a
+// distance code with their extra bits
+stbi_inline static void stbi__zrefill(stbi__zbuf * z)
+{
+#ifdef STBI__ZLOAD64
+	if (z->zbuffer_end - z->zbuffer >= 8) {
+		// take as many whole bytes as fit; the bits of a partial byte are
+		// masked off and read again by the next refill
+		stbi__uint64 v;
+		int bits = z->num_bits | 56;
+		memcpy(&v, z->zbuffer, 8);
+		z->code_buffer = (z->code_buffer | (v << z->num_bits)) & (((stbi__uint64)1 << bits) - 1);
+		z->zbuffer += (bits - z->num_bits) >> 3;
+		z->num_bits = bits;
+		return;
+	}
+#endif
+	if (z->num_bits <= 56) stbi__fill_bits(z);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf * z, int n)
 {
 	unsigned int k;
 	if (z->num_bits < n) stbi__fill_bits(z);
-	k = z->code_buffer & ((1 << n) - 1);
+	k = (unsigned int)(z->code_buffer & ((1 << n) - 1));
 	z->code_buffer >>= n;
 	z->num_bits -= n;
 	return k;
@@ -3991,7 +4983,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf * a, stbi__zhuffman * z)
 	int b, s, k;
 	// not resolved by fast table, so compute it the slow way
 	// use jpeg approach, which requires MSbits at top
-	k = stbi__bit_reverse(a->code_buffer, 16);
+	k = stbi__bit_reverse((int)(a->code_buffer & 0xffff), 16);
 	for (s = STBI__ZFAST_BITS + 1; ; ++s)
 		if (k < z->maxcode[s])
 			break;
@@ -4008,7 +5000,7 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf * a, stbi__zhuffman * z)
 {
 	int b, s;
 	if (a->num_bits < 16) stbi__fill_bits(a);
-	b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
+	b = z->fast[(int)(a->code_buffer & STBI__ZFAST_MASK)];
 	if (b) {
 		s = b >> 9;
 		a->code_buffer >>= s;
@@ -4026,8 +5018,11 @@ static int stbi__zexpand(stbi__zbuf * z, char* zout, int n)  // need to make roo
 	if (!z->z_expandable) return stbi__err("output buffer limit", "Corrupt PNG");
 	cur = (int)(z->zout - z->zout_start);
 	limit = old_limit = (int)(z->zout_end - z->zout_start);
-	while (cur + n > limit)
+	if (INT_MAX - cur < n) return stbi__err("outofmem", "Out of memory");
+	while (cur + n > limit) {
+		if (limit > INT_MAX / 2) return stbi__err("outofmem", "Out of memory");
 		limit *= 2;
+	}
 	q = (char*)STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
 	STBI_NOTUSED(old_limit);
 	if (q == NULL) return stbi__err("outofmem", "Out of memory");
@@ -4051,46 +5046,147 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
 
+// fills the one-probe tables from the single symbol fast tables, which see
+// STBI__ZFAST_BITS bits as well
+static void stbi__zbuild_fast_codes(stbi__zbuf * a)
+{
+	int j;
+	for (j = 0; j < (1 << STBI__ZFAST_BITS); ++j) {
+		int b = a->z_length.fast[j];
+		int s = b >> 9, v = b & 511;
+		stbi__uint32 e = STBI__ZENTRY_MISS;
+		if (b && v < 256) {
+			// a literal; if the next code is a literal that fits as well, take both
+			int b2 = a->z_length.fast[j >> s];
+			int s2 = b2 >> 9, v2 = b2 & 511;
+			if (b2 && s + s2 <= STBI__ZFAST_BITS && v2 < 256)
+				e = STBI__ZENTRY(s + s2, STBI__ZENTRY_LITERAL, v | (v2 << 8)) | STBI__ZENTRY_PAIR;
+			else
+				e = STBI__ZENTRY(s, STBI__ZENTRY_LITERAL, v);
+		}
+		else if (b && v > 256 && v < 286 && s + stbi__zlength_extra[v - 257] <= STBI__ZFAST_BITS) {
+			int extra = stbi__zlength_extra[v - 257];
+			e = STBI__ZENTRY(s + extra, STBI__ZENTRY_VALUE, stbi__zlength_base[v - 257] + ((j >> s) & ((1 << extra) - 1)));
+		}
+		else if (b) {
+			e = STBI__ZENTRY(s, STBI__ZENTRY_SYMBOL, v);
+		}
+		a->fast_length[j] = e;
+
+		b = a->z_distance.fast[j];
+		s = b >> 9;
+		v = b & 511;
+		e = STBI__ZENTRY_MISS;
+		if (b && v < 30 && s + stbi__zdist_extra[v] <= STBI__ZFAST_BITS) {
+			int extra = stbi__zdist_extra[v];
+			e = STBI__ZENTRY(s + extra, STBI__ZENTRY_VALUE, stbi__zdist_base[v] + ((j >> s) & ((1 << extra) - 1)));
+		}
+		else if (b) {
+			e = STBI__ZENTRY(s, STBI__ZENTRY_SYMBOL, v);
+		}
+		a->fast_distance[j] = e;
+	}
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf * a)
 {
 	char* zout = a->zout;
 	for (;;) {
-		int z = stbi__zhuffman_decode(a, &a->z_length);
-		if (z < 256) {
-			if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
-			if (zout >= a->zout_end) {
-				if (!stbi__zexpand(a, zout, 1)) return 0;
+		stbi__uint32 e;
+		stbi_uc* p;
+		int z, len, dist;
+		// 48 bits cover a length and a distance code with their extra bits,
+		// so a refill lasts for several literals
+		if (a->num_bits < 48) stbi__zrefill(a);
+		e = a->fast_length[(int)(a->code_buffer & STBI__ZFAST_MASK)];
+		if (((e >> 8) & 3) == STBI__ZENTRY_LITERAL) {
+			int count = 1 + ((e & STBI__ZENTRY_PAIR) != 0);
+			a->code_buffer >>= e & 255;
+			a->num_bits -= e & 255;
+			if (zout + count > a->zout_end) {
+				if (!stbi__zexpand(a, zout, count)) return 0;
 				zout = a->zout;
 			}
-			*zout++ = (char)z;
+			*zout++ = (char)(e >> 16);
+			if (count == 2) *zout++ = (char)(e >> 24);
+			continue;
+		}
+		if (((e >> 8) & 3) == STBI__ZENTRY_VALUE) {
+			a->code_buffer >>= e & 255;
+			a->num_bits -= e & 255;
+			len = (int)(e >> 16);
 		}
 		else {
-			stbi_uc* p;
-			int len, dist;
+			if (e) {
+				a->code_buffer >>= e & 255;
+				a->num_bits -= e & 255;
+				z = (int)(e >> 16);
+			}
+			else {
+				z = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+			}
+			if (z < 256) {
+				if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
+				if (zout >= a->zout_end) {
+					if (!stbi__zexpand(a, zout, 1)) return 0;
+					zout = a->zout;
+				}
+				*zout++ = (char)z;
+				continue;
+			}
 			if (z == 256) {
 				a->zout = zout;
 				return 1;
 			}
+			if (z >= 286) return stbi__err("bad huffman code", "Corrupt PNG"); // per DEFLATE, length codes 286 and 287 must not appear in compressed data
 			z -= 257;
 			len = stbi__zlength_base[z];
 			if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
-			z = stbi__zhuffman_decode(a, &a->z_distance);
-			if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG");
-			dist = stbi__zdist_base[z];
-			if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
-			if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
-			if (zout + len > a->zout_end) {
-				if (!stbi__zexpand(a, zout, len)) return 0;
-				zout = a->zout;
-			}
-			p = (stbi_uc*)(zout - dist);
-			if (dist == 1) { // run of one byte; common in images.
-				stbi_uc v = *p;
-				if (len) { do *zout++ = v; while (--len); }
+		}
+
+		e = a->fast_distance[(int)(a->code_buffer & STBI__ZFAST_MASK)];
+		if (((e >> 8) & 3) == STBI__ZENTRY_VALUE) {
+			a->code_buffer >>= e & 255;
+			a->num_bits -= e & 255;
+			dist = (int)(e >> 16);
+		}
+		else {
+			if (e) {
+				a->code_buffer >>= e & 255;
+				a->num_bits -= e & 255;
+				z = (int)(e >> 16);
 			}
 			else {
-				if (len) { do *zout++ = *p++; while (--len); }
+				z = stbi__zhuffman_decode_slowpath(a, &a->z_distance);
 			}
+			if (z < 0 || z >= 30) return stbi__err("bad huffman code", "Corrupt PNG"); // per DEFLATE, distance codes 30 and 31 must not appear in compressed data
+			dist = stbi__zdist_base[z];
+			if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
+		}
+		if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
+		if (zout + len > a->zout_end) {
+			if (!stbi__zexpand(a, zout, len)) return 0;
+			zout = a->zout;
+		}
+		p = (stbi_uc*)(zout - dist);
+		if (dist == 1) { // run of one byte; common in images.
+			memset(zout, *p, len);
+			zout += len;
+		}
+		else if (dist >= 16 && zout + len + 16 <= a->zout_end) {
+			// the source stays at least a chunk behind, so whole chunks can be
+			// copied and the last one may run past the match into free space
+			char* end = zout + len;
+			do { memcpy(zout, p, 16); zout += 16; p += 16; } while (zout < end);
+			zout = end;
+		}
+		else if (dist >= 8 && zout + len + 8 <= a->zout_end) {
+			char* end = zout + len;
+			do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < end);
+			zout = end;
+		}
+		else {
+			if (len) { do *zout++ = *p++; while (--len); }
 		}
 	}
 }
@@ -4153,21 +5249,27 @@ static int stbi__parse_uncompressed_block(stbi__zbuf * a)
 		stbi__zreceive(a, a->num_bits & 7); // discard
 	 // drain the bit-packed data into header
 	k = 0;
-	while (a->num_bits > 0) {
+	while (a->num_bits > 0 && k < 4) {
 		header[k++] = (stbi_uc)(a->code_buffer & 255); // suppress MSVC run-time check
 		a->code_buffer >>= 8;
 		a->num_bits -= 8;
 	}
-	STBI_ASSERT(a->num_bits == 0);
 	// now fill header the normal way
 	while (k < 4)
 		header[k++] = stbi__zget8(a);
 	len = header[1] * 256 + header[0];
 	nlen = header[3] * 256 + header[2];
 	if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt", "Corrupt PNG");
-	if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer", "Corrupt PNG");
 	if (a->zout + len > a->zout_end)
 		if (!stbi__zexpand(a, a->zout, len)) return 0;
+	// the 64-bit bit buffer can hold the first bytes of the block already
+	while (a->num_bits > 0 && len > 0) {
+		*a->zout++ = (char)(a->code_buffer & 255);
+		a->code_buffer >>= 8;
+		a->num_bits -= 8;
+		--len;
+	}
+	if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer", "Corrupt PNG");
 	memcpy(a->zout, a->zbuffer, len);
 	a->zbuffer += len;
 	a->zout += len;
@@ -4240,6 +5342,7 @@ static int stbi__parse_zlib(stbi__zbuf * a, int parse_header)
 			else {
 				if (!stbi__compute_huffman_codes(a)) return 0;
 			}
+			stbi__zbuild_fast_codes(a);
 			if (!stbi__parse_huffman_block(a)) return 0;
 		}
 	} while (!final);
@@ -4344,6 +5447,7 @@ STBIDEF int stbi_zlib_decode_noheader_buffer(char* obuffer, int olen, const char
 //        - avoids explicit window management
 //    performance
 //      - uses stb_zlib, a PD zlib implementation with fast huffman decoding
+//      - sse2 unfiltering of 8-bit rows with 3 or 4 bytes per pixel
 
 #ifndef STBI_NO_PNG
 typedef struct
@@ -4410,6 +5514,88 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+// a 3 or 4 byte pixel in the low bytes of a register; with 3 bytes per pixel
+// the fourth byte belongs to the next pixel and is left alone
+static __m128i stbi__png_load_pixel(const stbi_uc * p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+static void stbi__png_store_pixel(stbi_uc * p, __m128i v)
+{
+	int x = _mm_cvtsi128_si32(v);
+	memcpy(p, &x, 4);
+}
+
+// sse2 unfiltering of the bytes after the first pixel of a row, like the
+// scalar loops in stbi__create_png_image_raw. up works on 16 bytes at a time,
+// the others carry a dependency from pixel to pixel, so they work on one
+// pixel of 3 or 4 bytes at a time. returns how many bytes it did, the scalar
+// loop does the rest
+static int stbi__png_unfilter_simd(stbi_uc * cur, const stbi_uc * raw, const stbi_uc * prior, int nk, int filter_bytes, int filter)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a, b, c;
+	int k = 0, end;
+	if (filter == STBI__F_up) {
+		for (; k + 16 <= nk; k += 16)
+			_mm_storeu_si128((__m128i*) (cur + k), _mm_add_epi8(_mm_loadu_si128((const __m128i*) (raw + k)), _mm_loadu_si128((const __m128i*) (prior + k))));
+		return k;
+	}
+	if (filter_bytes != 3 && filter_bytes != 4) return 0;
+	// 4 byte accesses to the last pixel of a 3 byte row would run past it
+	end = (nk / filter_bytes - (filter_bytes == 3)) * filter_bytes;
+	// the first pixel is loaded with 4 bytes as well, which a row of a single 3 byte pixel doesn't have
+	if (end <= 0) return 0;
+	a = stbi__png_load_pixel(cur - filter_bytes);
+	switch (filter) {
+	case STBI__F_sub:
+	case STBI__F_paeth_first: // paeth(a, 0, 0) is a
+		for (; k < end; k += filter_bytes) {
+			a = _mm_add_epi8(a, stbi__png_load_pixel(raw + k));
+			stbi__png_store_pixel(cur + k, a);
+		}
+		break;
+	case STBI__F_avg:
+	case STBI__F_avg_first:
+		for (; k < end; k += filter_bytes) {
+			// avg_epu8 rounds up, (a + b) >> 1 rounds down
+			b = filter == STBI__F_avg ? stbi__png_load_pixel(prior + k) : zero;
+			b = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(b, stbi__png_load_pixel(raw + k));
+			stbi__png_store_pixel(cur + k, a);
+		}
+		break;
+	case STBI__F_paeth:
+		// in 16 bits: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, ties go to a, then b
+		a = _mm_unpacklo_epi8(a, zero);
+		c = _mm_unpacklo_epi8(stbi__png_load_pixel(prior - filter_bytes), zero);
+		for (; k < end; k += filter_bytes) {
+			__m128i pa, pb, pc, smallest, nearest, x;
+			b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior + k), zero);
+			pa = _mm_sub_epi16(b, c);
+			pb = _mm_sub_epi16(a, c);
+			pc = _mm_add_epi16(pa, pb);
+			pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+			pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+			pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			nearest = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(smallest, pb), b), _mm_andnot_si128(_mm_cmpeq_epi16(smallest, pb), c));
+			nearest = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(smallest, pa), a), _mm_andnot_si128(_mm_cmpeq_epi16(smallest, pa), nearest));
+			x = _mm_add_epi8(_mm_packus_epi16(nearest, nearest), stbi__png_load_pixel(raw + k));
+			stbi__png_store_pixel(cur + k, x);
+			a = _mm_unpacklo_epi8(x, zero);
+			c = b;
+		}
+		break;
+	}
+	return k;
+}
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png * a, stbi_uc * raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4423,6 +5609,9 @@ static int stbi__create_png_image_raw(stbi__png * a, stbi_uc * raw, stbi__uint32
 	int output_bytes = out_n * bytes;
 	int filter_bytes = img_n * bytes;
 	int width = x;
+#ifdef STBI_SSE2
+	int simd = stbi__sse2_available();
+#endif
 
 	STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
 	a->out = (stbi_uc*)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4494,9 +5683,14 @@ static int stbi__create_png_image_raw(stbi__png * a, stbi_uc * raw, stbi__uint32
 		// this is a little gross, so that we don't switch per-pixel or per-component
 		if (depth < 8 || img_n == out_n) {
 			int nk = (width - 1) * filter_bytes;
+			int done = 0;
+#ifdef STBI_SSE2
+			if (simd && filter != STBI__F_none)
+				done = stbi__png_unfilter_simd(cur, raw, prior, nk, filter_bytes, filter);
+#endif
 #define STBI__CASE(f) \
              case f:     \
-                for (k=0; k < nk; ++k)
+                for (k=done; k < nk; ++k)
 			switch (filter) {
 				// "none" filter turns into a memcpy here; make that explicit.
 			case STBI__F_none:         memcpy(cur, raw, nk); break;
@@ -4825,6 +6019,27 @@ static void stbi__de_iphone(stbi__png * z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+// bytes of filtered scanlines, filter bytes included, that the zlib stream of
+// an image inflates to, so its output can be allocated once at the final size
+static stbi__uint32 stbi__png_raw_size(stbi__uint32 img_x, stbi__uint32 img_y, int img_n, int depth, int interlace)
+{
+	static const int xorig[] = { 0,4,0,2,0,1,0 };
+	static const int yorig[] = { 0,0,4,0,2,0,1 };
+	static const int xspc[] = { 8,8,4,4,2,2,1 };
+	static const int yspc[] = { 8,8,8,4,4,2,2 };
+	stbi__uint32 size = 0, x, y;
+	int p;
+	if (!interlace)
+		return ((((img_n * img_x * depth) + 7) >> 3) + 1) * img_y;
+	for (p = 0; p < 7; ++p) {
+		x = (img_x - xorig[p] + xspc[p] - 1) / xspc[p];
+		y = (img_y - yorig[p] + yspc[p] - 1) / yspc[p];
+		if (x && y)
+			size += ((((img_n * x * depth) + 7) >> 3) + 1) * y;
+	}
+	return size;
+}
+
 static int stbi__parse_png_file(stbi__png * z, int scan, int req_comp)
 {
 	stbi_uc palette[1024], pal_img_n = 0;
@@ -4926,7 +6141,12 @@ static int stbi__parse_png_file(stbi__png * z, int scan, int req_comp)
 			if (ioff + c.length > idata_limit) {
 				stbi__uint32 idata_limit_old = idata_limit;
 				stbi_uc* p;
-				if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
+				if (idata_limit == 0) {
+					idata_limit = c.length > 4096 ? c.length : 4096;
+					// from memory the rest of the file bounds all IDATs together, so one allocation holds them
+					if (!s->read_from_callbacks && (size_t)(s->img_buffer_end - s->img_buffer) > idata_limit)
+						idata_limit = (stbi__uint32)(s->img_buffer_end - s->img_buffer);
+				}
 				while (ioff + c.length > idata_limit)
 					idata_limit *= 2;
 				STBI_NOTUSED(idata_limit_old);
@@ -4939,13 +6159,13 @@ static int stbi__parse_png_file(stbi__png * z, int scan, int req_comp)
 		}
 
 		case STBI__PNG_TYPE('I', 'E', 'N', 'D'): {
-			stbi__uint32 raw_len, bpl;
+			stbi__uint32 raw_len;
 			if (first) return stbi__err("first not IHDR", "Corrupt PNG");
 			if (scan != STBI__SCAN_load) return 1;
 			if (z->idata == NULL) return stbi__err("no IDAT", "Corrupt PNG");
-			// initial guess for decoded data size to avoid unnecessary reallocs
-			bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-			raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+			// exact decoded data size, so the output never needs to be reallocated
+			raw_len = stbi__png_raw_size(s->img_x, s->img_y, s->img_n, z->depth, interlace);
+			if (raw_len > INT_MAX) return stbi__err("too large", "Very large image (corrupt?)");
 			z->expanded = (stbi_uc*)stbi_zlib_decode_malloc_guesssize_headerflag((char*)z->idata, ioff, raw_len, (int*)& raw_len, !is_iphone);
 			if (z->expanded == NULL) return 0; // zlib should set error
 			STBI_FREE(z->idata); z->idata = NULL;